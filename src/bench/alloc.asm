@@ -0,0 +1,32 @@
+# alloc.asm
+# Copyright (c) 2024 Ishan Pranav
+# Licensed under the MIT license.
+# Allocation and abandonment of small, medium and large arrays.
+# r7 counts down the iterations and r5 holds 0xffffffff.
+li    r7 $0x100000
+nand  r5 r0 r0
+li    r6 $0x3
+# Loop body, unrolled 2 times.
+li    r2 $0x3
+alloc r3 r2
+li    r2 $0x28
+alloc r4 r2
+free  r3
+li    r2 $0x400
+alloc r3 r2
+free  r4
+free  r3
+li    r2 $0x3
+alloc r3 r2
+li    r2 $0x28
+alloc r4 r2
+free  r3
+li    r2 $0x400
+alloc r3 r2
+free  r4
+free  r3
+add   r7 r7 r5
+li    r1 $0x19
+cmov  r1 r6 r7
+load  r0 r1
+halt
@@ -0,0 +1,56 @@
+# load.asm
+# Copyright (c) 2024 Ishan Pranav
+# Licensed under the MIT license.
+# Loads of a large array that the program then writes to, so that every
+# load is followed by a full copy.
+# r7 counts down the iterations and r5 holds 0xffffffff.
+li    r7 $0x200
+nand  r5 r0 r0
+li    r2 $0x40000
+alloc r3 r2
+# Copy the loop at the end of the program to the start of array r3.
+li    r4 $0x26
+getp  r2 r0 r4
+li    r4 $0x0
+setp  r3 r4 r2
+li    r4 $0x27
+getp  r2 r0 r4
+li    r4 $0x1
+setp  r3 r4 r2
+li    r4 $0x28
+getp  r2 r0 r4
+li    r4 $0x2
+setp  r3 r4 r2
+li    r4 $0x29
+getp  r2 r0 r4
+li    r4 $0x3
+setp  r3 r4 r2
+li    r4 $0x2a
+getp  r2 r0 r4
+li    r4 $0x4
+setp  r3 r4 r2
+li    r4 $0x2b
+getp  r2 r0 r4
+li    r4 $0x5
+setp  r3 r4 r2
+li    r4 $0x2c
+getp  r2 r0 r4
+li    r4 $0x6
+setp  r3 r4 r2
+li    r4 $0x2d
+getp  r2 r0 r4
+li    r4 $0x7
+setp  r3 r4 r2
+# The loop writes past its own end, inside the zeroed part of the array.
+li    r4 $0x20000
+load  r3 r0
+# Loop body. While r7 is nonzero, load array r3 at offset 0; otherwise
+# jump to the halt instruction.
+setp  r0 r4 r0
+add   r7 r7 r5
+li    r1 $0x7
+li    r2 $0x0
+cmov  r1 r0 r7
+cmov  r2 r3 r7
+load  r2 r1
+halt
@@ -0,0 +1,23 @@
+# mul.asm
+# Copyright (c) 2024 Ishan Pranav
+# Licensed under the MIT license.
+# Multiplications.
+# r7 counts down the iterations and r5 holds 0xffffffff.
+li    r7 $0x400000
+nand  r5 r0 r0
+li    r6 $0x4
+li    r4 $0x3
+# Loop body, unrolled 8 times.
+mul   r4 r4 r7
+mul   r4 r4 r7
+mul   r4 r4 r7
+mul   r4 r4 r7
+mul   r4 r4 r7
+mul   r4 r4 r7
+mul   r4 r4 r7
+mul   r4 r4 r7
+add   r7 r7 r5
+li    r1 $0x10
+cmov  r1 r6 r7
+load  r0 r1
+halt
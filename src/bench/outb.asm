@@ -0,0 +1,23 @@
+# outb.asm
+# Copyright (c) 2024 Ishan Pranav
+# Licensed under the MIT license.
+# Byte output.
+# r7 counts down the iterations and r5 holds 0xffffffff.
+li    r7 $0x400000
+nand  r5 r0 r0
+li    r6 $0x4
+li    r2 $0x78
+# Loop body, unrolled 8 times.
+outb  r2
+outb  r2
+outb  r2
+outb  r2
+outb  r2
+outb  r2
+outb  r2
+outb  r2
+add   r7 r7 r5
+li    r1 $0x10
+cmov  r1 r6 r7
+load  r0 r1
+halt
@@ -0,0 +1,25 @@
+# selfmod.asm
+# Copyright (c) 2024 Ishan Pranav
+# Licensed under the MIT license.
+# Writes to array 0 that rewrite the loop with its own instructions.
+# r7 counts down the iterations and r5 holds 0xffffffff.
+li    r7 $0x400000
+nand  r5 r0 r0
+li    r6 $0x5
+li    r4 $0x5
+getp  r2 r0 r4
+# Loop body, unrolled 8 times. Each write replaces the first instruction
+# of the loop with itself.
+setp  r0 r4 r2
+setp  r0 r4 r2
+setp  r0 r4 r2
+setp  r0 r4 r2
+setp  r0 r4 r2
+setp  r0 r4 r2
+setp  r0 r4 r2
+setp  r0 r4 r2
+add   r7 r7 r5
+li    r1 $0x11
+cmov  r1 r6 r7
+load  r0 r1
+halt
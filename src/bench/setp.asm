@@ -0,0 +1,24 @@
+# setp.asm
+# Copyright (c) 2024 Ishan Pranav
+# Licensed under the MIT license.
+# Array writes.
+# r7 counts down the iterations and r5 holds 0xffffffff.
+li    r7 $0x400000
+nand  r5 r0 r0
+li    r6 $0x5
+li    r2 $0x10
+alloc r3 r2
+# Loop body, unrolled 8 times.
+setp  r3 r0 r7
+setp  r3 r0 r7
+setp  r3 r0 r7
+setp  r3 r0 r7
+setp  r3 r0 r7
+setp  r3 r0 r7
+setp  r3 r0 r7
+setp  r3 r0 r7
+add   r7 r7 r5
+li    r1 $0x11
+cmov  r1 r6 r7
+load  r0 r1
+halt
@@ -0,0 +1,15 @@
+# free_twice.asm
+# Copyright (c) 2024 Ishan Pranav
+# Licensed under the MIT license.
+# Frees an array a second time after it was merged into both free neighbours.
+# The machine must stop with an invalid free rather than reuse the block.
+li    r1 $0xa
+alloc r2 r1
+alloc r3 r1
+alloc r4 r1
+alloc r5 r1
+free  r2
+free  r4
+free  r3
+free  r3
+halt
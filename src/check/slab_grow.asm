@@ -0,0 +1,22 @@
+# slab_grow.asm
+# Copyright (c) 2024 Ishan Pranav
+# Licensed under the MIT license.
+# Writes 'A' into a 4-word array, then allocates 70000 more until the slab
+# holding them outgrows the heap and moves into a mapping. The machine must
+# still print 'A'.
+# r7 counts down the iterations and r5 holds 0xffffffff.
+li    r1 $0x4
+alloc r2 r1
+li    r3 $0x41
+setp  r2 r0 r3
+li    r7 $0x11170
+nand  r5 r0 r0
+li    r6 $0x7
+alloc r4 r1
+add   r7 r7 r5
+li    r4 $0xc
+cmov  r4 r6 r7
+load  r0 r4
+getp  r3 r2 r0
+outb  r3
+halt
@@ -0,0 +1,334 @@
+// checkpoint.c
+// Copyright (c) 2024 Ishan Pranav
+// Licensed under the MIT license.
+
+// http://boundvariable.org
+
+// A checkpoint file is a header followed by a sequence of sections. Each
+// section is a record giving its kind and size in bytes, followed by that many
+// bytes of host-endian data, padded so that every record and its data start on
+// a UM32_CHECKPOINT_ALIGNMENT boundary. The header records the format version
+// and a byte-order mark, and files from other versions or hosts are rejected.
+
+// Because nothing is encoded, a checkpoint is read by mapping the whole file
+// and copying each section into place. Streams that cannot be mapped are read
+// into memory first.
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define UM32_CHECKPOINT_MAP
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "checkpoint.h"
+#define UM32_CHECKPOINT_CHUNK 0x10000
+#define um32_checkpoint_align(size) \
+    (((size) + UM32_CHECKPOINT_ALIGNMENT - 1) & \
+        ~(uint64_t)(UM32_CHECKPOINT_ALIGNMENT - 1))
+
+static bool checkpoint_pad(Checkpoint instance)
+{
+    static const uint8_t PADDING[UM32_CHECKPOINT_ALIGNMENT];
+    uint64_t padding = um32_checkpoint_align(instance->offset) -
+        instance->offset;
+
+    if (fwrite(PADDING, 1, padding, instance->output) != padding)
+    {
+        return false;
+    }
+
+    instance->offset += padding;
+
+    return true;
+}
+
+bool checkpoint_writer(Checkpoint instance, FILE* output)
+{
+    struct CheckpointHeader header =
+    {
+        .version = UM32_CHECKPOINT_VERSION,
+        .byteOrder = UM32_CHECKPOINT_BYTE_ORDER
+    };
+
+    memcpy(header.magic, UM32_CHECKPOINT_MAGIC, sizeof header.magic);
+
+    instance->output = output;
+    instance->offset = 0;
+    instance->view = NULL;
+    instance->size = 0;
+    instance->mapped = false;
+
+    if (fwrite(&header, sizeof header, 1, output) != 1)
+    {
+        return false;
+    }
+
+    instance->offset = sizeof header;
+
+    return checkpoint_pad(instance);
+}
+
+bool checkpoint_write(
+    Checkpoint instance,
+    CheckpointSection section,
+    const void* buffer,
+    uint64_t size)
+{
+    struct CheckpointRecord record =
+    {
+        .section = section,
+        .size = size
+    };
+
+    if (fwrite(&record, sizeof record, 1, instance->output) != 1)
+    {
+        return false;
+    }
+
+    instance->offset += sizeof record;
+
+    if (!checkpoint_pad(instance) ||
+        fwrite(buffer, 1, size, instance->output) != size)
+    {
+        return false;
+    }
+
+    instance->offset += size;
+
+    return checkpoint_pad(instance);
+}
+
+bool checkpoint_write_segment(
+    Checkpoint instance,
+    Segment segment,
+    uint32_t length)
+{
+    return checkpoint_write(
+        instance,
+        CHECKPOINT_SECTION_SEGMENT,
+        segment->buffer,
+        (uint64_t)length * sizeof * segment->buffer);
+}
+
+#ifdef UM32_CHECKPOINT_MAP
+static bool checkpoint_map(Checkpoint instance, FILE* input)
+{
+    struct stat status;
+    int descriptor = fileno(input);
+
+    if (fstat(descriptor, &status) != 0 ||
+        !S_ISREG(status.st_mode) ||
+        !status.st_size)
+    {
+        return false;
+    }
+
+    uint8_t* view = mmap(
+        NULL,
+        status.st_size,
+        PROT_READ,
+        MAP_PRIVATE,
+        descriptor,
+        0);
+
+    if (view == MAP_FAILED)
+    {
+        return false;
+    }
+
+#ifdef MADV_SEQUENTIAL
+    madvise(view, status.st_size, MADV_SEQUENTIAL);
+#endif
+
+    instance->view = view;
+    instance->size = status.st_size;
+    instance->mapped = true;
+
+    return true;
+}
+#endif
+
+static bool checkpoint_load(Checkpoint instance, FILE* input)
+{
+    uint64_t capacity = 0;
+    size_t length;
+
+    do
+    {
+        if (instance->size == capacity)
+        {
+            uint8_t* view;
+
+            capacity += UM32_CHECKPOINT_CHUNK;
+            view = realloc(instance->view, capacity);
+
+            if (!view)
+            {
+                return false;
+            }
+
+            instance->view = view;
+        }
+
+        length = fread(
+            instance->view + instance->size,
+            1,
+            capacity - instance->size,
+            input);
+
+        instance->size += length;
+    }
+    while (length);
+
+    return !ferror(input);
+}
+
+bool checkpoint_reader(Checkpoint instance, FILE* input)
+{
+    instance->output = NULL;
+    instance->offset = 0;
+    instance->view = NULL;
+    instance->size = 0;
+    instance->mapped = false;
+
+#ifdef UM32_CHECKPOINT_MAP
+    if (!checkpoint_map(instance, input) && !checkpoint_load(instance, input))
+#else
+    if (!checkpoint_load(instance, input))
+#endif
+    {
+        finalize_checkpoint(instance);
+
+        return false;
+    }
+
+    struct CheckpointHeader header;
+
+    if (instance->size < sizeof header)
+    {
+        finalize_checkpoint(instance);
+
+        errno = EINVAL;
+
+        return false;
+    }
+
+    memcpy(&header, instance->view, sizeof header);
+
+    if (memcmp(header.magic, UM32_CHECKPOINT_MAGIC, sizeof header.magic) != 0 ||
+        header.version != UM32_CHECKPOINT_VERSION ||
+        header.byteOrder != UM32_CHECKPOINT_BYTE_ORDER)
+    {
+        finalize_checkpoint(instance);
+
+        errno = EINVAL;
+
+        return false;
+    }
+
+    instance->offset = um32_checkpoint_align(sizeof header);
+
+    return true;
+}
+
+const void* checkpoint_read(
+    Checkpoint instance,
+    CheckpointSection section,
+    uint64_t* size)
+{
+    struct CheckpointRecord record;
+    uint64_t offset = instance->offset;
+
+    if (offset > instance->size || instance->size - offset < sizeof record)
+    {
+        errno = EINVAL;
+
+        return NULL;
+    }
+
+    memcpy(&record, instance->view + offset, sizeof record);
+
+    offset = um32_checkpoint_align(offset + sizeof record);
+
+    if (record.section != section ||
+        offset > instance->size ||
+        instance->size - offset < record.size)
+    {
+        errno = EINVAL;
+
+        return NULL;
+    }
+
+    instance->offset = um32_checkpoint_align(offset + record.size);
+    *size = record.size;
+
+    return instance->view + offset;
+}
+
+bool checkpoint_read_segment(
+    Checkpoint instance,
+    Segment segment,
+    uint32_t capacity)
+{
+    uint64_t size;
+    const void* buffer = checkpoint_read(
+        instance,
+        CHECKPOINT_SECTION_SEGMENT,
+        &size);
+
+    if (!buffer)
+    {
+        return false;
+    }
+
+    uint64_t length = size / sizeof * segment->buffer;
+
+    if (length > UINT32_MAX)
+    {
+        errno = EINVAL;
+
+        return false;
+    }
+
+    if (capacity < length)
+    {
+        capacity = length;
+    }
+
+    if (!segment_ensure_capacity(segment, capacity))
+    {
+        return false;
+    }
+
+    memcpy(segment->buffer, buffer, length * sizeof * segment->buffer);
+
+    segment->length = length;
+
+    return true;
+}
+
+void finalize_checkpoint(Checkpoint instance)
+{
+    if (!instance->view)
+    {
+        return;
+    }
+
+#ifdef UM32_CHECKPOINT_MAP
+    if (instance->mapped)
+    {
+        munmap(instance->view, instance->size);
+    }
+    else
+#endif
+    {
+        free(instance->view);
+    }
+
+    instance->view = NULL;
+    instance->size = 0;
+    instance->mapped = false;
+}
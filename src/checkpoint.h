@@ -0,0 +1,82 @@
+// checkpoint.h
+// Copyright (c) 2024 Ishan Pranav
+// Licensed under the MIT license.
+
+// http://boundvariable.org
+
+#ifndef UM32_CHECKPOINT
+#define UM32_CHECKPOINT
+#include <stdio.h>
+#include "segment.h"
+#define UM32_CHECKPOINT_MAGIC "UM32CKPT"
+#define UM32_CHECKPOINT_VERSION 1
+#define UM32_CHECKPOINT_BYTE_ORDER 0x01020304
+#define UM32_CHECKPOINT_ALIGNMENT 16
+
+enum CheckpointSection
+{
+    CHECKPOINT_SECTION_MACHINE = 1,
+    CHECKPOINT_SECTION_INPUT,
+    CHECKPOINT_SECTION_PROGRAM,
+    CHECKPOINT_SECTION_HEAP,
+    CHECKPOINT_SECTION_SEGMENT,
+    CHECKPOINT_SECTION_SLAB,
+    CHECKPOINT_SECTION_CHUNKS,
+    CHECKPOINT_SECTION_CHUNK
+};
+
+typedef enum CheckpointSection CheckpointSection;
+
+struct CheckpointHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+};
+
+struct CheckpointRecord
+{
+    uint32_t section;
+    uint32_t reserved;
+    uint64_t size;
+};
+
+struct Checkpoint
+{
+    FILE* output;
+    uint64_t offset;
+    uint8_t* view;
+    uint64_t size;
+    bool mapped;
+};
+
+typedef struct Checkpoint* Checkpoint;
+
+bool checkpoint_writer(Checkpoint instance, FILE* output);
+
+bool checkpoint_write(
+    Checkpoint instance,
+    CheckpointSection section,
+    const void* buffer,
+    uint64_t size);
+
+bool checkpoint_write_segment(
+    Checkpoint instance,
+    Segment segment,
+    uint32_t length);
+
+bool checkpoint_reader(Checkpoint instance, FILE* input);
+
+const void* checkpoint_read(
+    Checkpoint instance,
+    CheckpointSection section,
+    uint64_t* size);
+
+bool checkpoint_read_segment(
+    Checkpoint instance,
+    Segment segment,
+    uint32_t capacity);
+
+void finalize_checkpoint(Checkpoint instance);
+
+#endif
@@ -0,0 +1,408 @@
+// chunk_table.c
+// Copyright (c) 2024 Ishan Pranav
+// Licensed under the MIT license.
+
+// http://boundvariable.org
+
+// A chunk table gives every array its own allocation, prefixed by a word
+// holding its capacity. Identifiers index a two-level table whose pages are
+// allocated on demand and never move, so neither allocation nor table growth
+// ever copies existing arrays. Free entries hold the next free identifier,
+// shifted left and tagged with the low bit.
+
+// Chunks of at least UM32_CHUNK_TABLE_MAPPED words are mapped directly from
+// the kernel, so their zero pages are only touched once written and freeing
+// them unmaps the memory at once.
+
+#ifdef __linux__
+#include <sys/mman.h>
+#define UM32_CHUNK_TABLE_MAP
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "chunk_table.h"
+#define um32_chunk_table_page(id) ((id) / UM32_CHUNK_TABLE_PAGE)
+#define um32_chunk_table_entry(instance, id) \
+    ((instance)->pages[um32_chunk_table_page(id)] + \
+        (id) % UM32_CHUNK_TABLE_PAGE)
+
+void chunk_table(ChunkTable instance)
+{
+    instance->pages = NULL;
+    instance->count = 1;
+    instance->free = 0;
+    instance->huge = false;
+}
+
+static uint32_t* chunk_table_new(ChunkTable instance, uint32_t capacity)
+{
+#ifdef UM32_CHUNK_TABLE_MAP
+    if (capacity >= UM32_CHUNK_TABLE_MAPPED)
+    {
+        size_t size = ((size_t)capacity + 1) * sizeof(uint32_t);
+        uint32_t* chunk = mmap(
+            NULL,
+            size,
+            PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS,
+            -1,
+            0);
+
+        if (chunk == MAP_FAILED)
+        {
+            return NULL;
+        }
+
+#ifdef MADV_HUGEPAGE
+        if (instance->huge)
+        {
+            madvise(chunk, size, MADV_HUGEPAGE);
+        }
+#endif
+
+        return chunk;
+    }
+#else
+    (void)instance;
+#endif
+
+    return calloc((size_t)capacity + 1, sizeof(uint32_t));
+}
+
+static void chunk_table_delete(uint32_t* chunk)
+{
+#ifdef UM32_CHUNK_TABLE_MAP
+    if (*chunk >= UM32_CHUNK_TABLE_MAPPED)
+    {
+        munmap(chunk, ((size_t)*chunk + 1) * sizeof * chunk);
+
+        return;
+    }
+#endif
+
+    free(chunk);
+}
+
+static bool chunk_table_reserve(ChunkTable instance, uint32_t id)
+{
+    if (!instance->pages)
+    {
+        instance->pages = calloc(
+            UM32_CHUNK_TABLE_PAGES,
+            sizeof * instance->pages);
+
+        if (!instance->pages)
+        {
+            return false;
+        }
+    }
+
+    uintptr_t** page = instance->pages + um32_chunk_table_page(id);
+
+    if (!*page)
+    {
+        *page = malloc(UM32_CHUNK_TABLE_PAGE * sizeof ** page);
+
+        if (!*page)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+uint32_t chunk_table_allocate(ChunkTable instance, uint32_t capacity)
+{
+    uint32_t id = instance->free;
+
+    if (!id)
+    {
+        id = instance->count;
+
+        if (id >= UM32_CHUNK_TABLE_IDS || !chunk_table_reserve(instance, id))
+        {
+            return 0;
+        }
+    }
+
+    uint32_t* chunk = chunk_table_new(instance, capacity);
+
+    if (!chunk)
+    {
+        return 0;
+    }
+
+    uintptr_t* entry = um32_chunk_table_entry(instance, id);
+
+    if (id == instance->free)
+    {
+        instance->free = *entry >> 1;
+    }
+    else
+    {
+        instance->count++;
+    }
+
+    *chunk = capacity;
+    *entry = (uintptr_t)chunk;
+
+    return id;
+}
+
+uint32_t* chunk_table_chunk(ChunkTable instance, uint32_t id)
+{
+    if (!id || id >= instance->count)
+    {
+        return NULL;
+    }
+
+    uintptr_t entry = *um32_chunk_table_entry(instance, id);
+
+    if (entry & 1)
+    {
+        return NULL;
+    }
+
+    return (uint32_t*)entry;
+}
+
+uint32_t* chunk_table_index(
+    ChunkTable instance,
+    uint32_t id,
+    uint32_t offset,
+    uint32_t* length)
+{
+    uint32_t* chunk = chunk_table_chunk(instance, id);
+
+    if (!chunk || offset >= *chunk)
+    {
+        return NULL;
+    }
+
+    if (length)
+    {
+        *length = *chunk;
+    }
+
+    return chunk + 1 + offset;
+}
+
+bool chunk_table_free(ChunkTable instance, uint32_t id)
+{
+    uint32_t* chunk = chunk_table_chunk(instance, id);
+
+    if (!chunk)
+    {
+        return false;
+    }
+
+    uintptr_t* entry = um32_chunk_table_entry(instance, id);
+
+    chunk_table_delete(chunk);
+
+    *entry = ((uintptr_t)instance->free << 1) | 1;
+    instance->free = id;
+
+    return true;
+}
+
+bool chunk_table_checkpoint(Checkpoint checkpoint, ChunkTable instance)
+{
+    // The table is saved as its count and free list head, followed by one
+    // entry per identifier: the capacity shifted left for a live chunk, or
+    // the tagged free entry itself. Each live chunk then follows in order.
+
+    uint64_t size = ((uint64_t)instance->count + 1) * sizeof(uint64_t);
+    uint64_t* entries = malloc(size);
+
+    if (!entries)
+    {
+        return false;
+    }
+
+    entries[0] = instance->count;
+    entries[1] = instance->free;
+
+    for (uint32_t id = 1; id < instance->count; id++)
+    {
+        uintptr_t entry = *um32_chunk_table_entry(instance, id);
+
+        if (entry & 1)
+        {
+            entries[id + 1] = entry;
+        }
+        else
+        {
+            entries[id + 1] = (uint64_t)*(uint32_t*)entry << 1;
+        }
+    }
+
+    bool result = checkpoint_write(
+        checkpoint,
+        CHECKPOINT_SECTION_CHUNKS,
+        entries,
+        size);
+
+    free(entries);
+
+    for (uint32_t id = 1; result && id < instance->count; id++)
+    {
+        uint32_t* chunk = chunk_table_chunk(instance, id);
+
+        if (chunk)
+        {
+            result = checkpoint_write(
+                checkpoint,
+                CHECKPOINT_SECTION_CHUNK,
+                chunk + 1,
+                (uint64_t)*chunk * sizeof * chunk);
+        }
+    }
+
+    return result;
+}
+
+bool chunk_table_restore(ChunkTable instance, Checkpoint checkpoint)
+{
+    uint64_t size;
+    const uint64_t* entries = checkpoint_read(
+        checkpoint,
+        CHECKPOINT_SECTION_CHUNKS,
+        &size);
+
+    if (!entries)
+    {
+        return false;
+    }
+
+    if (size < 2 * sizeof * entries ||
+        entries[0] < 1 ||
+        entries[0] > UM32_CHUNK_TABLE_IDS ||
+        size != (entries[0] + 1) * sizeof * entries ||
+        entries[1] >= entries[0])
+    {
+        errno = EINVAL;
+
+        return false;
+    }
+
+    uint32_t count = entries[0];
+
+    // The free list must run through free identifiers alone and end, or the
+    // allocator would hand out live arrays or loop.
+
+    uint32_t next = entries[1];
+
+    for (uint32_t step = 1; next; step++)
+    {
+        uint64_t entry = entries[next + 1];
+
+        if (!(entry & 1) || entry >> 1 >= count || step >= count)
+        {
+            errno = EINVAL;
+
+            return false;
+        }
+
+        next = entry >> 1;
+    }
+
+    // Identifiers are restored one at a time, so that a failure leaves a table
+    // that can still be finalized.
+
+    for (uint32_t id = 1; id < count; id++)
+    {
+        uint64_t entry = entries[id + 1];
+
+        if (!chunk_table_reserve(instance, id))
+        {
+            return false;
+        }
+
+        if (entry & 1)
+        {
+            if (entry >> 1 >= count)
+            {
+                errno = EINVAL;
+
+                return false;
+            }
+
+            *um32_chunk_table_entry(instance, id) = entry;
+            instance->count = id + 1;
+
+            continue;
+        }
+
+        uint32_t capacity = entry >> 1;
+        const uint32_t* words = checkpoint_read(
+            checkpoint,
+            CHECKPOINT_SECTION_CHUNK,
+            &size);
+
+        if (!words)
+        {
+            return false;
+        }
+
+        if (size != (uint64_t)capacity * sizeof * words)
+        {
+            errno = EINVAL;
+
+            return false;
+        }
+
+        uint32_t* chunk = chunk_table_new(instance, capacity);
+
+        if (!chunk)
+        {
+            return false;
+        }
+
+        *chunk = capacity;
+
+        memcpy(chunk + 1, words, size);
+
+        *um32_chunk_table_entry(instance, id) = (uintptr_t)chunk;
+        instance->count = id + 1;
+    }
+
+    instance->free = entries[1];
+
+    return true;
+}
+
+void finalize_chunk_table(ChunkTable instance)
+{
+    if (!instance->pages)
+    {
+        return;
+    }
+
+    for (uint32_t id = 1; id < instance->count; id++)
+    {
+        uint32_t* chunk = chunk_table_chunk(instance, id);
+
+        if (chunk)
+        {
+            chunk_table_delete(chunk);
+        }
+    }
+
+    for (uint32_t i = 0; i < UM32_CHUNK_TABLE_PAGES; i++)
+    {
+        if (instance->pages[i])
+        {
+            free(instance->pages[i]);
+        }
+    }
+
+    free(instance->pages);
+
+    instance->pages = NULL;
+    instance->count = 1;
+    instance->free = 0;
+}
@@ -0,0 +1,42 @@
+// chunk_table.h
+// Copyright (c) 2024 Ishan Pranav
+// Licensed under the MIT license.
+
+// http://boundvariable.org
+
+#ifndef UM32_CHUNK_TABLE
+#define UM32_CHUNK_TABLE
+#include <stdbool.h>
+#include <stdint.h>
+#include "checkpoint.h"
+#define UM32_CHUNK_TABLE_IDS 0x80000000u
+#define UM32_CHUNK_TABLE_PAGE 4096
+#define UM32_CHUNK_TABLE_PAGES (UM32_CHUNK_TABLE_IDS / UM32_CHUNK_TABLE_PAGE)
+#define UM32_CHUNK_TABLE_MAPPED 0x40000
+
+struct ChunkTable
+{
+    uintptr_t** pages;
+    uint32_t count;
+    uint32_t free;
+    bool huge;
+};
+
+typedef struct ChunkTable* ChunkTable;
+
+void chunk_table(ChunkTable instance);
+uint32_t chunk_table_allocate(ChunkTable instance, uint32_t capacity);
+uint32_t* chunk_table_chunk(ChunkTable instance, uint32_t id);
+
+uint32_t* chunk_table_index(
+    ChunkTable instance,
+    uint32_t id,
+    uint32_t offset,
+    uint32_t* length);
+
+bool chunk_table_free(ChunkTable instance, uint32_t id);
+bool chunk_table_checkpoint(Checkpoint checkpoint, ChunkTable instance);
+bool chunk_table_restore(ChunkTable instance, Checkpoint checkpoint);
+void finalize_chunk_table(ChunkTable instance);
+
+#endif
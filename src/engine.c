@@ -0,0 +1,38 @@
+// engine.c
+// Copyright (c) 2024 Ishan Pranav
+// Licensed under the MIT license.
+
+// http://boundvariable.org
+
+#include <string.h>
+#include "engine.h"
+
+static const char* ENGINES_STRINGS[ENGINES_COUNT] =
+{
+    [ENGINE_SWITCH] = "switch",
+    [ENGINE_THREADED] = "threaded",
+    [ENGINE_JIT] = "jit"
+};
+
+const char* engine_to_string(Engine value)
+{
+    if (value < 0 || value >= ENGINES_COUNT)
+    {
+        return "unknown";
+    }
+
+    return ENGINES_STRINGS[value];
+}
+
+Engine engine_from_string(const char* value)
+{
+    for (Engine engine = 0; engine < ENGINES_COUNT; engine++)
+    {
+        if (strcmp(value, ENGINES_STRINGS[engine]) == 0)
+        {
+            return engine;
+        }
+    }
+
+    return ENGINES_COUNT;
+}
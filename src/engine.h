@@ -0,0 +1,23 @@
+// engine.h
+// Copyright (c) 2024 Ishan Pranav
+// Licensed under the MIT license.
+
+// http://boundvariable.org
+
+#ifndef UM32_ENGINE
+#define UM32_ENGINE
+
+enum Engine
+{
+    ENGINE_SWITCH = 0,
+    ENGINE_THREADED = 1,
+    ENGINE_JIT = 2,
+    ENGINES_COUNT
+};
+
+typedef enum Engine Engine;
+
+const char* engine_to_string(Engine value);
+Engine engine_from_string(const char* value);
+
+#endif
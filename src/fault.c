@@ -21,6 +21,7 @@ static const char* FAULTS_STRINGS[FAULTS_COUNT] =
     [FAULT_MISSING_WRITER] = "missing writer",
     [FAULT_NO_OPERATION] = "no-op",
     [FAULT_OUT_OF_MEMORY] = "out of memory",
+    [FAULT_SUSPENDED] = "suspended",
 };
 
 const char* fault_to_string(Fault value)
@@ -22,6 +22,7 @@ enum Fault
     FAULT_MISSING_WRITER,
     FAULT_NO_OPERATION,
     FAULT_OUT_OF_MEMORY,
+    FAULT_SUSPENDED,
     FAULTS_COUNT
 };
 
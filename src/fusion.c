@@ -0,0 +1,199 @@
+// fusion.c
+// Copyright (c) 2024 Ishan Pranav
+// Licensed under the MIT license.
+
+// http://boundvariable.org
+
+#include "fusion.h"
+
+static const uint32_t FUSION_LENGTHS[SUPERINSTRUCTIONS_COUNT] =
+{
+    [SUPERINSTRUCTION_NOT] = 1,
+    [SUPERINSTRUCTION_NEGATE] = 3,
+    [SUPERINSTRUCTION_SUBTRACT] = 4,
+    [SUPERINSTRUCTION_JUMP] = 3,
+    [SUPERINSTRUCTION_IMMEDIATE_JUMP] = 2,
+    [SUPERINSTRUCTION_BRANCH] = 4
+};
+
+static bool fusion_is_not(Operation sequence)
+{
+    return sequence[0].opcode == OPCODE_NAND &&
+        sequence[0].b == sequence[0].c;
+}
+
+// nand t y y; li u 1; add t t u
+
+static bool fusion_is_negate(Operation sequence)
+{
+    uint8_t t = sequence[0].a;
+    uint8_t u = sequence[1].a;
+
+    return fusion_is_not(sequence) &&
+        sequence[1].opcode == OPCODE_IMMEDIATE &&
+        sequence[1].immediate == 1 &&
+        u != t &&
+        sequence[2].opcode == OPCODE_ADD &&
+        sequence[2].a == t &&
+        ((sequence[2].b == t && sequence[2].c == u) ||
+            (sequence[2].b == u && sequence[2].c == t));
+}
+
+// nand t y y; li u 1; add t t u; add x z t
+
+static bool fusion_is_subtract(Operation sequence)
+{
+    uint8_t t = sequence[0].a;
+
+    return fusion_is_negate(sequence) &&
+        sequence[3].opcode == OPCODE_ADD &&
+        (sequence[3].b == t || sequence[3].c == t);
+}
+
+// li t k; li z 0; load z t
+
+static bool fusion_is_jump(Operation sequence)
+{
+    uint8_t t = sequence[0].a;
+    uint8_t z = sequence[1].a;
+
+    return sequence[0].opcode == OPCODE_IMMEDIATE &&
+        sequence[1].opcode == OPCODE_IMMEDIATE &&
+        sequence[2].opcode == OPCODE_LOAD &&
+        (sequence[2].b == t || sequence[2].b == z) &&
+        (sequence[2].c == t || sequence[2].c == z);
+}
+
+// li t k; load z t
+
+static bool fusion_is_immediate_jump(Operation sequence)
+{
+    return sequence[0].opcode == OPCODE_IMMEDIATE &&
+        sequence[1].opcode == OPCODE_LOAD &&
+        sequence[1].c == sequence[0].a;
+}
+
+// li t k; li u j; cmov t u c; load z t
+
+static bool fusion_is_branch(Operation sequence)
+{
+    uint8_t t = sequence[0].a;
+
+    return sequence[0].opcode == OPCODE_IMMEDIATE &&
+        sequence[1].opcode == OPCODE_IMMEDIATE &&
+        sequence[2].opcode == OPCODE_CONDITIONAL_MOVE &&
+        sequence[2].a == t &&
+        sequence[2].b == sequence[1].a &&
+        sequence[3].opcode == OPCODE_LOAD &&
+        sequence[3].c == t;
+}
+
+bool fusion_match(
+    uint32_t* program,
+    uint32_t length,
+    uint32_t offset,
+    Superinstruction* result)
+{
+    if (offset >= length)
+    {
+        return false;
+    }
+
+    struct Operation sequence[UM32_FUSION_WINDOW];
+    uint32_t count = length - offset;
+
+    if (count > UM32_FUSION_WINDOW)
+    {
+        count = UM32_FUSION_WINDOW;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        operation(sequence + i, program[offset + i]);
+    }
+
+    for (uint32_t i = count; i < UM32_FUSION_WINDOW; i++)
+    {
+        operation_terminate(sequence + i);
+    }
+
+    if (fusion_is_subtract(sequence))
+    {
+        *result = SUPERINSTRUCTION_SUBTRACT;
+    }
+    else if (fusion_is_negate(sequence))
+    {
+        *result = SUPERINSTRUCTION_NEGATE;
+    }
+    else if (fusion_is_not(sequence))
+    {
+        *result = SUPERINSTRUCTION_NOT;
+    }
+    else if (fusion_is_branch(sequence))
+    {
+        *result = SUPERINSTRUCTION_BRANCH;
+    }
+    else if (fusion_is_jump(sequence))
+    {
+        *result = SUPERINSTRUCTION_JUMP;
+    }
+    else if (fusion_is_immediate_jump(sequence))
+    {
+        *result = SUPERINSTRUCTION_IMMEDIATE_JUMP;
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+uint32_t fusion_length(Superinstruction value)
+{
+    if (value < 0 || value >= SUPERINSTRUCTIONS_COUNT)
+    {
+        return 1;
+    }
+
+    return FUSION_LENGTHS[value];
+}
+
+void fusion_apply(Operation operations, uint32_t* program, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i++)
+    {
+        Superinstruction superinstruction;
+
+        if (fusion_match(program, length, i, &superinstruction))
+        {
+            operations[i].opcode = UM32_OPERATION_FUSED + superinstruction;
+        }
+    }
+}
+
+void fusion_update(
+    Operation operations,
+    uint32_t* program,
+    uint32_t length,
+    uint32_t offset)
+{
+    uint32_t first = 0;
+
+    if (offset >= UM32_FUSION_WINDOW)
+    {
+        first = offset - (UM32_FUSION_WINDOW - 1);
+    }
+
+    for (uint32_t i = first; i <= offset && i < length; i++)
+    {
+        Superinstruction superinstruction;
+
+        operation(operations + i, program[i]);
+
+        if (fusion_match(program, length, i, &superinstruction))
+        {
+            operations[i].opcode = UM32_OPERATION_FUSED + superinstruction;
+        }
+    }
+}
@@ -0,0 +1,32 @@
+// fusion.h
+// Copyright (c) 2024 Ishan Pranav
+// Licensed under the MIT license.
+
+// http://boundvariable.org
+
+// Superinstruction fusion. A fused operation keeps its own operands and reads
+// the rest of its sequence from the operations that follow it, which are left
+// unchanged so that jumps into the middle of a sequence still work.
+
+#ifndef UM32_FUSION
+#define UM32_FUSION
+#include <stdbool.h>
+#include "operation.h"
+#define UM32_FUSION_WINDOW 4
+
+bool fusion_match(
+    uint32_t* program,
+    uint32_t length,
+    uint32_t offset,
+    Superinstruction* result);
+
+uint32_t fusion_length(Superinstruction value);
+void fusion_apply(Operation operations, uint32_t* program, uint32_t length);
+
+void fusion_update(
+    Operation operations,
+    uint32_t* program,
+    uint32_t length,
+    uint32_t offset);
+
+#endif
@@ -10,16 +10,60 @@
 //  - https://csit.kutztown.edu/~schwesin/fall20/csc235/lectures/Dynamic_Memory_Allocation_Basic.html
 //  - https://web.stanford.edu/class/archive/cs/cs107/cs107.1246/lectures/24/Lecture24.pdf
 
+// Each block is laid out as [capacity][status][payload...][size]. The status
+// word is zero for a free block; otherwise it is one more than the number of
+// unused payload words beyond the capacity. Free blocks store their size in
+// the capacity word and thread the segregated free lists through the first
+// two payload words.
+
+// Arrays of fewer than UM32_HEAP_SLABS words are carved from per-capacity slabs
+// instead. Their identifiers set UM32_HEAP_SLAB and encode the capacity and
+// slot, so the arena itself is limited to addresses below UM32_HEAP_SLAB.
+
+// In HEAP_MODE_HANDLES, identifiers index a table of arena addresses and each
+// block reserves its first payload word for its own handle. Blocks can then
+// be slid together by heap_compact, which runs automatically once free-list
+// words exceed UM32_HEAP_COMPACTION percent of the arena.
+
+// Arrays of at least threshold words bypass the arena and are allocated
+// through the chunk table, which maps large chunks straight from the kernel.
+// Their identifiers are chunk identifiers tagged with UM32_HEAP_LARGE, which
+// uses a slab capacity that never occurs.
+
+// In HEAP_MODE_CHUNKS, every array, however small, is allocated separately
+// through a chunk table and the arena and slabs go unused.
+
+// Statistics are kept up to date by every allocation and free, so reading
+// them never walks the heap. Words held by slabs and free slab slots are
+// derived from the slabs themselves when the statistics are read.
+
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include "heap.h"
 #define UM32_HEAP_HEADER 2
 #define UM32_HEAP_FOOTER 1
 #define UM32_HEAP_OVERHEAD (UM32_HEAP_HEADER + UM32_HEAP_FOOTER)
+#define UM32_HEAP_MINIMUM 2
+#define UM32_HEAP_SEARCH 8
+#define UM32_HEAP_COMPACTION 25
+#define UM32_HEAP_COMPACTION_MINIMUM 65536
 #define um32_heap_capacity(instance, address) \
     ((instance)->segment.buffer + (address) - 2)
 #define um32_heap_allocated(instance, address) \
     ((instance)->segment.buffer + (address) - 1)
+#define um32_heap_next_free(instance, address) \
+    ((instance)->segment.buffer + (address))
+#define um32_heap_previous_free(instance, address) \
+    ((instance)->segment.buffer + (address) + 1)
+
+struct HeapCheckpoint
+{
+    uint32_t mode;
+    uint32_t threshold;
+    uint32_t freeWords;
+    uint32_t free[UM32_HEAP_CLASSES];
+};
 
 bool heap(Heap instance)
 {
@@ -28,20 +72,296 @@ bool heap(Heap instance)
         return false;
     }
 
+    if (!segment(&instance->handles, 0))
+    {
+        finalize_segment(&instance->segment);
+
+        return false;
+    }
+
+    if (!segment(&instance->freeHandles, 0))
+    {
+        finalize_segment(&instance->segment);
+        finalize_segment(&instance->handles);
+
+        return false;
+    }
+
+    chunk_table(&instance->chunks);
+
+    instance->mode = HEAP_MODE_ARENA;
+    instance->threshold = UM32_HEAP_THRESHOLD;
+    instance->freeWords = 0;
+    instance->handles.length = 1;
+    instance->handles.buffer[0] = 0;
+    instance->histogram = false;
+
+    memset(instance->free, 0, sizeof instance->free);
+    memset(&instance->stats, 0, sizeof instance->stats);
+
+    for (uint32_t i = 0; i < UM32_HEAP_SLABS; i++)
+    {
+        if (!slab(instance->slabs + i, i))
+        {
+            while (i)
+            {
+                i--;
+                finalize_slab(instance->slabs + i);
+            }
+
+            finalize_segment(&instance->segment);
+            finalize_segment(&instance->handles);
+            finalize_segment(&instance->freeHandles);
+
+            return false;
+        }
+    }
+
     return true;
 }
 
-// uint32_t heap_first_fit(Heap instance) 
-// {
-//     uint32_t address = UM32_HEAP_OVERHEAD;
+static uint32_t heap_class(uint32_t size)
+{
+    return 31 - __builtin_clz(size);
+}
 
-//     while (address < instance->segment.length)
-//     {
-//         uint32_t capacity = instance->segment.buffer[address]
-//     }
+static uint32_t heap_bucket(uint32_t capacity)
+{
+    if (!capacity)
+    {
+        return 0;
+    }
 
-//     return address;
-// }
+    return 32 - __builtin_clz(capacity);
+}
+
+static uint32_t heap_size(Heap instance, uint32_t address)
+{
+    uint32_t status = *um32_heap_allocated(instance, address);
+
+    if (!status)
+    {
+        return *um32_heap_capacity(instance, address);
+    }
+
+    return *um32_heap_capacity(instance, address) + status - 1;
+}
+
+static bool heap_valid(Heap instance, uint32_t address, uint32_t* size)
+{
+    uint32_t length = instance->segment.length;
+
+    if (address < UM32_HEAP_HEADER ||
+        address >= length ||
+        !*um32_heap_allocated(instance, address))
+    {
+        return false;
+    }
+
+    uint64_t end = (uint64_t)address + heap_size(instance, address);
+
+    if (end >= length || instance->segment.buffer[end] != end - address)
+    {
+        return false;
+    }
+
+    *size = end - address;
+
+    return true;
+}
+
+static void heap_link(Heap instance, uint32_t address, uint32_t size)
+{
+    uint32_t* head = instance->free + heap_class(size);
+
+    *um32_heap_capacity(instance, address) = size;
+    *um32_heap_allocated(instance, address) = false;
+    *um32_heap_next_free(instance, address) = *head;
+    *um32_heap_previous_free(instance, address) = 0;
+    instance->segment.buffer[address + size] = size;
+    instance->freeWords += size;
+    instance->stats.freeBlocks++;
+
+    if (*head)
+    {
+        *um32_heap_previous_free(instance, *head) = address;
+    }
+
+    *head = address;
+}
+
+static void heap_unlink(Heap instance, uint32_t address)
+{
+    uint32_t next = *um32_heap_next_free(instance, address);
+    uint32_t previous = *um32_heap_previous_free(instance, address);
+    uint32_t size = *um32_heap_capacity(instance, address);
+
+    instance->freeWords -= size;
+    instance->stats.freeBlocks--;
+
+    if (next)
+    {
+        *um32_heap_previous_free(instance, next) = previous;
+    }
+
+    if (previous)
+    {
+        *um32_heap_next_free(instance, previous) = next;
+
+        return;
+    }
+
+    instance->free[heap_class(size)] = next;
+}
+
+static uint32_t heap_best_fit(Heap instance, uint32_t size)
+{
+    uint32_t result = 0;
+    uint32_t resultSize = UINT32_MAX;
+    uint32_t remaining = UM32_HEAP_SEARCH;
+    uint32_t k = heap_class(size);
+
+    for (uint32_t address = instance->free[k];
+        address && remaining;
+        address = *um32_heap_next_free(instance, address), remaining--)
+    {
+        uint32_t candidate = *um32_heap_capacity(instance, address);
+
+        if (candidate >= size && candidate < resultSize)
+        {
+            result = address;
+            resultSize = candidate;
+
+            if (candidate == size)
+            {
+                break;
+            }
+        }
+    }
+
+    if (result)
+    {
+        return result;
+    }
+
+    for (k++; k < UM32_HEAP_CLASSES; k++)
+    {
+        if (instance->free[k])
+        {
+            return instance->free[k];
+        }
+    }
+
+    return 0;
+}
+
+static uint32_t heap_arena_allocate(Heap instance, uint32_t capacity)
+{
+    Segment segment = &instance->segment;
+    uint32_t size = capacity;
+
+    if (size < UM32_HEAP_MINIMUM)
+    {
+        size = UM32_HEAP_MINIMUM;
+    }
+
+    uint32_t address = heap_best_fit(instance, size);
+
+    if (address)
+    {
+        uint32_t blockSize = *um32_heap_capacity(instance, address);
+
+        heap_unlink(instance, address);
+
+        if (blockSize - size >= UM32_HEAP_OVERHEAD + UM32_HEAP_MINIMUM)
+        {
+            heap_link(
+                instance,
+                address + size + UM32_HEAP_OVERHEAD,
+                blockSize - size - UM32_HEAP_OVERHEAD);
+
+            blockSize = size;
+        }
+
+        size = blockSize;
+    }
+    else
+    {
+        uint64_t length = (uint64_t)segment->length + size + UM32_HEAP_OVERHEAD;
+
+        if (length > UM32_HEAP_SLAB || !segment_ensure_capacity(segment, length))
+        {
+            return 0;
+        }
+
+        address = segment->length + UM32_HEAP_HEADER;
+        segment->length = length;
+    }
+
+    *um32_heap_capacity(instance, address) = capacity;
+    *um32_heap_allocated(instance, address) = size - capacity + 1;
+
+    memset(segment->buffer + address, 0, capacity * sizeof * segment->buffer);
+
+    segment->buffer[address + size] = size;
+
+    return address;
+}
+
+static void heap_arena_free(Heap instance, uint32_t address, uint32_t size)
+{
+    Segment segment = &instance->segment;
+    uint32_t next = address + size + UM32_HEAP_OVERHEAD;
+
+    if (next < segment->length && !*um32_heap_allocated(instance, next))
+    {
+        heap_unlink(instance, next);
+
+        size += *um32_heap_capacity(instance, next) + UM32_HEAP_OVERHEAD;
+    }
+
+    if (address > UM32_HEAP_HEADER)
+    {
+        uint32_t previousSize = segment->buffer[address - UM32_HEAP_OVERHEAD];
+        uint32_t previous = address - previousSize - UM32_HEAP_OVERHEAD;
+
+        if (!*um32_heap_allocated(instance, previous))
+        {
+            heap_unlink(instance, previous);
+
+            // The absorbed header would otherwise still pass heap_valid, so
+            // freeing the same address again must find it marked free.
+
+            *um32_heap_allocated(instance, address) = false;
+            size += previousSize + UM32_HEAP_OVERHEAD;
+            address = previous;
+        }
+    }
+
+    if (address + size + UM32_HEAP_FOOTER == segment->length)
+    {
+        segment->length = address - UM32_HEAP_HEADER;
+
+        if (segment->mapped && segment->length < segment->capacity / 4)
+        {
+            segment_trim(segment);
+        }
+
+        return;
+    }
+
+    heap_link(instance, address, size);
+}
+
+static uint32_t heap_handle(Heap instance, uint32_t address)
+{
+    if (address >= instance->handles.length)
+    {
+        return 0;
+    }
+
+    return instance->handles.buffer[address];
+}
 
 void heap_first(HeapBlock result)
 {
@@ -57,33 +377,219 @@ bool heap_next(HeapBlock result, Heap instance)
         return false;
     }
 
-    result->capacity = instance->segment.buffer[result->address - 2];
-    result->allocated = instance->segment.buffer[result->address - 1];
-    result->address += result->capacity + UM32_HEAP_OVERHEAD;
+    if (instance->mode == HEAP_MODE_CHUNKS)
+    {
+        uint32_t id = result->address - UM32_HEAP_HEADER + 1;
+
+        if (id >= instance->chunks.count)
+        {
+            return false;
+        }
+
+        uint32_t* chunk = chunk_table_chunk(&instance->chunks, id);
+
+        result->allocated = chunk;
+        result->capacity = chunk ? *chunk : 0;
+        result->address++;
+
+        return true;
+    }
+
+    if (!(result->address & UM32_HEAP_SLAB))
+    {
+        if (result->address < instance->segment.length)
+        {
+            uint32_t size = heap_size(instance, result->address);
+
+            result->capacity = *um32_heap_capacity(instance, result->address);
+            result->allocated = *um32_heap_allocated(instance, result->address);
+            result->address += size + UM32_HEAP_OVERHEAD;
+
+            if (result->allocated && instance->mode == HEAP_MODE_HANDLES)
+            {
+                result->capacity--;
+            }
+
+            return true;
+        }
+
+        result->address = UM32_HEAP_SLAB;
+    }
+
+    while ((result->address & UM32_HEAP_LARGE) != UM32_HEAP_LARGE)
+    {
+        uint32_t capacity = um32_heap_slab(result->address);
+        uint32_t slot = um32_heap_slab_slot(result->address);
+
+        if (capacity >= UM32_HEAP_SLABS)
+        {
+            result->address = UM32_HEAP_LARGE | 1;
+
+            break;
+        }
+
+        if (slot < instance->slabs[capacity].count)
+        {
+            result->capacity = capacity;
+            result->allocated = slab_allocated(instance->slabs + capacity, slot);
+            result->address++;
+
+            return true;
+        }
+
+        result->address = UM32_HEAP_SLAB |
+            ((capacity + 1) << UM32_HEAP_SLAB_SHIFT);
+    }
+
+    uint32_t id = result->address & ~UM32_HEAP_LARGE;
+
+    if (id >= instance->chunks.count)
+    {
+        return false;
+    }
+
+    uint32_t* chunk = chunk_table_chunk(&instance->chunks, id);
+
+    result->allocated = chunk;
+    result->capacity = chunk ? *chunk : 0;
+    result->address++;
 
-    return result->address < instance->segment.length;
+    return true;
 }
 
-uint32_t heap_allocate(Heap instance, uint32_t capacity)
+static void heap_count_allocation(Heap instance, uint32_t capacity, bool chunk)
 {
-    Segment segment = &instance->segment;
-    uint32_t address = segment->length + UM32_HEAP_HEADER;
-    uint32_t length = address + capacity + UM32_HEAP_FOOTER;
+    HeapStats stats = &instance->stats;
+
+    stats->allocations++;
+    stats->arrays++;
+    stats->words += capacity;
+
+    if (chunk)
+    {
+        stats->chunkWords += capacity;
+    }
+
+    if (stats->arrays > stats->peakArrays)
+    {
+        stats->peakArrays = stats->arrays;
+    }
+
+    if (stats->words > stats->peakWords)
+    {
+        stats->peakWords = stats->words;
+    }
 
-    if (!segment_ensure_capacity(segment, length))
+    if (instance->histogram)
+    {
+        stats->sizes[heap_bucket(capacity)]++;
+    }
+}
+
+static void heap_count_free(Heap instance, uint32_t capacity, bool chunk)
+{
+    HeapStats stats = &instance->stats;
+
+    stats->frees++;
+    stats->arrays--;
+    stats->words -= capacity;
+    stats->freedWords += capacity;
+
+    if (chunk)
+    {
+        stats->chunkWords -= capacity;
+    }
+}
+
+static uint32_t heap_place(Heap instance, uint32_t capacity)
+{
+    if (instance->mode == HEAP_MODE_CHUNKS)
+    {
+        return chunk_table_allocate(&instance->chunks, capacity);
+    }
+
+    if (capacity < UM32_HEAP_SLABS)
+    {
+        uint32_t slot;
+
+        if (slab_allocate(instance->slabs + capacity, &slot))
+        {
+            return UM32_HEAP_SLAB | (capacity << UM32_HEAP_SLAB_SHIFT) | slot;
+        }
+    }
+
+    if (capacity >= instance->threshold)
+    {
+        uint32_t id = chunk_table_allocate(&instance->chunks, capacity);
+
+        if (id < UM32_HEAP_LARGE_IDS)
+        {
+            return id ? UM32_HEAP_LARGE | id : 0;
+        }
+
+        chunk_table_free(&instance->chunks, id);
+    }
+
+    if (instance->mode != HEAP_MODE_HANDLES)
+    {
+        return heap_arena_allocate(instance, capacity);
+    }
+
+    Segment handles = &instance->handles;
+    Segment freeHandles = &instance->freeHandles;
+    uint32_t handle;
+
+    if (capacity == UINT32_MAX)
     {
         return 0;
     }
 
-    *um32_heap_capacity(instance, address) = capacity;
-    *um32_heap_allocated(instance, address) = true;
+    uint32_t address = heap_arena_allocate(instance, capacity + 1);
 
-    memset(segment->buffer + address, 0, capacity * sizeof * segment->buffer);
+    if (!address)
+    {
+        return 0;
+    }
 
-    segment->buffer[address + capacity] = capacity;
-    segment->length = length;
+    if (freeHandles->length)
+    {
+        freeHandles->length--;
+        handle = freeHandles->buffer[freeHandles->length];
+    }
+    else
+    {
+        handle = handles->length;
 
-    return address;
+        if (handle >= UM32_HEAP_SLAB ||
+            !segment_ensure_capacity(freeHandles, handle + 1) ||
+            !segment_add(handles, 0))
+        {
+            heap_arena_free(instance, address, heap_size(instance, address));
+
+            return 0;
+        }
+    }
+
+    instance->segment.buffer[address] = handle;
+    handles->buffer[handle] = address;
+
+    return handle;
+}
+
+uint32_t heap_allocate(Heap instance, uint32_t capacity)
+{
+    uint32_t result = heap_place(instance, capacity);
+
+    if (result)
+    {
+        heap_count_allocation(
+            instance,
+            capacity,
+            instance->mode == HEAP_MODE_CHUNKS ||
+                (result & UM32_HEAP_LARGE) == UM32_HEAP_LARGE);
+    }
+
+    return result;
 }
 
 uint32_t* heap_index(
@@ -92,15 +598,58 @@ uint32_t* heap_index(
     uint32_t offset,
     uint32_t* length)
 {
-    if (address < UM32_HEAP_HEADER || !*um32_heap_allocated(instance, address))
+    uint32_t size;
+
+    if (instance->mode == HEAP_MODE_CHUNKS)
+    {
+        return chunk_table_index(&instance->chunks, address, offset, length);
+    }
+
+    if (address & UM32_HEAP_SLAB)
+    {
+        uint32_t capacity = um32_heap_slab(address);
+
+        if (capacity >= UM32_HEAP_SLABS)
+        {
+            if ((address & UM32_HEAP_LARGE) != UM32_HEAP_LARGE)
+            {
+                return NULL;
+            }
+
+            return chunk_table_index(
+                &instance->chunks,
+                address & ~UM32_HEAP_LARGE,
+                offset,
+                length);
+        }
+
+        if (length)
+        {
+            *length = capacity;
+        }
+
+        return slab_index(
+            instance->slabs + capacity,
+            um32_heap_slab_slot(address),
+            offset);
+    }
+
+    uint32_t reserved = 0;
+
+    if (instance->mode == HEAP_MODE_HANDLES)
+    {
+        address = heap_handle(instance, address);
+        reserved = 1;
+    }
+
+    if (!heap_valid(instance, address, &size))
     {
         return NULL;
     }
 
-    uint32_t capacity = *um32_heap_capacity(instance, address);
-    uint32_t footer = instance->segment.buffer[address + capacity];
-    
-    if (capacity != footer || offset >= capacity)
+    uint32_t capacity = *um32_heap_capacity(instance, address) - reserved;
+
+    if (offset >= capacity)
     {
         return NULL;
     }
@@ -110,17 +659,351 @@ uint32_t* heap_index(
         *length = capacity;
     }
 
+    return instance->segment.buffer + address + reserved + offset;
+}
+
+uint32_t* heap_index_unchecked(
+    Heap instance,
+    uint32_t address,
+    uint32_t offset)
+{
+    if (instance->mode == HEAP_MODE_CHUNKS)
+    {
+        return chunk_table_chunk(&instance->chunks, address) + 1 + offset;
+    }
+
+    if (address & UM32_HEAP_SLAB)
+    {
+        uint32_t capacity = um32_heap_slab(address);
+
+        if (capacity >= UM32_HEAP_SLABS)
+        {
+            return chunk_table_chunk(
+                &instance->chunks,
+                address & ~UM32_HEAP_LARGE) + 1 + offset;
+        }
+
+        return instance->slabs[capacity].slots.buffer +
+            um32_heap_slab_slot(address) * capacity + offset;
+    }
+
+    if (instance->mode == HEAP_MODE_HANDLES)
+    {
+        return instance->segment.buffer +
+            instance->handles.buffer[address] + 1 + offset;
+    }
+
     return instance->segment.buffer + address + offset;
 }
 
+static bool heap_free_chunk(Heap instance, uint32_t id)
+{
+    uint32_t* chunk = chunk_table_chunk(&instance->chunks, id);
+
+    if (!chunk)
+    {
+        return false;
+    }
+
+    heap_count_free(instance, *chunk, true);
+
+    return chunk_table_free(&instance->chunks, id);
+}
+
 bool heap_free(Heap instance, uint32_t address)
 {
-    if (address < UM32_HEAP_HEADER || !*um32_heap_allocated(instance, address))
+    uint32_t size;
+
+    if (instance->mode == HEAP_MODE_CHUNKS)
+    {
+        return heap_free_chunk(instance, address);
+    }
+
+    if (address & UM32_HEAP_SLAB)
+    {
+        uint32_t capacity = um32_heap_slab(address);
+
+        if ((address & UM32_HEAP_LARGE) == UM32_HEAP_LARGE)
+        {
+            return heap_free_chunk(instance, address & ~UM32_HEAP_LARGE);
+        }
+
+        if (capacity >= UM32_HEAP_SLABS ||
+            !slab_free(
+                instance->slabs + capacity,
+                um32_heap_slab_slot(address)))
+        {
+            return false;
+        }
+
+        heap_count_free(instance, capacity, false);
+
+        return true;
+    }
+
+    if (instance->mode != HEAP_MODE_HANDLES)
+    {
+        if (!heap_valid(instance, address, &size))
+        {
+            return false;
+        }
+
+        heap_count_free(
+            instance,
+            *um32_heap_capacity(instance, address),
+            false);
+        heap_arena_free(instance, address, size);
+
+        return true;
+    }
+
+    uint32_t handle = address;
+
+    address = heap_handle(instance, handle);
+
+    if (!heap_valid(instance, address, &size))
     {
         return false;
     }
 
-    *um32_heap_allocated(instance, address) = false;
+    instance->handles.buffer[handle] = 0;
+    instance->freeHandles.buffer[instance->freeHandles.length] = handle;
+    instance->freeHandles.length++;
+
+    heap_count_free(
+        instance,
+        *um32_heap_capacity(instance, address) - 1,
+        false);
+
+    heap_arena_free(instance, address, size);
+
+    uint64_t length = instance->segment.length;
+
+    if (length >= UM32_HEAP_COMPACTION_MINIMUM &&
+        (uint64_t)instance->freeWords * 100 >= length * UM32_HEAP_COMPACTION)
+    {
+        heap_compact(instance);
+    }
+
+    return true;
+}
+
+bool heap_compact(Heap instance)
+{
+    if (instance->mode != HEAP_MODE_HANDLES)
+    {
+        return false;
+    }
+
+    Segment segment = &instance->segment;
+    uint32_t target = UM32_HEAP_HEADER;
+
+    for (uint32_t address = UM32_HEAP_HEADER; address < segment->length; )
+    {
+        uint32_t size = heap_size(instance, address);
+        uint32_t next = address + size + UM32_HEAP_OVERHEAD;
+
+        if (*um32_heap_allocated(instance, address))
+        {
+            if (target != address)
+            {
+                memmove(
+                    segment->buffer + target - UM32_HEAP_HEADER,
+                    segment->buffer + address - UM32_HEAP_HEADER,
+                    (size + UM32_HEAP_OVERHEAD) * sizeof * segment->buffer);
+            }
+
+            instance->handles.buffer[segment->buffer[target]] = target;
+            target += size + UM32_HEAP_OVERHEAD;
+        }
+
+        address = next;
+    }
+
+    segment->length = target - UM32_HEAP_HEADER;
+    instance->freeWords = 0;
+    instance->stats.freeBlocks = 0;
+
+    memset(instance->free, 0, sizeof instance->free);
+
+    return segment_trim(segment);
+}
+
+void heap_stats(HeapStats result, Heap instance)
+{
+    *result = instance->stats;
+    result->freeWords = instance->freeWords;
+    result->size = (uint64_t)instance->segment.length + result->chunkWords;
+
+    for (uint32_t i = 0; i < UM32_HEAP_SLABS; i++)
+    {
+        Slab slab = instance->slabs + i;
+
+        result->freeBlocks += slab->free.length;
+        result->freeWords += (uint64_t)slab->free.length * i;
+        result->size += (uint64_t)slab->count * i;
+    }
+}
+
+static void heap_recount(Heap instance)
+{
+    HeapStats stats = &instance->stats;
+    Segment segment = &instance->segment;
+    uint32_t reserved = instance->mode == HEAP_MODE_HANDLES;
+
+    stats->arrays = 0;
+    stats->words = 0;
+    stats->freeBlocks = 0;
+    stats->chunkWords = 0;
+
+    for (uint32_t address = UM32_HEAP_HEADER; address < segment->length; )
+    {
+        if (*um32_heap_allocated(instance, address))
+        {
+            stats->arrays++;
+            stats->words += *um32_heap_capacity(instance, address) - reserved;
+        }
+        else
+        {
+            stats->freeBlocks++;
+        }
+
+        address += heap_size(instance, address) + UM32_HEAP_OVERHEAD;
+    }
+
+    for (uint32_t i = 0; i < UM32_HEAP_SLABS; i++)
+    {
+        Slab slab = instance->slabs + i;
+        uint32_t live = slab->count - slab->free.length;
+
+        stats->arrays += live;
+        stats->words += (uint64_t)live * i;
+    }
+
+    for (uint32_t id = 1; id < instance->chunks.count; id++)
+    {
+        uint32_t* chunk = chunk_table_chunk(&instance->chunks, id);
+
+        if (chunk)
+        {
+            stats->arrays++;
+            stats->words += *chunk;
+            stats->chunkWords += *chunk;
+        }
+    }
+
+    stats->peakArrays = stats->arrays;
+    stats->peakWords = stats->words;
+}
+
+bool heap_checkpoint(Checkpoint checkpoint, Heap instance)
+{
+    struct HeapCheckpoint state =
+    {
+        .mode = instance->mode,
+        .threshold = instance->threshold,
+        .freeWords = instance->freeWords
+    };
+
+    memcpy(state.free, instance->free, sizeof state.free);
+
+    if (!checkpoint_write(
+            checkpoint,
+            CHECKPOINT_SECTION_HEAP,
+            &state,
+            sizeof state) ||
+        !checkpoint_write_segment(
+            checkpoint,
+            &instance->segment,
+            instance->segment.length) ||
+        !checkpoint_write_segment(
+            checkpoint,
+            &instance->handles,
+            instance->handles.length) ||
+        !checkpoint_write_segment(
+            checkpoint,
+            &instance->freeHandles,
+            instance->freeHandles.length))
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < UM32_HEAP_SLABS; i++)
+    {
+        if (!slab_checkpoint(checkpoint, instance->slabs + i))
+        {
+            return false;
+        }
+    }
+
+    return chunk_table_checkpoint(checkpoint, &instance->chunks);
+}
+
+bool heap_restore(Heap instance, Checkpoint checkpoint)
+{
+    uint64_t size;
+    const struct HeapCheckpoint* state = checkpoint_read(
+        checkpoint,
+        CHECKPOINT_SECTION_HEAP,
+        &size);
+
+    if (!state)
+    {
+        return false;
+    }
+
+    if (size != sizeof * state || state->mode >= HEAP_MODES_COUNT)
+    {
+        errno = EINVAL;
+
+        return false;
+    }
+
+    // Freed handles are pushed without a capacity check, so their stack
+    // needs room for every handle.
+
+    if (!checkpoint_read_segment(checkpoint, &instance->segment, 0) ||
+        !checkpoint_read_segment(checkpoint, &instance->handles, 0) ||
+        !checkpoint_read_segment(
+            checkpoint,
+            &instance->freeHandles,
+            instance->handles.length))
+    {
+        return false;
+    }
+
+    if (instance->segment.length > UM32_HEAP_SLAB ||
+        !instance->handles.length ||
+        instance->freeHandles.length > instance->handles.length)
+    {
+        errno = EINVAL;
+
+        return false;
+    }
+
+    instance->mode = state->mode;
+    instance->threshold = state->threshold;
+    instance->freeWords = state->freeWords;
+
+    memcpy(instance->free, state->free, sizeof instance->free);
+
+    for (uint32_t i = 0; i < UM32_HEAP_SLABS; i++)
+    {
+        if (!slab_restore(instance->slabs + i, checkpoint))
+        {
+            return false;
+        }
+    }
+
+    if (!chunk_table_restore(&instance->chunks, checkpoint))
+    {
+        return false;
+    }
+
+    // Statistics are not saved. The live set is counted again instead, and
+    // the running totals start over.
+
+    heap_recount(instance);
 
     return true;
 }
@@ -128,4 +1011,12 @@ bool heap_free(Heap instance, uint32_t address)
 void finalize_heap(Heap instance)
 {
     finalize_segment(&instance->segment);
+    finalize_segment(&instance->handles);
+    finalize_segment(&instance->freeHandles);
+    finalize_chunk_table(&instance->chunks);
+
+    for (uint32_t i = 0; i < UM32_HEAP_SLABS; i++)
+    {
+        finalize_slab(instance->slabs + i);
+    }
 }
@@ -5,11 +5,52 @@
 // http://boundvariable.org
 
 #include "segment.h"
+#include "chunk_table.h"
 #include "heap_block.h"
+#include "heap_mode.h"
+#include "slab.h"
+#define UM32_HEAP_CLASSES 32
+#define UM32_HEAP_SLABS 5
+#define UM32_HEAP_SLAB 0x80000000
+#define UM32_HEAP_SLAB_SHIFT 28
+#define UM32_HEAP_LARGE 0xF0000000
+#define UM32_HEAP_LARGE_IDS 0x10000000
+#define UM32_HEAP_THRESHOLD UM32_CHUNK_TABLE_MAPPED
+#define UM32_HEAP_SIZES 33
+#define um32_heap_slab(address) (((address) >> UM32_HEAP_SLAB_SHIFT) & 0x7)
+#define um32_heap_slab_slot(address) ((address) & (UM32_SLAB_SLOTS - 1))
+
+struct HeapStats
+{
+    uint64_t arrays;
+    uint64_t words;
+    uint64_t peakArrays;
+    uint64_t peakWords;
+    uint64_t allocations;
+    uint64_t frees;
+    uint64_t freedWords;
+    uint64_t freeBlocks;
+    uint64_t freeWords;
+    uint64_t chunkWords;
+    uint64_t size;
+    uint64_t sizes[UM32_HEAP_SIZES];
+};
+
+typedef struct HeapStats* HeapStats;
 
 struct Heap
 {
+    HeapMode mode;
+    uint32_t threshold;
     struct Segment segment;
+    uint32_t free[UM32_HEAP_CLASSES];
+    uint32_t freeWords;
+    struct Segment handles;
+    struct Segment freeHandles;
+    struct ChunkTable chunks;
+    struct Slab slabs[UM32_HEAP_SLABS];
+    struct HeapStats stats;
+    bool histogram;
 };
 
 typedef struct Heap* Heap;
@@ -23,8 +64,17 @@ uint32_t* heap_index(
     uint32_t offset, 
     uint32_t* length);
 
+uint32_t* heap_index_unchecked(
+    Heap instance,
+    uint32_t address,
+    uint32_t offset);
+
 void heap_first(HeapBlock result);
 bool heap_next(HeapBlock result, Heap instance);
 
 bool heap_free(Heap instance, uint32_t address);
+bool heap_compact(Heap instance);
+void heap_stats(HeapStats result, Heap instance);
+bool heap_checkpoint(Checkpoint checkpoint, Heap instance);
+bool heap_restore(Heap instance, Checkpoint checkpoint);
 void finalize_heap(Heap instance);
@@ -0,0 +1,38 @@
+// heap_mode.c
+// Copyright (c) 2024 Ishan Pranav
+// Licensed under the MIT license.
+
+// http://boundvariable.org
+
+#include <string.h>
+#include "heap_mode.h"
+
+static const char* HEAP_MODES_STRINGS[HEAP_MODES_COUNT] =
+{
+    [HEAP_MODE_ARENA] = "arena",
+    [HEAP_MODE_HANDLES] = "handles",
+    [HEAP_MODE_CHUNKS] = "chunks"
+};
+
+const char* heap_mode_to_string(HeapMode value)
+{
+    if (value < 0 || value >= HEAP_MODES_COUNT)
+    {
+        return "unknown";
+    }
+
+    return HEAP_MODES_STRINGS[value];
+}
+
+HeapMode heap_mode_from_string(const char* value)
+{
+    for (HeapMode mode = 0; mode < HEAP_MODES_COUNT; mode++)
+    {
+        if (strcmp(value, HEAP_MODES_STRINGS[mode]) == 0)
+        {
+            return mode;
+        }
+    }
+
+    return HEAP_MODES_COUNT;
+}
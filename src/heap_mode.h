@@ -0,0 +1,23 @@
+// heap_mode.h
+// Copyright (c) 2024 Ishan Pranav
+// Licensed under the MIT license.
+
+// http://boundvariable.org
+
+#ifndef UM32_HEAP_MODE
+#define UM32_HEAP_MODE
+
+enum HeapMode
+{
+    HEAP_MODE_ARENA = 0,
+    HEAP_MODE_HANDLES = 1,
+    HEAP_MODE_CHUNKS = 2,
+    HEAP_MODES_COUNT
+};
+
+typedef enum HeapMode HeapMode;
+
+const char* heap_mode_to_string(HeapMode value);
+HeapMode heap_mode_from_string(const char* value);
+
+#endif
@@ -4,30 +4,122 @@
 
 // http://boundvariable.org
 
-#include <inttypes.h>
+#include <string.h>
 #include "instruction.h"
 #include "opcode.h"
 
-void instruction_write_assembly(FILE* output, uint32_t word)
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+void instruction_swap(
+    uint32_t target[],
+    const uint32_t source[],
+    uint32_t count)
+{
+    uint32_t i = 0;
+
+#if defined(__SSE2__)
+    // Swap the bytes of each 16-bit half, then swap the halves.
+
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i value = _mm_loadu_si128((const __m128i*)(source + i));
+
+        value = _mm_or_si128(
+            _mm_slli_epi16(value, 8),
+            _mm_srli_epi16(value, 8));
+        value = _mm_shufflelo_epi16(value, _MM_SHUFFLE(2, 3, 0, 1));
+        value = _mm_shufflehi_epi16(value, _MM_SHUFFLE(2, 3, 0, 1));
+
+        _mm_storeu_si128((__m128i*)(target + i), value);
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 4 <= count; i += 4)
+    {
+        uint8x16_t value = vld1q_u8((const uint8_t*)(source + i));
+
+        vst1q_u8((uint8_t*)(target + i), vrev32q_u8(value));
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        uint32_t value;
+
+        memcpy(&value, source + i, sizeof value);
+
+        target[i] = __builtin_bswap32(value);
+    }
+}
+
+static char* instruction_format_register(char* output, uint32_t value)
+{
+    *output++ = 'r';
+    *output++ = '0' + value;
+
+    return output;
+}
+
+uint32_t instruction_format_assembly(char buffer[], uint32_t word)
 {
-    uint32_t a;
+    static const char digits[] = "0123456789abcdef";
+    char* output = buffer;
     uint32_t opcode = um32_instruction_opcode(word);
+    const char* mnemonic = opcode_to_string(opcode);
+    int length = 0;
 
-    fprintf(output, "%08" PRIx32 ": %-5s ", word, opcode_to_string(opcode));
+    for (int shift = 28; shift >= 0; shift -= 4)
+    {
+        *output++ = digits[(word >> shift) & 0xf];
+    }
+
+    *output++ = ':';
+    *output++ = ' ';
+
+    for (; mnemonic[length]; length++)
+    {
+        *output++ = mnemonic[length];
+    }
+
+    for (; length < 5; length++)
+    {
+        *output++ = ' ';
+    }
+
+    *output++ = ' ';
 
     if (opcode == OPCODE_IMMEDIATE)
     {
-        a = um32_instruction_immediate_register(word);
-        
         uint32_t immediate = um32_instruction_immediate_value(word);
+        int shift = 24;
+
+        output = instruction_format_register(
+            output,
+            um32_instruction_immediate_register(word));
+        *output++ = ' ';
+        *output++ = '$';
+        *output++ = '0';
+        *output++ = 'x';
 
-        fprintf(output, "r%d $0x%" PRIx32 "\n", a, immediate);
+        while (shift && !(immediate >> shift))
+        {
+            shift -= 4;
+        }
 
-        return;
+        for (; shift >= 0; shift -= 4)
+        {
+            *output++ = digits[(immediate >> shift) & 0xf];
+        }
+
+        *output++ = '\n';
+
+        return output - buffer;
     }
 
-    a = um32_instruction_operand_a(word);
-    
+    uint32_t a = um32_instruction_operand_a(word);
     uint32_t b = um32_instruction_operand_b(word);
     uint32_t c = um32_instruction_operand_c(word);
 
@@ -40,22 +132,35 @@ void instruction_write_assembly(FILE* output, uint32_t word)
     case OPCODE_MULTIPLY:
     case OPCODE_NAND:
     case OPCODE_SET:
-        fprintf(output, "r%" PRIu32 " r%" PRIu32 " r%" PRIu32 "\n", a, b, c);
+        output = instruction_format_register(output, a);
+        *output++ = ' ';
+        output = instruction_format_register(output, b);
+        *output++ = ' ';
+        output = instruction_format_register(output, c);
         break;
 
     case OPCODE_ALLOCATE:
     case OPCODE_LOAD:
-        fprintf(output, "r%" PRIu32 " r%" PRIu32 "\n", b, c);
+        output = instruction_format_register(output, b);
+        *output++ = ' ';
+        output = instruction_format_register(output, c);
         break;
 
     case OPCODE_FREE:
     case OPCODE_READ:
     case OPCODE_WRITE:
-        fprintf(output, "r%" PRIu32 "\n", c);
-        break;
-
-    default:
-        fprintf(output, "\n");
+        output = instruction_format_register(output, c);
         break;
     }
+
+    *output++ = '\n';
+
+    return output - buffer;
+}
+
+void instruction_write_assembly(FILE* output, uint32_t word)
+{
+    char buffer[UM32_INSTRUCTION_ASSEMBLY_SIZE];
+
+    fwrite(buffer, 1, instruction_format_assembly(buffer, word), output);
 }
@@ -6,6 +6,7 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#define UM32_INSTRUCTION_ASSEMBLY_SIZE 32
 #define um32_instruction_opcode(word) ((word) >> 28)
 #define um32_instruction_operand_a(word) (((word) >> 6) & 0x7)
 #define um32_instruction_operand_b(word) (((word) >> 3) & 0x7)
@@ -17,4 +18,10 @@
 #define um32_instruction_from_immediate(opcode, a, immediate) \
     (((opcode) << 28) | ((a) << 25) | (immediate))
 
+void instruction_swap(
+    uint32_t target[],
+    const uint32_t source[],
+    uint32_t count);
+
+uint32_t instruction_format_assembly(char buffer[], uint32_t word);
 void instruction_write_assembly(FILE* output, uint32_t word);
@@ -0,0 +1,579 @@
+// interpreter.h
+// Copyright (c) 2024 Ishan Pranav
+// Licensed under the MIT license.
+
+// http://boundvariable.org
+
+// Interpreter template. Define UM32_INTERPRETER to the function name and,
+// optionally, UM32_INTERPRETER_THREADED before including this file. Defining
+// UM32_INTERPRETER_TRUSTED also removes the bounds and identifier checks on
+// array accesses, for images known never to access memory out of range.
+// Defining UM32_INTERPRETER_PROFILED counts every dispatch, load and
+// allocation in the machine's profile instead, which the other builds never
+// touch.
+// Superinstructions count as every operation they replace; one that does not
+// fit in the remaining budget runs as its first operation alone.
+
+#ifdef UM32_INTERPRETER_THREADED
+#define um32_interpreter_case(opcode) label_##opcode:
+#define um32_interpreter_dispatch() \
+    do \
+    { \
+        if (count == budget) \
+        { \
+            goto exit; \
+        } \
+        instruction = operations[instructionPointer]; \
+        um32_interpreter_profile(); \
+        goto *LABELS[instruction.opcode]; \
+    } while (0)
+#define um32_interpreter_redispatch() goto *LABELS[instruction.opcode]
+#else
+#define um32_interpreter_case(opcode) case opcode:
+#define um32_interpreter_dispatch() continue
+#define um32_interpreter_redispatch() goto dispatch
+#endif
+
+#ifdef UM32_INTERPRETER_PROFILED
+#define um32_interpreter_profile() \
+    do \
+    { \
+        profile->operations[instruction.opcode]++; \
+        profile->counts[instructionPointer]++; \
+    } while (0)
+#else
+#define um32_interpreter_profile() do { } while (0)
+#endif
+
+#define um32_interpreter_next() \
+    { \
+        instructionPointer++; \
+        count++; \
+        um32_interpreter_dispatch(); \
+    }
+#define um32_interpreter_jump() \
+    { \
+        count++; \
+        um32_interpreter_dispatch(); \
+    }
+#define um32_interpreter_skip(size) \
+    { \
+        instructionPointer += (size); \
+        count += (size); \
+        um32_interpreter_dispatch(); \
+    }
+#define um32_interpreter_fuse(first, size) \
+    do \
+    { \
+        if (budget - count < (size)) \
+        { \
+            instruction.opcode = (first); \
+            um32_interpreter_redispatch(); \
+        } \
+    } while (0)
+#define um32_interpreter_fault(value) \
+    do \
+    { \
+        fault = (value); \
+        goto exit; \
+    } while (0)
+
+#ifdef UM32_INTERPRETER_TRUSTED
+#define um32_interpreter_check(condition, value) do { } while (0)
+#define um32_interpreter_index(address, offset) \
+    heap_index_unchecked(heap, (address), (offset))
+#else
+#define um32_interpreter_check(condition, value) \
+    do \
+    { \
+        if (condition) \
+        { \
+            um32_interpreter_fault(value); \
+        } \
+    } while (0)
+#define um32_interpreter_index(address, offset) \
+    heap_index(heap, (address), (offset), NULL)
+#endif
+
+#define um32_interpreter_a() registers[instruction.a]
+#define um32_interpreter_b() registers[instruction.b]
+#define um32_interpreter_c() registers[instruction.c]
+
+static Fault UM32_INTERPRETER(
+    Machine instance,
+    uint64_t budget,
+    uint64_t* executed)
+{
+    Fault fault = FAULT_NONE;
+    Heap heap = &instance->heap;
+    Stream stream = &instance->stream;
+    uint64_t count = 0;
+    struct Operation instruction;
+    uint32_t instructionPointer = instance->instructionPointer;
+    uint32_t* program = instance->program.buffer;
+    Operation operations = instance->operations;
+    uint32_t length = instance->program.length;
+    uint32_t registers[UM32_MACHINE_REGISTERS];
+
+    memcpy(registers, instance->registers, sizeof registers);
+
+#ifdef UM32_INTERPRETER_PROFILED
+    Profile profile = instance->profile;
+
+    // The terminating operation after the program is dispatched as well.
+
+    if (!profile_reserve(profile, (uint64_t)length + 1))
+    {
+        um32_interpreter_fault(FAULT_OUT_OF_MEMORY);
+    }
+#endif
+
+#ifdef UM32_INTERPRETER_THREADED
+    static const void* LABELS[UM32_OPERATIONS_COUNT] =
+    {
+        [OPCODE_CONDITIONAL_MOVE] = &&label_OPCODE_CONDITIONAL_MOVE,
+        [OPCODE_GET] = &&label_OPCODE_GET,
+        [OPCODE_SET] = &&label_OPCODE_SET,
+        [OPCODE_ADD] = &&label_OPCODE_ADD,
+        [OPCODE_MULTIPLY] = &&label_OPCODE_MULTIPLY,
+        [OPCODE_DIVIDE] = &&label_OPCODE_DIVIDE,
+        [OPCODE_NAND] = &&label_OPCODE_NAND,
+        [OPCODE_HALT] = &&label_OPCODE_HALT,
+        [OPCODE_ALLOCATE] = &&label_OPCODE_ALLOCATE,
+        [OPCODE_FREE] = &&label_OPCODE_FREE,
+        [OPCODE_WRITE] = &&label_OPCODE_WRITE,
+        [OPCODE_READ] = &&label_OPCODE_READ,
+        [OPCODE_LOAD] = &&label_OPCODE_LOAD,
+        [OPCODE_IMMEDIATE] = &&label_OPCODE_IMMEDIATE,
+        [UM32_OPERATION_INVALID] = &&label_UM32_OPERATION_INVALID,
+        [UM32_OPERATION_TERMINATE] = &&label_UM32_OPERATION_TERMINATE,
+        [UM32_OPERATION_NOT] = &&label_UM32_OPERATION_NOT,
+        [UM32_OPERATION_NEGATE] = &&label_UM32_OPERATION_NEGATE,
+        [UM32_OPERATION_SUBTRACT] = &&label_UM32_OPERATION_SUBTRACT,
+        [UM32_OPERATION_JUMP] = &&label_UM32_OPERATION_JUMP,
+        [UM32_OPERATION_IMMEDIATE_JUMP] =
+            &&label_UM32_OPERATION_IMMEDIATE_JUMP,
+        [UM32_OPERATION_BRANCH] = &&label_UM32_OPERATION_BRANCH
+    };
+
+    um32_interpreter_dispatch();
+#else
+    for (;;)
+    {
+        if (count == budget)
+        {
+            goto exit;
+        }
+
+        instruction = operations[instructionPointer];
+        um32_interpreter_profile();
+
+dispatch:
+        switch (instruction.opcode)
+        {
+#endif
+
+    um32_interpreter_case(OPCODE_ADD)
+        um32_interpreter_a() = um32_interpreter_b() + um32_interpreter_c();
+        um32_interpreter_next();
+
+    um32_interpreter_case(OPCODE_ALLOCATE)
+    {
+        uint32_t capacity = um32_interpreter_c();
+        uint32_t address = heap_allocate(heap, capacity);
+
+        if (!address)
+        {
+            um32_interpreter_fault(FAULT_OUT_OF_MEMORY);
+        }
+
+        um32_interpreter_b() = address;
+
+#ifdef UM32_INTERPRETER_PROFILED
+        profile->allocations++;
+        profile->zeroedWords += capacity;
+#endif
+
+        if (instance->programSource)
+        {
+            // The heap may have moved. Refresh the borrowed program view.
+
+            machine_share(instance, instance->programSource);
+
+            program = instance->program.buffer;
+        }
+    }
+    um32_interpreter_next();
+
+    um32_interpreter_case(OPCODE_CONDITIONAL_MOVE)
+        if (um32_interpreter_c())
+        {
+            um32_interpreter_a() = um32_interpreter_b();
+        }
+        um32_interpreter_next();
+
+    um32_interpreter_case(OPCODE_DIVIDE)
+        if (!um32_interpreter_c())
+        {
+            um32_interpreter_fault(FAULT_DIVISION_BY_ZERO);
+        }
+
+        um32_interpreter_a() = um32_interpreter_b() / um32_interpreter_c();
+        um32_interpreter_next();
+
+    um32_interpreter_case(OPCODE_FREE)
+        if (um32_interpreter_c() == instance->programSource &&
+            um32_interpreter_c())
+        {
+            if (!machine_unshare(instance))
+            {
+                um32_interpreter_fault(FAULT_OUT_OF_MEMORY);
+            }
+
+            program = instance->program.buffer;
+        }
+
+        if (instance->cached & um32_machine_cached(um32_interpreter_c()))
+        {
+            machine_forget(instance, um32_interpreter_c());
+        }
+
+        if (!heap_free(heap, um32_interpreter_c()))
+        {
+            um32_interpreter_fault(FAULT_INVALID_FREE);
+        }
+
+        if (instance->programSource)
+        {
+            machine_share(instance, instance->programSource);
+
+            program = instance->program.buffer;
+        }
+        um32_interpreter_next();
+
+    um32_interpreter_case(OPCODE_GET)
+    {
+        uint32_t address = um32_interpreter_b();
+        uint32_t offset = um32_interpreter_c();
+
+        if (!address)
+        {
+            um32_interpreter_check(offset >= length, FAULT_INVALID_ADDRESS);
+
+            um32_interpreter_a() = program[offset];
+            um32_interpreter_next();
+        }
+
+        uint32_t* index = um32_interpreter_index(address, offset);
+
+        um32_interpreter_check(!index, FAULT_INVALID_ADDRESS);
+
+        um32_interpreter_a() = *index;
+    }
+    um32_interpreter_next();
+
+    um32_interpreter_case(OPCODE_HALT)
+        count++;
+        um32_interpreter_fault(FAULT_HALTED);
+
+    um32_interpreter_case(OPCODE_IMMEDIATE)
+        um32_interpreter_a() = instruction.immediate;
+        um32_interpreter_next();
+
+    um32_interpreter_case(OPCODE_LOAD)
+    {
+        uint32_t address = um32_interpreter_b();
+        uint32_t offset = um32_interpreter_c();
+
+        if (!address)
+        {
+            if (offset >= length)
+            {
+                um32_interpreter_fault(FAULT_INVALID_INSTRUCTION_POINTER);
+            }
+
+            instructionPointer = offset;
+            um32_interpreter_jump();
+        }
+
+        if (address == instance->programSource)
+        {
+            if (offset >= length)
+            {
+                um32_interpreter_fault(FAULT_INVALID_INSTRUCTION_POINTER);
+            }
+
+            instructionPointer = offset;
+            um32_interpreter_jump();
+        }
+
+        uint32_t capacity;
+
+        if (!heap_index(heap, address, 0, &capacity))
+        {
+            um32_interpreter_fault(FAULT_INVALID_ADDRESS);
+        }
+
+        if (offset >= capacity)
+        {
+            um32_interpreter_fault(FAULT_INVALID_INSTRUCTION_POINTER);
+        }
+
+        if (!machine_load(instance, address))
+        {
+            um32_interpreter_fault(FAULT_OUT_OF_MEMORY);
+        }
+
+#ifdef UM32_INTERPRETER_PROFILED
+        if (!profile_reserve(profile, (uint64_t)capacity + 1))
+        {
+            um32_interpreter_fault(FAULT_OUT_OF_MEMORY);
+        }
+
+        profile->loads++;
+        profile->loadedWords += capacity;
+#endif
+
+        program = instance->program.buffer;
+        operations = instance->operations;
+        length = capacity;
+        instructionPointer = offset;
+    }
+    um32_interpreter_jump();
+
+    um32_interpreter_case(OPCODE_MULTIPLY)
+        um32_interpreter_a() = um32_interpreter_b() * um32_interpreter_c();
+        um32_interpreter_next();
+
+    um32_interpreter_case(OPCODE_NAND)
+        um32_interpreter_a() = ~(um32_interpreter_b() & um32_interpreter_c());
+        um32_interpreter_next();
+
+    um32_interpreter_case(OPCODE_READ)
+        if (stream->inputOffset < stream->inputLength)
+        {
+            um32_interpreter_c() = stream->input[stream->inputOffset];
+            stream->inputOffset++;
+            um32_interpreter_next();
+        }
+
+        if (!stream_read(stream, &um32_interpreter_c()))
+        {
+            um32_interpreter_fault(stream->suspended ?
+                FAULT_SUSPENDED :
+                FAULT_MISSING_READER);
+        }
+        um32_interpreter_next();
+
+    um32_interpreter_case(OPCODE_SET)
+    {
+        uint32_t address = um32_interpreter_a();
+        uint32_t offset = um32_interpreter_b();
+
+        if (!address)
+        {
+            um32_interpreter_check(offset >= length, FAULT_INVALID_ADDRESS);
+
+            if (instance->programSource)
+            {
+                if (!machine_unshare(instance))
+                {
+                    um32_interpreter_fault(FAULT_OUT_OF_MEMORY);
+                }
+
+                program = instance->program.buffer;
+            }
+
+            program[offset] = um32_interpreter_c();
+
+            if (machine_fuses(instance))
+            {
+                fusion_update(operations, program, length, offset);
+            }
+            else
+            {
+                operation(operations + offset, program[offset]);
+            }
+            um32_interpreter_next();
+        }
+
+        if (address == instance->programSource)
+        {
+            if (!machine_unshare(instance))
+            {
+                um32_interpreter_fault(FAULT_OUT_OF_MEMORY);
+            }
+
+            program = instance->program.buffer;
+        }
+
+        if (instance->cached & um32_machine_cached(address))
+        {
+            machine_forget(instance, address);
+        }
+
+        uint32_t* index = um32_interpreter_index(address, offset);
+
+        um32_interpreter_check(!index, FAULT_INVALID_ADDRESS);
+
+        *index = um32_interpreter_c();
+    }
+    um32_interpreter_next();
+
+    um32_interpreter_case(OPCODE_WRITE)
+        if (um32_interpreter_c() > UINT8_MAX)
+        {
+            um32_interpreter_fault(FAULT_INVALID_BYTE);
+        }
+
+        if (!stream->writer)
+        {
+            um32_interpreter_fault(FAULT_MISSING_WRITER);
+        }
+
+        um32_stream_write(stream, um32_interpreter_c());
+        um32_interpreter_next();
+
+    um32_interpreter_case(UM32_OPERATION_TERMINATE)
+        um32_interpreter_fault(FAULT_TERMINATED);
+
+    um32_interpreter_case(UM32_OPERATION_NOT)
+        um32_interpreter_a() = ~um32_interpreter_b();
+        um32_interpreter_next();
+
+    um32_interpreter_case(UM32_OPERATION_NEGATE)
+    {
+        um32_interpreter_fuse(OPCODE_NAND, 3);
+
+        Operation sequence = operations + instructionPointer;
+
+        registers[sequence[0].a] = ~registers[sequence[0].b];
+        registers[sequence[1].a] = sequence[1].immediate;
+        registers[sequence[2].a] =
+            registers[sequence[2].b] + registers[sequence[2].c];
+    }
+    um32_interpreter_skip(3);
+
+    um32_interpreter_case(UM32_OPERATION_SUBTRACT)
+    {
+        um32_interpreter_fuse(OPCODE_NAND, 4);
+
+        Operation sequence = operations + instructionPointer;
+
+        registers[sequence[0].a] = ~registers[sequence[0].b];
+        registers[sequence[1].a] = sequence[1].immediate;
+        registers[sequence[2].a] =
+            registers[sequence[2].b] + registers[sequence[2].c];
+        registers[sequence[3].a] =
+            registers[sequence[3].b] + registers[sequence[3].c];
+    }
+    um32_interpreter_skip(4);
+
+    um32_interpreter_case(UM32_OPERATION_JUMP)
+    {
+        um32_interpreter_fuse(OPCODE_IMMEDIATE, 3);
+
+        Operation sequence = operations + instructionPointer;
+
+        registers[sequence[0].a] = sequence[0].immediate;
+        registers[sequence[1].a] = sequence[1].immediate;
+
+        // Anything but a jump within array 0 is left to the load itself.
+
+        if (registers[sequence[2].b] || registers[sequence[2].c] >= length)
+        {
+            um32_interpreter_skip(2);
+        }
+
+        instructionPointer = registers[sequence[2].c];
+        count += 3;
+    }
+    um32_interpreter_dispatch();
+
+    um32_interpreter_case(UM32_OPERATION_IMMEDIATE_JUMP)
+    {
+        um32_interpreter_fuse(OPCODE_IMMEDIATE, 2);
+
+        Operation sequence = operations + instructionPointer;
+
+        registers[sequence[0].a] = sequence[0].immediate;
+
+        if (registers[sequence[1].b] || registers[sequence[1].c] >= length)
+        {
+            um32_interpreter_skip(1);
+        }
+
+        instructionPointer = registers[sequence[1].c];
+        count += 2;
+    }
+    um32_interpreter_dispatch();
+
+    um32_interpreter_case(UM32_OPERATION_BRANCH)
+    {
+        um32_interpreter_fuse(OPCODE_IMMEDIATE, 4);
+
+        Operation sequence = operations + instructionPointer;
+
+        registers[sequence[0].a] = sequence[0].immediate;
+        registers[sequence[1].a] = sequence[1].immediate;
+
+        if (registers[sequence[2].c])
+        {
+            registers[sequence[2].a] = registers[sequence[2].b];
+        }
+
+        if (registers[sequence[3].b] || registers[sequence[3].c] >= length)
+        {
+            um32_interpreter_skip(3);
+        }
+
+        instructionPointer = registers[sequence[3].c];
+        count += 4;
+    }
+    um32_interpreter_dispatch();
+
+#ifdef UM32_INTERPRETER_THREADED
+    label_UM32_OPERATION_INVALID:
+        um32_interpreter_fault(FAULT_INVALID_INSTRUCTION);
+#else
+        default: um32_interpreter_fault(FAULT_INVALID_INSTRUCTION);
+        }
+    }
+#endif
+
+exit:
+    if (fault)
+    {
+        stream_flush(stream);
+    }
+
+    memcpy(instance->registers, registers, sizeof registers);
+
+    instance->instructionPointer = instructionPointer;
+
+    if (executed)
+    {
+        *executed = count;
+    }
+
+    return fault;
+}
+
+#undef um32_interpreter_case
+#undef um32_interpreter_dispatch
+#undef um32_interpreter_profile
+#undef um32_interpreter_next
+#undef um32_interpreter_jump
+#undef um32_interpreter_skip
+#undef um32_interpreter_fuse
+#undef um32_interpreter_redispatch
+#undef um32_interpreter_fault
+#undef um32_interpreter_check
+#undef um32_interpreter_index
+#undef um32_interpreter_a
+#undef um32_interpreter_b
+#undef um32_interpreter_c
+#undef UM32_INTERPRETER
+#undef UM32_INTERPRETER_THREADED
+#undef UM32_INTERPRETER_TRUSTED
+#undef UM32_INTERPRETER_PROFILED
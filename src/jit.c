@@ -0,0 +1,1183 @@
+// jit.c
+// Copyright (c) 2024 Ishan Pranav
+// Licensed under the MIT license.
+
+// http://boundvariable.org
+
+// References:
+//  - https://www.felixcloutier.com/x86
+//  - https://wiki.osdev.org/X86-64_Instruction_Encoding
+
+// The JIT translates basic blocks of predecoded operations into x86-64. While
+// native code runs, UM registers live in r8d through r15d, rbx points at the
+// Jit, and eax, ecx and edx are scratch. The code buffer begins with an entry
+// trampoline that loads the registers and an exit routine that stores them.
+
+// Each block begins by charging its length against the remaining budget and
+// bails out before executing anything if the budget cannot cover it. A block
+// ends at the first operation it cannot translate or at a load from array 0.
+// Loads whose target is a known constant, or a conditional move between two
+// constants, jump straight to the target's translation; until the target is
+// translated they jump to an exit stub that is patched later. Other loads
+// look their target up in the entry table. Array reads and writes call
+// heap_index directly, except that writes to array 0, to the array the program
+// is shared with, or possibly to an array whose translations are cached, leave
+// native code. Output is appended to the
+// stream's buffer while it has room. Everything else leaves native code with
+// the instruction pointer set, for the interpreter to execute.
+
+// The code buffer is never writable and executable at once. It is mapped
+// read-write, made read-execute before an entry is handed out, and made
+// writable again only to translate a block and patch the jumps into it.
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "heap.h"
+#include "jit.h"
+#include "stream.h"
+
+#ifdef UM32_JIT_AVAILABLE
+#include <sys/mman.h>
+#define UM32_JIT_RAX 0
+#define UM32_JIT_RCX 1
+#define UM32_JIT_RDX 2
+#define UM32_JIT_RBX 3
+#define UM32_JIT_RSI 6
+#define UM32_JIT_RDI 7
+#define UM32_JIT_FIXUPS (UM32_JIT_BLOCK * 4 + 4)
+#define UM32_JIT_RESERVE (UM32_JIT_BLOCK * 256 + 512)
+#define um32_jit_register(index) (8 + (index))
+#define um32_jit_field(field) offsetof(struct Jit, field)
+
+enum JitValueKind
+{
+    JIT_VALUE_UNKNOWN = 0,
+    JIT_VALUE_CONSTANT,
+    JIT_VALUE_SELECT
+};
+
+struct JitValue
+{
+    enum JitValueKind kind;
+    uint32_t condition;
+    uint32_t value;
+    uint32_t other;
+};
+
+enum JitFixupKind
+{
+    JIT_FIXUP_EXIT = 0,
+    JIT_FIXUP_CHAIN,
+    JIT_FIXUP_DYNAMIC
+};
+
+struct JitFixup
+{
+    enum JitFixupKind kind;
+    uint32_t site;
+    uint32_t instructionPointer;
+    uint32_t executed;
+};
+
+struct JitBlock
+{
+    uint32_t start;
+    uint32_t count;
+    struct JitFixup fixups[UM32_JIT_FIXUPS];
+};
+
+static void jit_byte(Jit instance, uint8_t value)
+{
+    instance->code[instance->used] = value;
+    instance->used++;
+}
+
+static void jit_word(Jit instance, uint32_t value)
+{
+    memcpy(instance->code + instance->used, &value, sizeof value);
+
+    instance->used += sizeof value;
+}
+
+static void jit_quad(Jit instance, uint64_t value)
+{
+    memcpy(instance->code + instance->used, &value, sizeof value);
+
+    instance->used += sizeof value;
+}
+
+static void jit_rex(Jit instance, bool wide, uint32_t reg, uint32_t rm)
+{
+    uint8_t rex = 0x40 | (wide << 3) | ((reg >> 3) << 2) | (rm >> 3);
+
+    if (rex != 0x40)
+    {
+        jit_byte(instance, rex);
+    }
+}
+
+static void jit_register(
+    Jit instance,
+    uint8_t opcode,
+    uint32_t reg,
+    uint32_t rm)
+{
+    jit_rex(instance, false, reg, rm);
+    jit_byte(instance, opcode);
+    jit_byte(instance, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+static void jit_extended(
+    Jit instance,
+    uint8_t opcode,
+    uint32_t reg,
+    uint32_t rm)
+{
+    jit_rex(instance, false, reg, rm);
+    jit_byte(instance, 0x0f);
+    jit_byte(instance, opcode);
+    jit_byte(instance, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+static void jit_memory(
+    Jit instance,
+    bool wide,
+    uint8_t opcode,
+    uint32_t reg,
+    uint32_t displacement)
+{
+    jit_rex(instance, wide, reg, UM32_JIT_RBX);
+    jit_byte(instance, opcode);
+    jit_byte(instance, 0x80 | ((reg & 7) << 3) | UM32_JIT_RBX);
+    jit_word(instance, displacement);
+}
+
+static void jit_move(Jit instance, uint32_t target, uint32_t source)
+{
+    jit_register(instance, 0x89, source, target);
+}
+
+static uint32_t jit_branch(Jit instance, uint8_t condition)
+{
+    if (condition)
+    {
+        jit_byte(instance, 0x0f);
+        jit_byte(instance, condition);
+    }
+    else
+    {
+        jit_byte(instance, 0xe9);
+    }
+
+    jit_word(instance, 0);
+
+    return instance->used - sizeof(uint32_t);
+}
+
+static void jit_patch(Jit instance, uint32_t site, uint8_t* target)
+{
+    int32_t offset = target - (instance->code + site + sizeof offset);
+
+    memcpy(instance->code + site, &offset, sizeof offset);
+}
+
+static void jit_leave(Jit instance)
+{
+    uint32_t site = jit_branch(instance, 0);
+
+    jit_patch(instance, site, instance->code + instance->exit);
+}
+
+static void jit_set_instruction_pointer(Jit instance, uint32_t value)
+{
+    jit_memory(instance, false, 0xc7, 0, um32_jit_field(instructionPointer));
+    jit_word(instance, value);
+}
+
+static void jit_charge(Jit instance, uint8_t extension, uint32_t count)
+{
+    jit_memory(instance, true, 0x81, extension, um32_jit_field(remaining));
+    jit_word(instance, count);
+}
+
+static void jit_trampoline(Jit instance)
+{
+    static const uint8_t PROLOGUE[] =
+    {
+        0x53, 0x55, 0x41, 0x54, 0x41, 0x55, 0x41, 0x56, 0x41, 0x57,
+        0x48, 0x83, 0xec, 0x08, 0x48, 0x89, 0xfb
+    };
+    static const uint8_t EPILOGUE[] =
+    {
+        0x48, 0x83, 0xc4, 0x08, 0x41, 0x5f, 0x41, 0x5e, 0x41, 0x5d, 0x41,
+        0x5c, 0x5d, 0x5b, 0xc3
+    };
+
+    instance->used = 0;
+
+    for (uint32_t i = 0; i < sizeof PROLOGUE; i++)
+    {
+        jit_byte(instance, PROLOGUE[i]);
+    }
+
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        jit_memory(
+            instance,
+            false,
+            0x8b,
+            um32_jit_register(i),
+            um32_jit_field(registers) + i * sizeof(uint32_t));
+    }
+
+    jit_byte(instance, 0xff);
+    jit_byte(instance, 0xe6);
+
+    instance->exit = instance->used;
+
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        jit_memory(
+            instance,
+            false,
+            0x89,
+            um32_jit_register(i),
+            um32_jit_field(registers) + i * sizeof(uint32_t));
+    }
+
+    for (uint32_t i = 0; i < sizeof EPILOGUE; i++)
+    {
+        jit_byte(instance, EPILOGUE[i]);
+    }
+
+    instance->start = instance->used;
+}
+
+static bool jit_clear(Jit instance, uint32_t length)
+{
+    if (!instance->entries || instance->length != length)
+    {
+        void** entries = realloc(
+            instance->entries,
+            ((size_t)length + 1) * sizeof * entries);
+
+        if (!entries)
+        {
+            return false;
+        }
+
+        instance->entries = entries;
+        instance->length = length;
+    }
+
+    memset(instance->entries, 0, ((size_t)length + 1) * sizeof(void*));
+
+    instance->patches.length = 0;
+    instance->tableEpoch = instance->epoch;
+
+    return true;
+}
+
+static bool jit_protect(Jit instance, bool writable)
+{
+    if (instance->writable == writable)
+    {
+        return true;
+    }
+
+    int protection = PROT_READ | (writable ? PROT_WRITE : PROT_EXEC);
+
+    if (mprotect(instance->code, UM32_JIT_CODE, protection))
+    {
+        instance->disabled = true;
+
+        return false;
+    }
+
+    instance->writable = writable;
+
+    return true;
+}
+
+// Discards every translation, including those in tables that are swapped
+// out, which no longer match the epoch.
+
+static bool jit_reset(Jit instance, uint32_t length)
+{
+    if (!instance->code)
+    {
+        void* code = mmap(
+            NULL,
+            UM32_JIT_CODE,
+            PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS,
+            -1,
+            0);
+
+        if (code == MAP_FAILED)
+        {
+            instance->disabled = true;
+
+            return false;
+        }
+
+        instance->code = code;
+        instance->writable = true;
+
+        jit_trampoline(instance);
+    }
+
+    instance->used = instance->start;
+    instance->epoch++;
+
+    if (!instance->epoch)
+    {
+        instance->epoch++;
+    }
+
+    if (!jit_clear(instance, length))
+    {
+        return false;
+    }
+
+    instance->valid = true;
+
+    return true;
+}
+
+static void jit_assign(
+    struct JitValue values[],
+    uint32_t index,
+    struct JitValue value)
+{
+    for (uint32_t i = 0; i < 8; i++)
+    {
+        if (values[i].kind == JIT_VALUE_SELECT && values[i].condition == index)
+        {
+            values[i].kind = JIT_VALUE_UNKNOWN;
+        }
+    }
+
+    if (value.kind == JIT_VALUE_SELECT && value.condition == index)
+    {
+        value.kind = JIT_VALUE_UNKNOWN;
+    }
+
+    values[index] = value;
+}
+
+static bool jit_constant(struct JitValue value, uint32_t constant)
+{
+    return value.kind == JIT_VALUE_CONSTANT && value.value == constant;
+}
+
+static void jit_conditional_move(
+    Jit instance,
+    struct JitValue values[],
+    struct Operation operation)
+{
+    struct JitValue a = values[operation.a];
+    struct JitValue b = values[operation.b];
+    struct JitValue c = values[operation.c];
+    struct JitValue result = { 0 };
+
+    jit_register(
+        instance,
+        0x85,
+        um32_jit_register(operation.c),
+        um32_jit_register(operation.c));
+    jit_extended(
+        instance,
+        0x45,
+        um32_jit_register(operation.a),
+        um32_jit_register(operation.b));
+
+    if (c.kind == JIT_VALUE_CONSTANT)
+    {
+        result = c.value ? b : a;
+    }
+    else if (operation.c != operation.a &&
+        a.kind == JIT_VALUE_CONSTANT &&
+        b.kind == JIT_VALUE_CONSTANT)
+    {
+        result.kind = JIT_VALUE_SELECT;
+        result.condition = operation.c;
+        result.value = a.value;
+        result.other = b.value;
+    }
+
+    jit_assign(values, operation.a, result);
+}
+
+static void jit_arithmetic(
+    Jit instance,
+    struct JitValue values[],
+    struct Operation operation)
+{
+    struct JitValue b = values[operation.b];
+    struct JitValue c = values[operation.c];
+    struct JitValue result = { 0 };
+    bool constant = b.kind == JIT_VALUE_CONSTANT &&
+        c.kind == JIT_VALUE_CONSTANT;
+
+    jit_move(instance, UM32_JIT_RAX, um32_jit_register(operation.b));
+
+    switch (operation.opcode)
+    {
+        case OPCODE_ADD:
+            jit_register(
+                instance,
+                0x01,
+                um32_jit_register(operation.c),
+                UM32_JIT_RAX);
+
+            result.value = b.value + c.value;
+            break;
+
+        case OPCODE_MULTIPLY:
+            jit_extended(
+                instance,
+                0xaf,
+                UM32_JIT_RAX,
+                um32_jit_register(operation.c));
+
+            result.value = b.value * c.value;
+            break;
+
+        default:
+            jit_register(
+                instance,
+                0x21,
+                um32_jit_register(operation.c),
+                UM32_JIT_RAX);
+            jit_register(instance, 0xf7, 2, UM32_JIT_RAX);
+
+            result.value = ~(b.value & c.value);
+            break;
+    }
+
+    jit_move(instance, um32_jit_register(operation.a), UM32_JIT_RAX);
+
+    if (constant)
+    {
+        result.kind = JIT_VALUE_CONSTANT;
+    }
+
+    jit_assign(values, operation.a, result);
+}
+
+static void jit_fixup(
+    Jit instance,
+    struct JitBlock* block,
+    enum JitFixupKind kind,
+    uint8_t condition,
+    uint32_t instructionPointer,
+    uint32_t executed)
+{
+    struct JitFixup* fixup = block->fixups + block->count;
+
+    fixup->kind = kind;
+    fixup->site = jit_branch(instance, condition);
+    fixup->instructionPointer = instructionPointer;
+    fixup->executed = executed;
+    block->count++;
+}
+
+static void jit_pointer(Jit instance, uint32_t reg, const void* value)
+{
+    uint64_t address;
+
+    memcpy(&address, &value, sizeof value);
+    jit_rex(instance, true, 0, reg);
+    jit_byte(instance, 0xb8 + (reg & 7));
+    jit_quad(instance, address);
+}
+
+static void jit_heap_index(Jit instance, uint32_t address, uint32_t offset)
+{
+    static const uint8_t SAVE[] =
+    {
+        0x41, 0x50, 0x41, 0x51, 0x41, 0x52, 0x41, 0x53
+    };
+    static const uint8_t RESTORE[] =
+    {
+        0x41, 0x5b, 0x41, 0x5a, 0x41, 0x59, 0x41, 0x58
+    };
+    uint32_t* (*function)(Heap, uint32_t, uint32_t, uint32_t*) = heap_index;
+    uint64_t target;
+
+    memcpy(&target, &function, sizeof target);
+
+    for (uint32_t i = 0; i < sizeof SAVE; i++)
+    {
+        jit_byte(instance, SAVE[i]);
+    }
+
+    jit_pointer(instance, UM32_JIT_RDI, instance->heap);
+    jit_move(instance, UM32_JIT_RSI, address);
+    jit_move(instance, UM32_JIT_RDX, offset);
+    jit_register(instance, 0x31, UM32_JIT_RCX, UM32_JIT_RCX);
+    jit_rex(instance, true, 0, UM32_JIT_RAX);
+    jit_byte(instance, 0xb8);
+    jit_quad(instance, target);
+    jit_byte(instance, 0xff);
+    jit_byte(instance, 0xd0);
+
+    for (uint32_t i = 0; i < sizeof RESTORE; i++)
+    {
+        jit_byte(instance, RESTORE[i]);
+    }
+
+    jit_byte(instance, 0x48);
+    jit_register(instance, 0x85, UM32_JIT_RAX, UM32_JIT_RAX);
+}
+
+static void jit_get(
+    Jit instance,
+    struct JitBlock* block,
+    struct Operation operation,
+    uint32_t length,
+    uint32_t instructionPointer)
+{
+    uint32_t a = um32_jit_register(operation.a);
+    uint32_t b = um32_jit_register(operation.b);
+    uint32_t c = um32_jit_register(operation.c);
+    uint32_t executed = instructionPointer - block->start;
+
+    jit_register(instance, 0x85, b, b);
+
+    uint32_t heap = jit_branch(instance, 0x85);
+
+    jit_rex(instance, false, 0, c);
+    jit_byte(instance, 0x81);
+    jit_byte(instance, 0xf8 | (c & 7));
+    jit_word(instance, length);
+    jit_fixup(
+        instance,
+        block,
+        JIT_FIXUP_EXIT,
+        0x83,
+        instructionPointer,
+        executed);
+    jit_pointer(instance, UM32_JIT_RAX, instance->program);
+    jit_byte(instance, 0x48);
+    jit_byte(instance, 0x8b);
+    jit_byte(instance, 0x00);
+    jit_byte(instance, 0x40 | ((a >> 3) << 2) | ((c >> 3) << 1));
+    jit_byte(instance, 0x8b);
+    jit_byte(instance, 0x04 | ((a & 7) << 3));
+    jit_byte(instance, 0x80 | ((c & 7) << 3) | UM32_JIT_RAX);
+
+    uint32_t done = jit_branch(instance, 0);
+
+    jit_patch(instance, heap, instance->code + instance->used);
+    jit_heap_index(instance, b, c);
+    jit_fixup(
+        instance,
+        block,
+        JIT_FIXUP_EXIT,
+        0x84,
+        instructionPointer,
+        executed);
+    jit_rex(instance, false, a, UM32_JIT_RAX);
+    jit_byte(instance, 0x8b);
+    jit_byte(instance, (a & 7) << 3);
+    jit_patch(instance, done, instance->code + instance->used);
+}
+
+static void jit_set(
+    Jit instance,
+    struct JitBlock* block,
+    struct Operation operation,
+    uint32_t instructionPointer)
+{
+    uint32_t a = um32_jit_register(operation.a);
+    uint32_t b = um32_jit_register(operation.b);
+    uint32_t c = um32_jit_register(operation.c);
+    uint32_t executed = instructionPointer - block->start;
+
+    jit_register(instance, 0x85, a, a);
+    jit_fixup(
+        instance,
+        block,
+        JIT_FIXUP_EXIT,
+        0x84,
+        instructionPointer,
+        executed);
+    jit_pointer(instance, UM32_JIT_RAX, instance->source);
+    jit_rex(instance, false, a, UM32_JIT_RAX);
+    jit_byte(instance, 0x3b);
+    jit_byte(instance, (a & 7) << 3);
+    jit_fixup(
+        instance,
+        block,
+        JIT_FIXUP_EXIT,
+        0x84,
+        instructionPointer,
+        executed);
+    jit_pointer(instance, UM32_JIT_RAX, instance->cached);
+    jit_byte(instance, 0x48);
+    jit_byte(instance, 0x8b);
+    jit_byte(instance, 0x00);
+    jit_rex(instance, true, a, UM32_JIT_RAX);
+    jit_byte(instance, 0x0f);
+    jit_byte(instance, 0xa3);
+    jit_byte(instance, 0xc0 | ((a & 7) << 3));
+    jit_fixup(
+        instance,
+        block,
+        JIT_FIXUP_EXIT,
+        0x82,
+        instructionPointer,
+        executed);
+    jit_heap_index(instance, a, b);
+    jit_fixup(
+        instance,
+        block,
+        JIT_FIXUP_EXIT,
+        0x84,
+        instructionPointer,
+        executed);
+    jit_rex(instance, false, c, UM32_JIT_RAX);
+    jit_byte(instance, 0x89);
+    jit_byte(instance, (c & 7) << 3);
+}
+
+static void jit_write(
+    Jit instance,
+    struct JitBlock* block,
+    struct Operation operation,
+    uint32_t instructionPointer)
+{
+    uint32_t c = um32_jit_register(operation.c);
+    uint32_t executed = instructionPointer - block->start;
+
+    jit_rex(instance, false, 0, c);
+    jit_byte(instance, 0x81);
+    jit_byte(instance, 0xf8 | (c & 7));
+    jit_word(instance, UINT8_MAX);
+    jit_fixup(
+        instance,
+        block,
+        JIT_FIXUP_EXIT,
+        0x87,
+        instructionPointer,
+        executed);
+    jit_pointer(instance, UM32_JIT_RAX, instance->stream);
+    jit_byte(instance, 0x8b);
+    jit_byte(instance, 0x80 | (UM32_JIT_RDX << 3));
+    jit_word(instance, offsetof(struct Stream, outputLength));
+    jit_byte(instance, 0x81);
+    jit_byte(instance, 0xf8 | UM32_JIT_RDX);
+    jit_word(instance, UM32_STREAM_BUFFER);
+    jit_fixup(
+        instance,
+        block,
+        JIT_FIXUP_EXIT,
+        0x83,
+        instructionPointer,
+        executed);
+    jit_rex(instance, false, c, UM32_JIT_RAX);
+    jit_byte(instance, 0x88);
+    jit_byte(instance, 0x84 | ((c & 7) << 3));
+    jit_byte(instance, (UM32_JIT_RDX << 3) | UM32_JIT_RAX);
+    jit_word(instance, offsetof(struct Stream, output));
+    jit_byte(instance, 0x83);
+    jit_byte(instance, 0xc0 | UM32_JIT_RDX);
+    jit_byte(instance, 1);
+    jit_byte(instance, 0x89);
+    jit_byte(instance, 0x80 | (UM32_JIT_RDX << 3));
+    jit_word(instance, offsetof(struct Stream, outputLength));
+}
+
+static void jit_load(
+    Jit instance,
+    struct JitBlock* block,
+    struct JitValue values[],
+    struct Operation operation,
+    uint32_t length,
+    uint32_t instructionPointer)
+{
+    struct JitValue b = values[operation.b];
+    struct JitValue c = values[operation.c];
+    uint32_t executed = instructionPointer - block->start;
+
+    if (!jit_constant(b, 0))
+    {
+        uint32_t array = um32_jit_register(operation.b);
+
+        jit_register(instance, 0x85, array, array);
+        jit_fixup(
+            instance,
+            block,
+            JIT_FIXUP_EXIT,
+            0x85,
+            instructionPointer,
+            executed);
+    }
+
+    if (c.kind == JIT_VALUE_CONSTANT && c.value < length)
+    {
+        jit_fixup(instance, block, JIT_FIXUP_CHAIN, 0, c.value, 0);
+
+        return;
+    }
+
+    if (c.kind == JIT_VALUE_SELECT && c.value < length && c.other < length)
+    {
+        uint32_t condition = um32_jit_register(c.condition);
+
+        jit_register(instance, 0x85, condition, condition);
+        jit_fixup(instance, block, JIT_FIXUP_CHAIN, 0x85, c.other, 0);
+        jit_fixup(instance, block, JIT_FIXUP_CHAIN, 0, c.value, 0);
+
+        return;
+    }
+
+    jit_move(instance, UM32_JIT_RAX, um32_jit_register(operation.c));
+    jit_byte(instance, 0x3d);
+    jit_word(instance, length);
+    jit_fixup(
+        instance,
+        block,
+        JIT_FIXUP_EXIT,
+        0x83,
+        instructionPointer,
+        executed);
+    jit_pointer(instance, UM32_JIT_RDX, instance->entries);
+    jit_byte(instance, 0x48);
+    jit_byte(instance, 0x8b);
+    jit_byte(instance, 0x14);
+    jit_byte(instance, 0xc2);
+    jit_byte(instance, 0x48);
+    jit_register(instance, 0x85, UM32_JIT_RDX, UM32_JIT_RDX);
+    jit_fixup(instance, block, JIT_FIXUP_DYNAMIC, 0x84, 0, 0);
+    jit_byte(instance, 0xff);
+    jit_byte(instance, 0xe2);
+}
+
+static void jit_resolve(Jit instance, struct JitBlock* block, uint32_t executed)
+{
+    for (uint32_t k = 0; k < block->count; k++)
+    {
+        struct JitFixup fixup = block->fixups[k];
+        void* target = NULL;
+
+        if (fixup.kind == JIT_FIXUP_CHAIN)
+        {
+            target = instance->entries[fixup.instructionPointer];
+        }
+
+        if (target)
+        {
+            jit_patch(instance, fixup.site, target);
+
+            continue;
+        }
+
+        jit_patch(instance, fixup.site, instance->code + instance->used);
+
+        switch (fixup.kind)
+        {
+            case JIT_FIXUP_EXIT:
+                jit_charge(instance, 0, executed - fixup.executed);
+                jit_set_instruction_pointer(
+                    instance,
+                    fixup.instructionPointer);
+                break;
+
+            case JIT_FIXUP_CHAIN:
+                jit_set_instruction_pointer(
+                    instance,
+                    fixup.instructionPointer);
+
+                if (!segment_add(&instance->patches, fixup.site) ||
+                    !segment_add(&instance->patches, fixup.instructionPointer))
+                {
+                    instance->valid = false;
+                }
+                break;
+
+            case JIT_FIXUP_DYNAMIC:
+                jit_memory(
+                    instance,
+                    false,
+                    0x89,
+                    UM32_JIT_RAX,
+                    um32_jit_field(instructionPointer));
+                break;
+        }
+
+        jit_leave(instance);
+    }
+
+    Segment patches = &instance->patches;
+    void* entry = instance->entries[block->start];
+
+    for (uint32_t k = 0; k < patches->length; )
+    {
+        if (patches->buffer[k + 1] != block->start)
+        {
+            k += 2;
+
+            continue;
+        }
+
+        jit_patch(instance, patches->buffer[k], entry);
+
+        patches->length -= 2;
+        patches->buffer[k] = patches->buffer[patches->length];
+        patches->buffer[k + 1] = patches->buffer[patches->length + 1];
+    }
+}
+
+static void* jit_compile(
+    Jit instance,
+    Operation operations,
+    uint32_t length,
+    uint32_t start)
+{
+    struct JitValue values[8] = { { 0 } };
+    struct JitBlock block;
+
+    if (UM32_JIT_CODE - instance->used < UM32_JIT_RESERVE &&
+        !jit_reset(instance, length))
+    {
+        return NULL;
+    }
+
+    if (!jit_protect(instance, true))
+    {
+        return NULL;
+    }
+
+    uint8_t* entry = instance->code + instance->used;
+
+    jit_charge(instance, 5, 0);
+
+    uint32_t charge = instance->used - sizeof(uint32_t);
+    uint32_t bail = jit_branch(instance, 0x82);
+    uint32_t i = start;
+    bool terminated = false;
+    bool transferred = false;
+
+    block.start = start;
+    block.count = 0;
+
+    while (!terminated && i - start < UM32_JIT_BLOCK)
+    {
+        struct Operation operation = operations[i];
+        struct JitValue unknown = { 0 };
+
+        switch (operation.opcode)
+        {
+            case OPCODE_ADD:
+            case OPCODE_MULTIPLY:
+            case OPCODE_NAND:
+                jit_arithmetic(instance, values, operation);
+                break;
+
+            case OPCODE_CONDITIONAL_MOVE:
+                jit_conditional_move(instance, values, operation);
+                break;
+
+            case OPCODE_IMMEDIATE:
+            {
+                struct JitValue result = { JIT_VALUE_CONSTANT, 0, 0, 0 };
+                uint32_t target = um32_jit_register(operation.a);
+
+                jit_rex(instance, false, 0, target);
+                jit_byte(instance, 0xb8 + (target & 7));
+                jit_word(instance, operation.immediate);
+
+                result.value = operation.immediate;
+
+                jit_assign(values, operation.a, result);
+            }
+            break;
+
+            case OPCODE_DIVIDE:
+                jit_move(
+                    instance,
+                    UM32_JIT_RCX,
+                    um32_jit_register(operation.c));
+                jit_register(instance, 0x85, UM32_JIT_RCX, UM32_JIT_RCX);
+                jit_fixup(
+                    instance,
+                    &block,
+                    JIT_FIXUP_EXIT,
+                    0x84,
+                    i,
+                    i - start);
+                jit_move(
+                    instance,
+                    UM32_JIT_RAX,
+                    um32_jit_register(operation.b));
+                jit_register(instance, 0x31, UM32_JIT_RDX, UM32_JIT_RDX);
+                jit_register(instance, 0xf7, 6, UM32_JIT_RCX);
+                jit_move(
+                    instance,
+                    um32_jit_register(operation.a),
+                    UM32_JIT_RAX);
+                jit_assign(values, operation.a, unknown);
+                break;
+
+            case OPCODE_GET:
+                jit_get(instance, &block, operation, length, i);
+                jit_assign(values, operation.a, unknown);
+                break;
+
+            case OPCODE_SET:
+                jit_set(instance, &block, operation, i);
+                break;
+
+            case OPCODE_WRITE:
+                if (!instance->stream->writer)
+                {
+                    terminated = true;
+                    break;
+                }
+
+                jit_write(instance, &block, operation, i);
+                break;
+
+            case OPCODE_LOAD:
+                if (values[operation.b].kind == JIT_VALUE_CONSTANT &&
+                    values[operation.b].value)
+                {
+                    terminated = true;
+                    break;
+                }
+
+                jit_load(instance, &block, values, operation, length, i);
+
+                terminated = true;
+                transferred = true;
+                break;
+
+            default:
+                terminated = true;
+                break;
+        }
+
+        if (!terminated || transferred)
+        {
+            i++;
+        }
+    }
+
+    uint32_t executed = i - start;
+
+    if (!transferred)
+    {
+        jit_set_instruction_pointer(instance, i);
+        jit_leave(instance);
+    }
+
+    memcpy(instance->code + charge, &executed, sizeof executed);
+
+    instance->entries[start] = entry;
+
+    jit_patch(instance, bail, instance->code + instance->used);
+    jit_charge(instance, 0, executed);
+    jit_set_instruction_pointer(instance, start);
+    jit_leave(instance);
+    jit_resolve(instance, &block, executed);
+
+    return entry;
+}
+
+static void* jit_translate(
+    Jit instance,
+    Operation operations,
+    uint32_t length,
+    uint32_t instructionPointer)
+{
+    switch (operations[instructionPointer].opcode)
+    {
+        case OPCODE_WRITE:
+            if (!instance->stream->writer)
+            {
+                return NULL;
+            }
+            // fall through
+
+        case OPCODE_ADD:
+        case OPCODE_CONDITIONAL_MOVE:
+        case OPCODE_DIVIDE:
+        case OPCODE_GET:
+        case OPCODE_IMMEDIATE:
+        case OPCODE_LOAD:
+        case OPCODE_MULTIPLY:
+        case OPCODE_NAND:
+        case OPCODE_SET:
+            return jit_compile(
+                instance,
+                operations,
+                length,
+                instructionPointer);
+
+        default: return NULL;
+    }
+}
+#endif
+
+bool jit(
+    Jit instance,
+    Heap heap,
+    Stream stream,
+    uint32_t** program,
+    uint32_t* source,
+    const uint64_t* cached)
+{
+    instance->heap = heap;
+    instance->stream = stream;
+    instance->program = program;
+    instance->source = source;
+    instance->cached = cached;
+    instance->code = NULL;
+    instance->used = 0;
+    instance->start = 0;
+    instance->exit = 0;
+    instance->entries = NULL;
+    instance->length = 0;
+    instance->epoch = 0;
+    instance->tableEpoch = 0;
+    instance->valid = false;
+    instance->disabled = false;
+    instance->writable = false;
+
+    return segment(&instance->patches, 0);
+}
+
+void* jit_entry(
+    Jit instance,
+    Operation operations,
+    uint32_t length,
+    uint32_t instructionPointer)
+{
+#ifdef UM32_JIT_AVAILABLE
+    if (instance->disabled)
+    {
+        return NULL;
+    }
+
+    if (!instance->valid && !jit_reset(instance, length))
+    {
+        return NULL;
+    }
+
+    if ((instance->tableEpoch != instance->epoch ||
+        instance->length != length) &&
+        !jit_clear(instance, length))
+    {
+        return NULL;
+    }
+
+    void* entry = instance->entries[instructionPointer];
+
+    if (!entry)
+    {
+        entry = jit_translate(instance, operations, length, instructionPointer);
+    }
+
+    if (!entry || !jit_protect(instance, false))
+    {
+        return NULL;
+    }
+
+    return entry;
+#else
+    (void)instance;
+    (void)operations;
+    (void)length;
+    (void)instructionPointer;
+
+    return NULL;
+#endif
+}
+
+void jit_execute(Jit instance, void* entry)
+{
+#ifdef UM32_JIT_AVAILABLE
+    void (*trampoline)(Jit, void*);
+    void* code = instance->code;
+
+    memcpy(&trampoline, &code, sizeof trampoline);
+    trampoline(instance, entry);
+#else
+    (void)instance;
+    (void)entry;
+#endif
+}
+
+void jit_invalidate(Jit instance)
+{
+    instance->valid = false;
+}
+
+bool jit_table(JitTable instance)
+{
+    instance->entries = NULL;
+    instance->length = 0;
+    instance->epoch = 0;
+
+    return segment(&instance->patches, 0);
+}
+
+void jit_swap(Jit instance, JitTable table)
+{
+    struct JitTable current =
+    {
+        .entries = instance->entries,
+        .length = instance->length,
+        .epoch = instance->tableEpoch,
+        .patches = instance->patches
+    };
+
+    instance->entries = table->entries;
+    instance->length = table->length;
+    instance->tableEpoch = table->epoch;
+    instance->patches = table->patches;
+    *table = current;
+}
+
+// Forgets the translations of the current program alone, leaving the code of
+// the other tables in place.
+
+void jit_invalidate_table(Jit instance)
+{
+    instance->tableEpoch = 0;
+}
+
+void finalize_jit_table(JitTable instance)
+{
+    free(instance->entries);
+    finalize_segment(&instance->patches);
+
+    instance->entries = NULL;
+}
+
+void finalize_jit(Jit instance)
+{
+#ifdef UM32_JIT_AVAILABLE
+    if (instance->code)
+    {
+        munmap(instance->code, UM32_JIT_CODE);
+
+        instance->code = NULL;
+    }
+#endif
+
+    if (instance->entries)
+    {
+        free(instance->entries);
+
+        instance->entries = NULL;
+    }
+
+    finalize_segment(&instance->patches);
+
+    instance->valid = false;
+}
@@ -0,0 +1,83 @@
+// jit.h
+// Copyright (c) 2024 Ishan Pranav
+// Licensed under the MIT license.
+
+// http://boundvariable.org
+
+#ifndef UM32_JIT
+#define UM32_JIT
+#include "operation.h"
+#include "segment.h"
+#define UM32_JIT_CODE 0x1000000
+#define UM32_JIT_BLOCK 1024
+
+#if defined(__x86_64__) && defined(__linux__) && !defined(UM32_JIT_DISABLED)
+#define UM32_JIT_AVAILABLE
+#endif
+
+struct Heap;
+struct Stream;
+
+// The entry table and pending patches of one program. A machine keeps one per
+// array it has recently loaded, so that their translations outlive a load of
+// another array; a table is only valid while its epoch matches the code.
+
+struct JitTable
+{
+    void** entries;
+    uint32_t length;
+    uint32_t epoch;
+    struct Segment patches;
+};
+
+typedef struct JitTable* JitTable;
+
+struct Jit
+{
+    uint32_t registers[8];
+    uint32_t instructionPointer;
+    uint64_t remaining;
+    uint8_t* code;
+    uint32_t used;
+    uint32_t start;
+    uint32_t exit;
+    void** entries;
+    uint32_t length;
+    uint32_t epoch;
+    uint32_t tableEpoch;
+    bool valid;
+    bool disabled;
+    bool writable;
+    struct Segment patches;
+    struct Heap* heap;
+    struct Stream* stream;
+    uint32_t** program;
+    uint32_t* source;
+    const uint64_t* cached;
+};
+
+typedef struct Jit* Jit;
+
+bool jit(
+    Jit instance,
+    struct Heap* heap,
+    struct Stream* stream,
+    uint32_t** program,
+    uint32_t* source,
+    const uint64_t* cached);
+
+void* jit_entry(
+    Jit instance,
+    Operation operations,
+    uint32_t length,
+    uint32_t instructionPointer);
+
+void jit_execute(Jit instance, void* entry);
+void jit_invalidate(Jit instance);
+bool jit_table(JitTable instance);
+void jit_swap(Jit instance, JitTable table);
+void jit_invalidate_table(Jit instance);
+void finalize_jit_table(JitTable instance);
+void finalize_jit(Jit instance);
+
+#endif
@@ -4,12 +4,311 @@
 
 // http://boundvariable.org
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define UM32_MACHINE_MAP
+#endif
+
+#include <errno.h>
+#include "fusion.h"
 #include "instruction.h"
 #include "machine.h"
 #include "opcode.h"
 #define UM32_MACHINE_CHUNK_SIZE 256
 
+struct MachineCheckpoint
+{
+    uint32_t instructionPointer;
+    uint32_t registers[UM32_MACHINE_REGISTERS];
+    uint32_t programSource;
+};
+
+#if defined(__GNUC__) && !defined(UM32_MACHINE_NO_THREADED)
+#define UM32_MACHINE_THREADED
+#define UM32_MACHINE_DEFAULT_ENGINE ENGINE_THREADED
+#else
+#define UM32_MACHINE_DEFAULT_ENGINE ENGINE_SWITCH
+#endif
+
+static bool machine_fuses(Machine instance)
+{
+    // Translated code cannot chain through superinstructions, and a profile
+    // counts the instructions that the program actually contains.
+
+    return instance->fused &&
+        instance->engine != ENGINE_JIT &&
+        !instance->profile;
+}
+
+static bool machine_decode(Machine instance)
+{
+    uint32_t length = instance->program.length;
+
+    if (length >= instance->operationsCapacity)
+    {
+        uint32_t capacity = instance->program.capacity + 1;
+        Operation operations = realloc(
+            instance->operations,
+            capacity * sizeof * operations);
+
+        if (!operations)
+        {
+            return false;
+        }
+
+        instance->operations = operations;
+        instance->operationsCapacity = capacity;
+    }
+
+    for (uint32_t i = 0; i < length; i++)
+    {
+        operation(instance->operations + i, instance->program.buffer[i]);
+    }
+
+    operation_terminate(instance->operations + length);
+
+    if (machine_fuses(instance))
+    {
+        fusion_apply(
+            instance->operations,
+            instance->program.buffer,
+            length);
+    }
+
+    instance->decoded = true;
+
+    return true;
+}
+
+static void machine_share(Machine instance, uint32_t address)
+{
+    uint32_t length;
+    uint32_t* buffer = heap_index(&instance->heap, address, 0, &length);
+
+    if (!instance->programSource)
+    {
+        instance->programStorage = instance->program;
+    }
+
+    instance->program.length = length;
+    instance->program.capacity = length;
+    instance->program.buffer = buffer;
+    instance->programSource = address;
+}
+
+static void machine_filter(Machine instance)
+{
+    instance->cached = 0;
+
+    for (uint32_t i = 0; i < UM32_MACHINE_DECODINGS; i++)
+    {
+        uint32_t source = instance->decodings[i].source;
+
+        if (source)
+        {
+            instance->cached |= um32_machine_cached(source);
+        }
+    }
+}
+
+// Drops the decoding kept for an array that is about to change or be freed.
+// The interpreter only calls this when the filter says it might be cached.
+
+static void machine_forget(Machine instance, uint32_t address)
+{
+    for (uint32_t i = 0; i < UM32_MACHINE_DECODINGS; i++)
+    {
+        if (instance->decodings[i].source == address)
+        {
+            instance->decodings[i].source = 0;
+        }
+    }
+
+    machine_filter(instance);
+}
+
+static void machine_forget_all(Machine instance)
+{
+    for (uint32_t i = 0; i < UM32_MACHINE_DECODINGS; i++)
+    {
+        instance->decodings[i].source = 0;
+    }
+
+    instance->cached = 0;
+}
+
+// Makes an array the program. If the array was decoded before and has not
+// changed since, its slot is swapped in. A program being replaced that is
+// itself shared with an array keeps its decoding and translations in the
+// slot given up, or else in an empty or the least recently used slot, whose
+// buffers are then reused to decode the array.
+
+static bool machine_load(Machine instance, uint32_t address)
+{
+    bool fused = machine_fuses(instance);
+    MachineDecoding slot = NULL;
+
+    for (uint32_t i = 0; i < UM32_MACHINE_DECODINGS; i++)
+    {
+        MachineDecoding candidate = instance->decodings + i;
+
+        if (candidate->source == address && candidate->fused == fused)
+        {
+            slot = candidate;
+
+            break;
+        }
+
+        if (!slot ||
+            (slot->source &&
+                (!candidate->source || candidate->used < slot->used)))
+        {
+            slot = candidate;
+        }
+    }
+
+    bool found = slot->source == address && slot->fused == fused;
+
+    if (found || instance->programSource)
+    {
+        Operation operations = slot->operations;
+        uint32_t operationsCapacity = slot->operationsCapacity;
+
+        slot->source = instance->programSource;
+        slot->fused = fused;
+        slot->used = ++instance->loads;
+        slot->operations = instance->operations;
+        slot->operationsCapacity = instance->operationsCapacity;
+        instance->operations = operations;
+        instance->operationsCapacity = operationsCapacity;
+
+        jit_swap(&instance->jit, &slot->table);
+    }
+
+    machine_share(instance, address);
+
+    instance->generation++;
+
+    machine_filter(instance);
+
+    if (found)
+    {
+        return true;
+    }
+
+    instance->decoded = false;
+
+    jit_invalidate_table(&instance->jit);
+
+    return machine_decode(instance);
+}
+
+static bool machine_unshare(Machine instance)
+{
+    Segment storage = &instance->programStorage;
+    uint32_t length = instance->program.length;
+
+    if (!segment_ensure_capacity(storage, length))
+    {
+        return false;
+    }
+
+    memcpy(
+        storage->buffer,
+        instance->program.buffer,
+        length * sizeof * storage->buffer);
+
+    storage->length = length;
+    instance->program = *storage;
+    instance->programSource = 0;
+    storage->length = 0;
+    storage->capacity = 0;
+    storage->buffer = NULL;
+    storage->mapped = false;
+
+    return true;
+}
+
+#define UM32_INTERPRETER machine_run_switch
+#include "interpreter.h"
+
+#define UM32_INTERPRETER machine_run_switch_trusted
+#define UM32_INTERPRETER_TRUSTED
+#include "interpreter.h"
+
+#define UM32_INTERPRETER machine_run_switch_profiled
+#define UM32_INTERPRETER_PROFILED
+#include "interpreter.h"
+
+#ifdef UM32_MACHINE_THREADED
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#define UM32_INTERPRETER machine_run_threaded
+#define UM32_INTERPRETER_THREADED
+#include "interpreter.h"
+
+#define UM32_INTERPRETER machine_run_threaded_trusted
+#define UM32_INTERPRETER_THREADED
+#define UM32_INTERPRETER_TRUSTED
+#include "interpreter.h"
+
+#define UM32_INTERPRETER machine_run_threaded_profiled
+#define UM32_INTERPRETER_THREADED
+#define UM32_INTERPRETER_PROFILED
+#include "interpreter.h"
+#pragma GCC diagnostic pop
+#endif
+
+static uint32_t machine_read(void* context, uint8_t buffer[], uint32_t length)
+{
+    Machine instance = context;
+
+    (void)length;
+
+    buffer[0] = instance->reader();
+
+    return 1;
+}
+
+static void machine_write(
+    void* context,
+    const uint8_t buffer[],
+    uint32_t length)
+{
+    Machine instance = context;
+
+    for (uint32_t i = 0; i < length; i++)
+    {
+        instance->writer(buffer[i]);
+    }
+}
+
 bool machine(Machine instance, Reader reader, Writer writer)
+{
+    // The byte callbacks are adapted to the block interface one byte at a
+    // time, so that a read never waits for more input than it returns.
+
+    if (!machine_stream(
+        instance,
+        reader ? machine_read : NULL,
+        writer ? machine_write : NULL,
+        instance))
+    {
+        return false;
+    }
+
+    instance->reader = reader;
+    instance->writer = writer;
+
+    return true;
+}
+
+bool machine_stream(
+    Machine instance,
+    BlockReader reader,
+    BlockWriter writer,
+    void* context)
 {
     if (!segment(&instance->program, 0))
     {
@@ -23,28 +322,158 @@ bool machine(Machine instance, Reader reader, Writer writer)
         return false;
     }
 
+    if (!jit(
+        &instance->jit,
+        &instance->heap,
+        &instance->stream,
+        &instance->program.buffer,
+        &instance->programSource,
+        &instance->cached))
+    {
+        finalize_segment(&instance->program);
+        finalize_heap(&instance->heap);
+
+        return false;
+    }
+
+    for (uint32_t i = 0; i < UM32_MACHINE_DECODINGS; i++)
+    {
+        MachineDecoding decoding = instance->decodings + i;
+
+        if (!jit_table(&decoding->table))
+        {
+            while (i)
+            {
+                i--;
+                finalize_jit_table(&instance->decodings[i].table);
+            }
+
+            finalize_segment(&instance->program);
+            finalize_heap(&instance->heap);
+            finalize_jit(&instance->jit);
+
+            return false;
+        }
+
+        decoding->source = 0;
+        decoding->fused = false;
+        decoding->used = 0;
+        decoding->operations = NULL;
+        decoding->operationsCapacity = 0;
+    }
+
     memset(instance->registers, 0, sizeof instance->registers);
 
     instance->instructionPointer = 0;
-    instance->reader = reader;
-    instance->writer = writer;
+    instance->programStorage.length = 0;
+    instance->programStorage.capacity = 0;
+    instance->programStorage.buffer = NULL;
+    instance->programStorage.mapped = false;
+    instance->programStorage.huge = false;
+    instance->programSource = 0;
+    instance->operations = NULL;
+    instance->operationsCapacity = 0;
+    instance->decoded = false;
+    instance->cached = 0;
+    instance->loads = 0;
+    instance->reader = NULL;
+    instance->writer = NULL;
+    instance->engine = UM32_MACHINE_DEFAULT_ENGINE;
+    instance->trusted = false;
+    instance->fused = false;
+    instance->profile = NULL;
+    instance->generation = 0;
+
+    stream(&instance->stream, reader, writer, context);
 
     return true;
 }
 
+#ifdef UM32_MACHINE_MAP
+static bool machine_map_program(Machine instance, FILE* input)
+{
+    struct stat status;
+    long position = ftell(input);
+    int descriptor = fileno(input);
+
+    if (position < 0 ||
+        fstat(descriptor, &status) != 0 ||
+        !S_ISREG(status.st_mode) ||
+        status.st_size <= position)
+    {
+        return false;
+    }
+
+    Segment program = &instance->program;
+    size_t size = status.st_size;
+    uint64_t count = (size - position) / sizeof(uint32_t);
+
+    if (count > UINT32_MAX - program->length)
+    {
+        return false;
+    }
+
+    // Size the program once from the file length, then byte-swap straight
+    // out of the page cache.
+
+    if (!segment_ensure_capacity(program, program->length + count))
+    {
+        return false;
+    }
+
+    uint8_t* view = mmap(NULL, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+
+    if (view == MAP_FAILED)
+    {
+        return false;
+    }
+
+#ifdef MADV_SEQUENTIAL
+    madvise(view, size, MADV_SEQUENTIAL);
+#endif
+
+    instruction_swap(
+        program->buffer + program->length,
+        (const uint32_t*)(view + position),
+        count);
+    munmap(view, size);
+
+    program->length += count;
+
+    return fseek(input, position + count * sizeof(uint32_t), SEEK_SET) == 0;
+}
+#endif
+
 bool machine_read_program(Machine instance, FILE* input)
 {
     uint32_t length;
     uint32_t chunk[UM32_MACHINE_CHUNK_SIZE];
 
+    if (instance->programSource && !machine_unshare(instance))
+    {
+        return false;
+    }
+
+    instance->decoded = false;
+
+#ifdef UM32_MACHINE_MAP
+    int error = errno;
+
+    if (machine_map_program(instance, input))
+    {
+        return true;
+    }
+
+    // Streams that cannot be mapped, such as pipes, are read in chunks.
+
+    errno = error;
+#endif
+
     do
     {
         length = fread(chunk, sizeof * chunk, UM32_MACHINE_CHUNK_SIZE, input);
 
-        for (uint32_t i = 0; i < length; i++)
-        {
-            chunk[i] = __builtin_bswap32(chunk[i]);
-        }
+        instruction_swap(chunk, chunk, length);
 
         if (!segment_add_range(&instance->program, chunk, length))
         {
@@ -70,10 +499,7 @@ bool machine_write_program(FILE* output, Machine instance)
             length = program.length - i;
         }
 
-        for (uint32_t i = 0; i < length; i++)
-        {
-            chunk[i] = __builtin_bswap32(program.buffer[i]);
-        }
+        instruction_swap(chunk, program.buffer + i, length);
 
         if (fwrite(chunk, sizeof * chunk, length, output) != length)
         {
@@ -84,234 +510,372 @@ bool machine_write_program(FILE* output, Machine instance)
     return true;
 }
 
-Fault machine_execute(Machine instance)
+bool machine_checkpoint(FILE* output, Machine instance)
 {
-    if (instance->instructionPointer >= instance->program.length)
+    struct Checkpoint checkpoint;
+    struct MachineCheckpoint state =
     {
-        return FAULT_TERMINATED;
+        .instructionPointer = instance->instructionPointer,
+        .programSource = instance->programSource
+    };
+    Stream stream = &instance->stream;
+    uint32_t length = instance->program.length;
+
+    memcpy(state.registers, instance->registers, sizeof state.registers);
+    machine_flush(instance);
+
+    // A program shared with an array is saved with the heap.
+
+    if (instance->programSource)
+    {
+        length = 0;
     }
 
-    uint32_t a;
-    uint32_t word = instance->program.buffer[instance->instructionPointer];
-    uint32_t opcode = um32_instruction_opcode(word);
+    return checkpoint_writer(&checkpoint, output) &&
+        checkpoint_write(
+            &checkpoint,
+            CHECKPOINT_SECTION_MACHINE,
+            &state,
+            sizeof state) &&
+        checkpoint_write(
+            &checkpoint,
+            CHECKPOINT_SECTION_INPUT,
+            stream->input + stream->inputOffset,
+            stream->inputLength - stream->inputOffset) &&
+        checkpoint_write(
+            &checkpoint,
+            CHECKPOINT_SECTION_PROGRAM,
+            instance->program.buffer,
+            (uint64_t)length * sizeof * instance->program.buffer) &&
+        heap_checkpoint(&checkpoint, &instance->heap);
+}
 
-    if (opcode > OPCODES_COUNT)
+static bool machine_load_checkpoint(Machine instance, Checkpoint checkpoint)
+{
+    uint64_t stateSize;
+    uint64_t inputSize;
+    uint64_t programSize;
+    const struct MachineCheckpoint* state = checkpoint_read(
+        checkpoint,
+        CHECKPOINT_SECTION_MACHINE,
+        &stateSize);
+    const uint8_t* input = state ? checkpoint_read(
+        checkpoint,
+        CHECKPOINT_SECTION_INPUT,
+        &inputSize) : NULL;
+    const uint32_t* program = input ? checkpoint_read(
+        checkpoint,
+        CHECKPOINT_SECTION_PROGRAM,
+        &programSize) : NULL;
+
+    if (!program)
     {
-        return FAULT_INVALID_INSTRUCTION;
+        return false;
     }
 
-    if (opcode == OPCODE_IMMEDIATE)
+    uint64_t length = programSize / sizeof * program;
+
+    if (stateSize != sizeof * state ||
+        inputSize > UM32_STREAM_BUFFER ||
+        programSize % sizeof * program ||
+        length >= UINT32_MAX ||
+        (state->programSource && length))
     {
-        a = um32_instruction_immediate_register(word);
-        instance->registers[a] = um32_instruction_immediate_value(word);
-        instance->instructionPointer++;
+        errno = EINVAL;
 
-        return FAULT_NONE;
+        return false;
     }
 
-    a = um32_instruction_operand_a(word);
+    // The heap is rebuilt on the side, so that a damaged checkpoint leaves
+    // the machine as it was.
 
-    uint32_t b = um32_instruction_operand_b(word);
-    uint32_t c = um32_instruction_operand_c(word);
+    struct Heap restored;
 
-    switch (opcode)
+    if (!heap(&restored))
     {
-    case OPCODE_ADD:
+        return false;
+    }
+
+    restored.segment.huge = instance->heap.segment.huge;
+    restored.chunks.huge = instance->heap.chunks.huge;
+    restored.histogram = instance->heap.histogram;
+
+    if (!heap_restore(&restored, checkpoint))
     {
-        uint32_t sum = instance->registers[b] + instance->registers[c];
+        finalize_heap(&restored);
 
-        instance->registers[a] = sum;
+        return false;
     }
-    break;
 
-    case OPCODE_ALLOCATE:
+    if (state->programSource &&
+        !heap_index(&restored, state->programSource, 0, NULL))
     {
-        uint32_t capacity = instance->registers[c];
-        uint32_t address = heap_allocate(&instance->heap, capacity);
+        finalize_heap(&restored);
 
-        if (!address)
-        {
-            return FAULT_OUT_OF_MEMORY;
-        }
+        errno = EINVAL;
 
-        instance->registers[b] = address;
+        return false;
     }
-    break;
 
-    case OPCODE_CONDITIONAL_MOVE:
-        if (instance->registers[c])
-        {
-            instance->registers[a] = instance->registers[b];
-        }
-        break;
-
-    case OPCODE_DIVIDE:
+    if (instance->programSource)
     {
-        uint32_t denominator = instance->registers[c];
-
-        if (!denominator)
-        {
-            return FAULT_DIVISION_BY_ZERO;
-        }
-
-        instance->registers[a] = instance->registers[b] / denominator;
+        instance->program = instance->programStorage;
+        instance->programSource = 0;
+        instance->programStorage.length = 0;
+        instance->programStorage.capacity = 0;
+        instance->programStorage.buffer = NULL;
+        instance->programStorage.mapped = false;
     }
-    break;
 
-    case OPCODE_FREE:
-        if (!heap_free(&instance->heap, instance->registers[c]))
-        {
-            return FAULT_INVALID_FREE;
-        }
-        break;
+    instance->program.length = 0;
+    instance->decoded = false;
+
+    machine_forget_all(instance);
 
-    case OPCODE_GET:
+    if (!segment_ensure_capacity(&instance->program, length))
     {
-        uint32_t address = instance->registers[b];
-        uint32_t offset = instance->registers[c];
+        finalize_heap(&restored);
 
-        if (!address)
-        {
-            if (offset >= instance->program.length)
-            {
-                return FAULT_INVALID_ADDRESS;
-            }
+        return false;
+    }
 
-            instance->registers[a] = instance->program.buffer[offset];
+    memcpy(instance->program.buffer, program, programSize);
+    memcpy(instance->registers, state->registers, sizeof state->registers);
+    memcpy(instance->stream.input, input, inputSize);
+    finalize_heap(&instance->heap);
 
-            break;
-        }
+    instance->program.length = length;
+    instance->instructionPointer = state->instructionPointer;
+    instance->heap = restored;
+    instance->stream.inputOffset = 0;
+    instance->stream.inputLength = inputSize;
 
-        uint32_t* index = heap_index(&instance->heap, address, offset, NULL);
+    if (state->programSource)
+    {
+        machine_share(instance, state->programSource);
+    }
 
-        if (!index)
-        {
-            return FAULT_INVALID_ADDRESS;
-        }
+    return true;
+}
 
-        instance->registers[a] = *index;
-    }
-    break;
+bool machine_restore(Machine instance, FILE* input)
+{
+    struct Checkpoint checkpoint;
 
-    case OPCODE_HALT: return FAULT_HALTED;
+    machine_flush(instance);
 
-    case OPCODE_LOAD:
+    if (!checkpoint_reader(&checkpoint, input))
     {
-        uint32_t address = instance->registers[b];
-        uint32_t offset = instance->registers[c];
+        return false;
+    }
 
-        if (!address)
-        {
-            if (offset >= instance->program.length)
-            {
-                return FAULT_INVALID_INSTRUCTION_POINTER;
-            }
+    bool result = machine_load_checkpoint(instance, &checkpoint);
 
-            instance->instructionPointer = offset;
+    finalize_checkpoint(&checkpoint);
 
-            return FAULT_NONE;
-        }
+    return result;
+}
 
-        uint32_t length;
-        uint32_t* index = heap_index(&instance->heap, address, 0, &length);
+Fault machine_execute(Machine instance)
+{
+    return machine_run(instance, 1, NULL);
+}
 
-        if (!index)
-        {
-            return FAULT_INVALID_ADDRESS;
-        }
-    
-        if (offset >= length)
+static Fault machine_interpret(
+    Machine instance,
+    uint64_t budget,
+    uint64_t* executed)
+{
+#ifdef UM32_MACHINE_THREADED
+    if (instance->engine != ENGINE_SWITCH)
+    {
+        if (instance->trusted)
         {
-            return FAULT_INVALID_INSTRUCTION_POINTER;
+            return machine_run_threaded_trusted(instance, budget, executed);
         }
-    
-        segment_ensure_capacity(&instance->program, length);
-        memcpy(instance->program.buffer, index, length * sizeof * index);
 
-        instance->program.length = length;
-        instance->instructionPointer = offset;
+        return machine_run_threaded(instance, budget, executed);
     }
-    return FAULT_NONE;
+#endif
 
-    case OPCODE_MULTIPLY:
+    if (instance->trusted)
     {
-        uint32_t product = instance->registers[b] * instance->registers[c];
-
-        instance->registers[a] = product;
+        return machine_run_switch_trusted(instance, budget, executed);
     }
-    break;
 
-    case OPCODE_NAND:
-    {
-        uint32_t nand = ~(instance->registers[b] & instance->registers[c]);
+    return machine_run_switch(instance, budget, executed);
+}
 
-        instance->registers[a] = nand;
-    }
-    break;
+static Fault machine_profile(
+    Machine instance,
+    uint64_t budget,
+    uint64_t* executed)
+{
+    // Profiled runs always interpret, and always check array accesses.
 
-    case OPCODE_READ:
+#ifdef UM32_MACHINE_THREADED
+    if (instance->engine != ENGINE_SWITCH)
     {
-        if (!instance->reader)
-        {
-            return FAULT_MISSING_READER;
-        }
-
-        instance->registers[c] = instance->reader();
+        return machine_run_threaded_profiled(instance, budget, executed);
     }
-    break;
+#endif
+
+    return machine_run_switch_profiled(instance, budget, executed);
+}
 
-    case OPCODE_SET:
+#ifdef UM32_JIT_AVAILABLE
+static Fault machine_run_jit(
+    Machine instance,
+    uint64_t budget,
+    uint64_t* executed)
+{
+    Jit jit = &instance->jit;
+    Fault fault = FAULT_NONE;
+    uint64_t count = 0;
+
+    while (count < budget)
     {
-        uint32_t address = instance->registers[a];
-        uint32_t offset = instance->registers[b];
+        void* entry = jit_entry(
+            jit,
+            instance->operations,
+            instance->program.length,
+            instance->instructionPointer);
 
-        if (!address)
+        if (entry)
         {
-            if (offset >= instance->program.length)
+            memcpy(jit->registers, instance->registers, sizeof jit->registers);
+
+            jit->remaining = budget - count;
+
+            jit_execute(jit, entry);
+            memcpy(instance->registers, jit->registers, sizeof jit->registers);
+
+            uint64_t translated = budget - count - jit->remaining;
+
+            instance->instructionPointer = jit->instructionPointer;
+            count += translated;
+
+            if (translated)
             {
-                return FAULT_INVALID_ADDRESS;
+                continue;
             }
+        }
+
+        // Interpret one operation, discarding every translation if it writes
+        // to array 0.
 
-            instance->program.buffer[offset] = instance->registers[c];
+        struct Operation current =
+            instance->operations[instance->instructionPointer];
+        bool modified = current.opcode == OPCODE_SET &&
+            !instance->registers[current.a];
+        uint64_t interpreted;
 
+        fault = machine_interpret(instance, 1, &interpreted);
+        count += interpreted;
+
+        if (fault)
+        {
             break;
         }
 
-        uint32_t* index = heap_index(&instance->heap, address, offset, NULL);
-
-        if (!index)
+        if (modified)
         {
-            return FAULT_INVALID_ADDRESS;
+            jit_invalidate(jit);
         }
+    }
 
-        *index = instance->registers[c];
+    if (executed)
+    {
+        *executed = count;
     }
-    break;
 
-    case OPCODE_WRITE:
+    return fault;
+}
+#endif
+
+static Fault machine_dispatch(
+    Machine instance,
+    uint64_t budget,
+    uint64_t* executed)
+{
+    if (!instance->decoded)
     {
-        if (instance->registers[c] > UINT8_MAX)
+        if (!machine_decode(instance))
         {
-            return FAULT_INVALID_BYTE;
+            return FAULT_OUT_OF_MEMORY;
         }
 
-        if (!instance->writer)
-        {
-            return FAULT_MISSING_WRITER;
-        }
+        jit_invalidate(&instance->jit);
+    }
 
-        instance->writer(instance->registers[c]);
+    if (instance->profile)
+    {
+        return machine_profile(instance, budget, executed);
     }
-    break;
+
+#ifdef UM32_JIT_AVAILABLE
+    if (instance->engine == ENGINE_JIT)
+    {
+        return machine_run_jit(instance, budget, executed);
     }
+#endif
+
+    return machine_interpret(instance, budget, executed);
+}
+
+Fault machine_run(Machine instance, uint64_t budget, uint64_t* executed)
+{
+    Fault result = machine_dispatch(instance, budget, executed);
 
-    instance->instructionPointer++;
+    // A byte writer given to machine() expects each byte by the time the
+    // step that wrote it returns, as it did before output was buffered.
 
-    return FAULT_NONE;
+    if (instance->writer)
+    {
+        stream_flush(&instance->stream);
+    }
+
+    return result;
+}
+
+void machine_flush(Machine instance)
+{
+    stream_flush(&instance->stream);
 }
 
 void finalize_machine(Machine instance)
 {
-    finalize_segment(&instance->program);
+    stream_flush(&instance->stream);
+
+    if (!instance->programSource)
+    {
+        finalize_segment(&instance->program);
+    }
+
+    finalize_segment(&instance->programStorage);
+
+    instance->programSource = 0;
     finalize_heap(&instance->heap);
+    finalize_jit(&instance->jit);
+
+    if (instance->operations)
+    {
+        free(instance->operations);
+
+        instance->operations = NULL;
+        instance->operationsCapacity = 0;
+    }
+
+    for (uint32_t i = 0; i < UM32_MACHINE_DECODINGS; i++)
+    {
+        MachineDecoding decoding = instance->decodings + i;
+
+        free(decoding->operations);
+        finalize_jit_table(&decoding->table);
+
+        decoding->operations = NULL;
+        decoding->operationsCapacity = 0;
+    }
+
+    machine_forget_all(instance);
 }
@@ -7,28 +7,77 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "checkpoint.h"
+#include "engine.h"
 #include "fault.h"
 #include "heap.h"
+#include "jit.h"
+#include "operation.h"
+#include "profile.h"
 #include "reader.h"
+#include "stream.h"
 #include "writer.h"
 #define UM32_MACHINE_REGISTERS 8 
 #define UM32_MACHINE_HEAP_SEGMENTS 4
+#define UM32_MACHINE_DECODINGS 4
+#define um32_machine_cached(address) (1ull << ((address) & 63))
+
+// The decoded operations and translations of an array that was loaded as the
+// program before, kept while the array is unchanged.
+
+struct MachineDecoding
+{
+    uint32_t source;
+    bool fused;
+    uint64_t used;
+    Operation operations;
+    uint32_t operationsCapacity;
+    struct JitTable table;
+};
+
+typedef struct MachineDecoding* MachineDecoding;
 
 struct Machine
 {
     uint32_t instructionPointer;
     uint32_t registers[UM32_MACHINE_REGISTERS];
     struct Segment program;
+    struct Segment programStorage;
+    uint32_t programSource;
+    uint32_t generation;
+    Operation operations;
+    uint32_t operationsCapacity;
+    bool decoded;
+    struct MachineDecoding decodings[UM32_MACHINE_DECODINGS];
+    uint64_t cached;
+    uint64_t loads;
     struct Heap heap;
     Reader reader;
     Writer writer;
+    struct Stream stream;
+    Engine engine;
+    bool trusted;
+    bool fused;
+    Profile profile;
+    struct Jit jit;
 };
 
 typedef struct Machine* Machine;
 
 bool machine(Machine instance, Reader reader, Writer writer);
+
+bool machine_stream(
+    Machine instance,
+    BlockReader reader,
+    BlockWriter writer,
+    void* context);
+
 bool machine_read_program(Machine instance, FILE* input);
 bool machine_write_program(FILE* output, Machine instance);
+bool machine_checkpoint(FILE* output, Machine instance);
+bool machine_restore(Machine instance, FILE* input);
 Fault machine_execute(Machine instance);
+Fault machine_run(Machine instance, uint64_t budget, uint64_t* executed);
+void machine_flush(Machine instance);
 void machine_dump(FILE* output, Machine instance);
 void finalize_machine(Machine instance);
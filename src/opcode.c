@@ -6,6 +6,9 @@
 
 #include <string.h>
 #include "opcode.h"
+#define UM32_OPCODE_HASH_SIZE 32
+#define um32_opcode_hash(first, second, length) \
+    (((first) * 5 + (second) * 7 + (length)) & (UM32_OPCODE_HASH_SIZE - 1))
 
 static const char* OPCODES_STRINGS[OPCODES_COUNT] =
 {
@@ -25,6 +28,28 @@ static const char* OPCODES_STRINGS[OPCODES_COUNT] =
     [OPCODE_WRITE] = "outb"
 };
 
+// No two mnemonics share a combination of first two characters and length, so
+// this hash gives each its own slot. Empty slots hold 0, which only matches the
+// mnemonic it names.
+
+static const Opcode OPCODES_HASH[UM32_OPCODE_HASH_SIZE] =
+{
+    [0] = OPCODE_FREE,
+    [2] = OPCODE_WRITE,
+    [4] = OPCODE_ADD,
+    [6] = OPCODE_SET,
+    [9] = OPCODE_LOAD,
+    [10] = OPCODE_GET,
+    [14] = OPCODE_CONDITIONAL_MOVE,
+    [17] = OPCODE_NAND,
+    [18] = OPCODE_READ,
+    [19] = OPCODE_HALT,
+    [22] = OPCODE_DIVIDE,
+    [23] = OPCODE_MULTIPLY,
+    [29] = OPCODE_IMMEDIATE,
+    [30] = OPCODE_ALLOCATE
+};
+
 const char* opcode_to_string(Opcode value)
 {
     if (value < 0 || value >= OPCODES_COUNT)
@@ -35,15 +60,26 @@ const char* opcode_to_string(Opcode value)
     return OPCODES_STRINGS[value];
 }
 
-Opcode opcode_from_string(const char* value)
+Opcode opcode_from_token(const char* value, size_t length)
 {
-    for (Opcode opcode = 0; opcode < OPCODES_COUNT; opcode++)
+    if (length < 2)
     {
-        if (strcmp(value, OPCODES_STRINGS[opcode]) == 0)
-        {
-            return opcode;
-        }
+        return OPCODES_COUNT;
     }
 
-    return OPCODES_COUNT;
+    const unsigned char* token = (const unsigned char*)value;
+    Opcode result = OPCODES_HASH[um32_opcode_hash(token[0], token[1], length)];
+    const char* mnemonic = OPCODES_STRINGS[result];
+
+    if (strncmp(mnemonic, value, length) != 0 || mnemonic[length])
+    {
+        return OPCODES_COUNT;
+    }
+
+    return result;
+}
+
+Opcode opcode_from_string(const char* value)
+{
+    return opcode_from_token(value, strlen(value));
 }
@@ -6,6 +6,7 @@
 
 #ifndef UM32_OPCODE
 #define UM32_OPCODE
+#include <stddef.h>
 
 enum Opcode
 {
@@ -30,5 +31,6 @@ typedef enum Opcode Opcode;
 
 const char* opcode_to_string(Opcode value);
 Opcode opcode_from_string(const char* value);
+Opcode opcode_from_token(const char* value, size_t length);
 
 #endif
@@ -0,0 +1,44 @@
+// operation.c
+// Copyright (c) 2024 Ishan Pranav
+// Licensed under the MIT license.
+
+// http://boundvariable.org
+
+#include "instruction.h"
+#include "operation.h"
+
+void operation(Operation instance, uint32_t word)
+{
+    uint32_t opcode = um32_instruction_opcode(word);
+
+    if (opcode >= OPCODES_COUNT)
+    {
+        opcode = UM32_OPERATION_INVALID;
+    }
+
+    instance->opcode = opcode;
+
+    if (opcode == OPCODE_IMMEDIATE)
+    {
+        instance->a = um32_instruction_immediate_register(word);
+        instance->b = 0;
+        instance->c = 0;
+        instance->immediate = um32_instruction_immediate_value(word);
+
+        return;
+    }
+
+    instance->a = um32_instruction_operand_a(word);
+    instance->b = um32_instruction_operand_b(word);
+    instance->c = um32_instruction_operand_c(word);
+    instance->immediate = 0;
+}
+
+void operation_terminate(Operation instance)
+{
+    instance->opcode = UM32_OPERATION_TERMINATE;
+    instance->a = 0;
+    instance->b = 0;
+    instance->c = 0;
+    instance->immediate = 0;
+}
@@ -0,0 +1,39 @@
+// operation.h
+// Copyright (c) 2024 Ishan Pranav
+// Licensed under the MIT license.
+
+// http://boundvariable.org
+
+#ifndef UM32_OPERATION
+#define UM32_OPERATION
+#include <stdint.h>
+#include "opcode.h"
+#include "superinstruction.h"
+#define UM32_OPERATION_INVALID OPCODES_COUNT
+#define UM32_OPERATION_TERMINATE (OPCODES_COUNT + 1)
+#define UM32_OPERATION_FUSED (OPCODES_COUNT + 2)
+#define UM32_OPERATION_NOT (UM32_OPERATION_FUSED + SUPERINSTRUCTION_NOT)
+#define UM32_OPERATION_NEGATE (UM32_OPERATION_FUSED + SUPERINSTRUCTION_NEGATE)
+#define UM32_OPERATION_SUBTRACT \
+    (UM32_OPERATION_FUSED + SUPERINSTRUCTION_SUBTRACT)
+#define UM32_OPERATION_JUMP (UM32_OPERATION_FUSED + SUPERINSTRUCTION_JUMP)
+#define UM32_OPERATION_IMMEDIATE_JUMP \
+    (UM32_OPERATION_FUSED + SUPERINSTRUCTION_IMMEDIATE_JUMP)
+#define UM32_OPERATION_BRANCH (UM32_OPERATION_FUSED + SUPERINSTRUCTION_BRANCH)
+#define UM32_OPERATIONS_COUNT (UM32_OPERATION_FUSED + SUPERINSTRUCTIONS_COUNT)
+
+struct Operation
+{
+    uint8_t opcode;
+    uint8_t a;
+    uint8_t b;
+    uint8_t c;
+    uint32_t immediate;
+};
+
+typedef struct Operation* Operation;
+
+void operation(Operation instance, uint32_t word);
+void operation_terminate(Operation instance);
+
+#endif
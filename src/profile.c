@@ -0,0 +1,238 @@
+// profile.c
+// Copyright (c) 2024 Ishan Pranav
+// Licensed under the MIT license.
+
+// http://boundvariable.org
+
+// A profile is filled in by the profiled builds of the interpreter, which
+// count every dispatch by operation and by offset into the program. The
+// counters are indexed without bounds checks, so the interpreter reserves
+// room for the whole program whenever one is loaded.
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "instruction.h"
+#include "profile.h"
+
+static const char* PROFILE_PHASES_STRINGS[PROFILE_PHASES_COUNT] =
+{
+    [PROFILE_PHASE_LOAD] = "load",
+    [PROFILE_PHASE_EXECUTE] = "execute",
+    [PROFILE_PHASE_TEARDOWN] = "teardown"
+};
+
+void profile(Profile instance)
+{
+    memset(instance, 0, sizeof * instance);
+}
+
+bool profile_reserve(Profile instance, uint64_t length)
+{
+    if (length <= instance->length)
+    {
+        return true;
+    }
+
+    if (length > SIZE_MAX / sizeof * instance->counts)
+    {
+        return false;
+    }
+
+    uint64_t* counts = realloc(instance->counts, length * sizeof * counts);
+
+    if (!counts)
+    {
+        return false;
+    }
+
+    memset(
+        counts + instance->length,
+        0,
+        (length - instance->length) * sizeof * counts);
+
+    instance->counts = counts;
+    instance->length = length;
+
+    return true;
+}
+
+static double profile_wall()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static double profile_cpu()
+{
+    return (double)clock() / CLOCKS_PER_SEC;
+}
+
+void profile_begin(Profile instance, ProfilePhase phase)
+{
+    instance->timers[phase].wallStart = profile_wall();
+    instance->timers[phase].cpuStart = profile_cpu();
+}
+
+void profile_end(Profile instance, ProfilePhase phase)
+{
+    struct ProfileTimer* timer = instance->timers + phase;
+
+    timer->wall += profile_wall() - timer->wallStart;
+    timer->cpu += profile_cpu() - timer->cpuStart;
+}
+
+static void profile_write_operations(
+    FILE* output,
+    Profile instance,
+    double executed)
+{
+    bool written[OPCODES_COUNT] = { 0 };
+
+    fprintf(output, "\n%-16s %16s %8s\n", "Opcode", "Executed", "Share");
+
+    // Selection by repeated scans is fine for fourteen opcodes.
+
+    for (;;)
+    {
+        Opcode best = OPCODES_COUNT;
+
+        for (Opcode opcode = 0; opcode < OPCODES_COUNT; opcode++)
+        {
+            if (!written[opcode] && instance->operations[opcode] &&
+                (best == OPCODES_COUNT ||
+                    instance->operations[opcode] > instance->operations[best]))
+            {
+                best = opcode;
+            }
+        }
+
+        if (best == OPCODES_COUNT)
+        {
+            break;
+        }
+
+        written[best] = true;
+
+        fprintf(output,
+            "%-16s %16" PRIu64 " %7.2lf%%\n",
+            opcode_to_string(best),
+            instance->operations[best],
+            instance->operations[best] * 100.0 / executed);
+    }
+}
+
+void profile_rank(Profile instance, Segment program)
+{
+    uint32_t* hottest = instance->hottest;
+    uint32_t count = 0;
+
+    // Keep the hottest offsets in descending order with an insertion sort,
+    // which only runs for offsets hotter than the coldest one kept so far.
+
+    for (uint64_t offset = 0; offset < instance->length; offset++)
+    {
+        uint64_t hits = instance->counts[offset];
+
+        if (!hits ||
+            (count == UM32_PROFILE_HOTTEST &&
+                hits <= instance->counts[hottest[count - 1]]))
+        {
+            continue;
+        }
+
+        uint32_t i = count < UM32_PROFILE_HOTTEST ? count++ : count - 1;
+
+        while (i && instance->counts[hottest[i - 1]] < hits)
+        {
+            hottest[i] = hottest[i - 1];
+            i--;
+        }
+
+        hottest[i] = offset;
+    }
+
+    // The words are kept so that the report can be written after the
+    // program is gone.
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        instance->hottestWords[i] = hottest[i] < program->length ?
+            program->buffer[hottest[i]] :
+            UINT32_MAX;
+    }
+
+    instance->hottestCount = count;
+}
+
+static void profile_write_offsets(
+    FILE* output,
+    Profile instance,
+    double executed)
+{
+    fprintf(output,
+        "\n%-8s %16s %8s  %s\n", "Offset", "Executed", "Share", "Instruction");
+
+    for (uint32_t i = 0; i < instance->hottestCount; i++)
+    {
+        uint32_t offset = instance->hottest[i];
+        uint64_t hits = instance->counts[offset];
+
+        fprintf(output,
+            "%08" PRIx32 " %16" PRIu64 " %7.2lf%%  ",
+            offset,
+            hits,
+            hits * 100.0 / executed);
+        instruction_write_assembly(output, instance->hottestWords[i]);
+    }
+}
+
+void profile_write(FILE* output, Profile instance)
+{
+    uint64_t total = 0;
+
+    for (Opcode opcode = 0; opcode < OPCODES_COUNT; opcode++)
+    {
+        total += instance->operations[opcode];
+    }
+
+    double executed = total ? total : 1;
+
+    fprintf(output, "%-16s %16s %16s\n", "Phase", "Wall (s)", "CPU (s)");
+
+    for (ProfilePhase phase = 0; phase < PROFILE_PHASES_COUNT; phase++)
+    {
+        fprintf(output,
+            "%-16s %16.6lf %16.6lf\n",
+            PROFILE_PHASES_STRINGS[phase],
+            instance->timers[phase].wall,
+            instance->timers[phase].cpu);
+    }
+
+    fprintf(output,
+        "\n%-16s %16" PRIu64 "\n"
+        "%-16s %16" PRIu64 "\n"
+        "%-16s %16" PRIu64 "\n"
+        "%-16s %16" PRIu64 "\n"
+        "%-16s %16" PRIu64 "\n",
+        "Executed", total,
+        "Program loads", instance->loads,
+        "Words loaded", instance->loadedWords,
+        "Allocations", instance->allocations,
+        "Words zeroed", instance->zeroedWords);
+
+    profile_write_operations(output, instance, executed);
+    profile_write_offsets(output, instance, executed);
+}
+
+void finalize_profile(Profile instance)
+{
+    free(instance->counts);
+
+    instance->counts = NULL;
+    instance->length = 0;
+}
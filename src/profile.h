@@ -0,0 +1,58 @@
+// profile.h
+// Copyright (c) 2024 Ishan Pranav
+// Licensed under the MIT license.
+
+// http://boundvariable.org
+
+#ifndef UM32_PROFILE
+#define UM32_PROFILE
+#include <stdbool.h>
+#include <stdio.h>
+#include "operation.h"
+#include "segment.h"
+#define UM32_PROFILE_HOTTEST 20
+
+enum ProfilePhase
+{
+    PROFILE_PHASE_LOAD = 0,
+    PROFILE_PHASE_EXECUTE = 1,
+    PROFILE_PHASE_TEARDOWN = 2,
+    PROFILE_PHASES_COUNT
+};
+
+typedef enum ProfilePhase ProfilePhase;
+
+struct ProfileTimer
+{
+    double wall;
+    double cpu;
+    double wallStart;
+    double cpuStart;
+};
+
+struct Profile
+{
+    uint64_t operations[UM32_OPERATIONS_COUNT];
+    uint64_t* counts;
+    uint64_t length;
+    uint64_t loads;
+    uint64_t loadedWords;
+    uint64_t allocations;
+    uint64_t zeroedWords;
+    struct ProfileTimer timers[PROFILE_PHASES_COUNT];
+    uint32_t hottest[UM32_PROFILE_HOTTEST];
+    uint32_t hottestWords[UM32_PROFILE_HOTTEST];
+    uint32_t hottestCount;
+};
+
+typedef struct Profile* Profile;
+
+void profile(Profile instance);
+bool profile_reserve(Profile instance, uint64_t length);
+void profile_begin(Profile instance, ProfilePhase phase);
+void profile_end(Profile instance, ProfilePhase phase);
+void profile_rank(Profile instance, Segment program);
+void profile_write(FILE* output, Profile instance);
+void finalize_profile(Profile instance);
+
+#endif
@@ -4,6 +4,21 @@
 
 // http://boundvariable.org
 
+#ifndef UM32_READER
+#define UM32_READER
 #include <stdint.h>
+#define UM32_READER_SUSPEND UINT32_MAX
 
 typedef uint8_t (*Reader)();
+
+// Reads at most length bytes into buffer, blocking until at least one is
+// available. Returns the number of bytes read, or 0 at the end of the input.
+// Returning UM32_READER_SUSPEND instead stops the machine before the read, so
+// that it can be resumed once more input is available.
+
+typedef uint32_t (*BlockReader)(
+    void* context,
+    uint8_t buffer[],
+    uint32_t length);
+
+#endif
@@ -0,0 +1,317 @@
+// sampler.c
+// Copyright (c) 2024 Ishan Pranav
+// Licensed under the MIT license.
+
+// http://boundvariable.org
+
+// A sampler collects the position of a running machine at intervals. Samples
+// pass through a fixed ring with one producer and one consumer, which only
+// exchange the head and tail indices, so recording a sample never blocks or
+// allocates. Draining the ring folds the samples into an open-addressed table
+// keyed by program generation and offset.
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include "instruction.h"
+#include "sampler.h"
+#define UM32_SAMPLER_ENTRIES 1024
+
+bool sampler(Sampler instance)
+{
+    instance->ring = malloc(UM32_SAMPLER_RING * sizeof * instance->ring);
+
+    if (!instance->ring)
+    {
+        return false;
+    }
+
+    instance->entries = calloc(
+        UM32_SAMPLER_ENTRIES,
+        sizeof * instance->entries);
+
+    if (!instance->entries)
+    {
+        free(instance->ring);
+
+        instance->ring = NULL;
+
+        return false;
+    }
+
+    atomic_init(&instance->head, 0);
+    atomic_init(&instance->tail, 0);
+
+    instance->capacity = UM32_SAMPLER_ENTRIES;
+    instance->count = 0;
+    instance->samples = 0;
+    instance->dropped = 0;
+
+    memset(instance->opcodes, 0, sizeof instance->opcodes);
+
+    return true;
+}
+
+bool sampler_push(Sampler instance, struct Sample value)
+{
+    uint32_t head = atomic_load_explicit(
+        &instance->head,
+        memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(
+        &instance->tail,
+        memory_order_acquire);
+
+    if (head - tail == UM32_SAMPLER_RING)
+    {
+        instance->dropped++;
+
+        return false;
+    }
+
+    instance->ring[head % UM32_SAMPLER_RING] = value;
+
+    atomic_store_explicit(&instance->head, head + 1, memory_order_release);
+
+    return true;
+}
+
+uint32_t sampler_backlog(Sampler instance)
+{
+    return atomic_load_explicit(&instance->head, memory_order_acquire) -
+        atomic_load_explicit(&instance->tail, memory_order_acquire);
+}
+
+static SamplerEntry sampler_find(
+    SamplerEntry entries,
+    uint32_t capacity,
+    uint32_t instructionPointer,
+    uint32_t generation)
+{
+    uint64_t key = ((uint64_t)generation << 32) | instructionPointer;
+    uint32_t i = (key * 0x9e3779b97f4a7c15) >> 32;
+
+    for (;; i++)
+    {
+        SamplerEntry entry = entries + (i & (capacity - 1));
+
+        if (!entry->count ||
+            (entry->instructionPointer == instructionPointer &&
+                entry->generation == generation))
+        {
+            return entry;
+        }
+    }
+}
+
+static bool sampler_grow(Sampler instance)
+{
+    uint32_t capacity = instance->capacity * 2;
+    SamplerEntry entries = calloc(capacity, sizeof * entries);
+
+    if (!entries)
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < instance->capacity; i++)
+    {
+        SamplerEntry entry = instance->entries + i;
+
+        if (entry->count)
+        {
+            *sampler_find(
+                entries,
+                capacity,
+                entry->instructionPointer,
+                entry->generation) = *entry;
+        }
+    }
+
+    free(instance->entries);
+
+    instance->entries = entries;
+    instance->capacity = capacity;
+
+    return true;
+}
+
+bool sampler_drain(Sampler instance)
+{
+    uint32_t tail = atomic_load_explicit(
+        &instance->tail,
+        memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(
+        &instance->head,
+        memory_order_acquire);
+
+    for (; tail != head; tail++)
+    {
+        struct Sample* sample = instance->ring + tail % UM32_SAMPLER_RING;
+
+        // The table is kept at most half full.
+
+        if (instance->count * 2 >= instance->capacity &&
+            !sampler_grow(instance))
+        {
+            atomic_store_explicit(&instance->tail, tail, memory_order_release);
+
+            return false;
+        }
+
+        SamplerEntry entry = sampler_find(
+            instance->entries,
+            instance->capacity,
+            sample->instructionPointer,
+            sample->generation);
+
+        if (!entry->count)
+        {
+            entry->instructionPointer = sample->instructionPointer;
+            entry->generation = sample->generation;
+            entry->word = sample->word;
+            instance->count++;
+        }
+
+        Opcode opcode = um32_instruction_opcode(sample->word);
+
+        if (opcode < OPCODES_COUNT)
+        {
+            instance->opcodes[opcode]++;
+        }
+
+        entry->count++;
+        instance->samples++;
+    }
+
+    atomic_store_explicit(&instance->tail, tail, memory_order_release);
+
+    return true;
+}
+
+static void sampler_write_opcodes(FILE* output, Sampler instance, double total)
+{
+    bool written[OPCODES_COUNT] = { 0 };
+
+    fprintf(output, "\n%-16s %16s %8s\n", "Opcode", "Samples", "Share");
+
+    for (;;)
+    {
+        Opcode best = OPCODES_COUNT;
+
+        for (Opcode opcode = 0; opcode < OPCODES_COUNT; opcode++)
+        {
+            if (!written[opcode] && instance->opcodes[opcode] &&
+                (best == OPCODES_COUNT ||
+                    instance->opcodes[opcode] > instance->opcodes[best]))
+            {
+                best = opcode;
+            }
+        }
+
+        if (best == OPCODES_COUNT)
+        {
+            break;
+        }
+
+        written[best] = true;
+
+        fprintf(output,
+            "%-16s %16" PRIu64 " %7.2lf%%\n",
+            opcode_to_string(best),
+            instance->opcodes[best],
+            instance->opcodes[best] * 100.0 / total);
+    }
+}
+
+void sampler_write(FILE* output, Sampler instance)
+{
+    SamplerEntry hottest[UM32_SAMPLER_HOTTEST];
+    uint32_t count = 0;
+    double total = instance->samples ? instance->samples : 1;
+
+    fprintf(output,
+        "%-16s %16" PRIu64 "\n"
+        "%-16s %16" PRIu64 "\n",
+        "Samples", instance->samples,
+        "Dropped", instance->dropped);
+
+    sampler_write_opcodes(output, instance, total);
+
+    // Keep the hottest entries in descending order with an insertion sort.
+
+    for (uint32_t i = 0; i < instance->capacity; i++)
+    {
+        SamplerEntry entry = instance->entries + i;
+
+        if (!entry->count ||
+            (count == UM32_SAMPLER_HOTTEST &&
+                entry->count <= hottest[count - 1]->count))
+        {
+            continue;
+        }
+
+        uint32_t j = count < UM32_SAMPLER_HOTTEST ? count++ : count - 1;
+
+        while (j && hottest[j - 1]->count < entry->count)
+        {
+            hottest[j] = hottest[j - 1];
+            j--;
+        }
+
+        hottest[j] = entry;
+    }
+
+    fprintf(output,
+        "\n%-10s %-8s %16s %8s  %s\n",
+        "Generation", "Offset", "Samples", "Share", "Instruction");
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        fprintf(output,
+            "%10" PRIu32 " %08" PRIx32 " %16" PRIu64 " %7.2lf%%  ",
+            hottest[i]->generation,
+            hottest[i]->instructionPointer,
+            hottest[i]->count,
+            hottest[i]->count * 100.0 / total);
+        instruction_write_assembly(output, hottest[i]->word);
+    }
+}
+
+bool sampler_write_folded(FILE* output, Sampler instance)
+{
+    // Each line is a stack of program generation, opcode and offset, followed
+    // by its number of samples, as consumed by flame graph tools.
+
+    for (uint32_t i = 0; i < instance->capacity; i++)
+    {
+        SamplerEntry entry = instance->entries + i;
+
+        if (!entry->count)
+        {
+            continue;
+        }
+
+        if (fprintf(output,
+            "program %" PRIu32 ";%s;%08" PRIx32 " %" PRIu64 "\n",
+            entry->generation,
+            opcode_to_string(um32_instruction_opcode(entry->word)),
+            entry->instructionPointer,
+            entry->count) < 0)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void finalize_sampler(Sampler instance)
+{
+    free(instance->ring);
+    free(instance->entries);
+
+    instance->ring = NULL;
+    instance->entries = NULL;
+    instance->capacity = 0;
+    instance->count = 0;
+}
@@ -0,0 +1,57 @@
+// sampler.h
+// Copyright (c) 2024 Ishan Pranav
+// Licensed under the MIT license.
+
+// http://boundvariable.org
+
+#ifndef UM32_SAMPLER
+#define UM32_SAMPLER
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "opcode.h"
+#define UM32_SAMPLER_RING 4096
+#define UM32_SAMPLER_HOTTEST 20
+
+struct Sample
+{
+    uint32_t instructionPointer;
+    uint32_t generation;
+    uint32_t word;
+};
+
+struct SamplerEntry
+{
+    uint64_t count;
+    uint32_t instructionPointer;
+    uint32_t generation;
+    uint32_t word;
+};
+
+typedef struct SamplerEntry* SamplerEntry;
+
+struct Sampler
+{
+    struct Sample* ring;
+    _Atomic uint32_t head;
+    _Atomic uint32_t tail;
+    SamplerEntry entries;
+    uint32_t capacity;
+    uint32_t count;
+    uint64_t samples;
+    uint64_t dropped;
+    uint64_t opcodes[OPCODES_COUNT];
+};
+
+typedef struct Sampler* Sampler;
+
+bool sampler(Sampler instance);
+bool sampler_push(Sampler instance, struct Sample value);
+uint32_t sampler_backlog(Sampler instance);
+bool sampler_drain(Sampler instance);
+void sampler_write(FILE* output, Sampler instance);
+bool sampler_write_folded(FILE* output, Sampler instance);
+void finalize_sampler(Sampler instance);
+
+#endif
@@ -4,11 +4,23 @@
 
 // http://boundvariable.org
 
+// Once a segment reaches UM_SEGMENT_MAPPED words, it moves into an anonymous
+// mapping. Growing or trimming a mapped segment remaps its pages rather than
+// copying them, and words beyond the old capacity come from the kernel's zero
+// pages. Setting the huge field asks for transparent huge pages on mapping.
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <sys/mman.h>
+#define UM32_SEGMENT_MAP
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "segment.h"
 #define UM_SEGMENT_DEFAULT 4
+#define UM_SEGMENT_MAPPED 0x40000
 
 bool segment(Segment instance, uint32_t capacity)
 {
@@ -21,37 +33,104 @@ bool segment(Segment instance, uint32_t capacity)
     
     instance->capacity = UM_SEGMENT_DEFAULT;
     instance->buffer = malloc(UM_SEGMENT_DEFAULT * sizeof * instance->buffer);
+    instance->mapped = false;
+    instance->huge = false;
 
     return instance->buffer;
 }
 
-bool segment_ensure_capacity(Segment instance, uint32_t capacity)
+static bool segment_resize(Segment instance, uint32_t capacity)
 {
-    if (instance->capacity >= capacity)
-    {
-        return true;
-    }
+    uint32_t* buffer;
 
-    uint32_t newCapacity = instance->capacity * 2;
-
-    if (capacity > newCapacity)
+#ifdef UM32_SEGMENT_MAP
+    if (instance->mapped || capacity >= UM_SEGMENT_MAPPED)
     {
-        newCapacity = capacity;
+        size_t size = (size_t)capacity * sizeof * buffer;
+
+        if (instance->mapped)
+        {
+            buffer = mremap(
+                instance->buffer,
+                (size_t)instance->capacity * sizeof * buffer,
+                size,
+                MREMAP_MAYMOVE);
+        }
+        else
+        {
+            buffer = mmap(
+                NULL,
+                size,
+                PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS,
+                -1,
+                0);
+
+            if (buffer != MAP_FAILED && instance->buffer)
+            {
+                memcpy(
+                    buffer,
+                    instance->buffer,
+                    instance->capacity * sizeof * buffer);
+                free(instance->buffer);
+            }
+        }
+
+        if (buffer == MAP_FAILED)
+        {
+            return false;
+        }
+
+#ifdef MADV_HUGEPAGE
+        if (instance->huge)
+        {
+            madvise(buffer, size, MADV_HUGEPAGE);
+        }
+#endif
+
+        instance->capacity = capacity;
+        instance->buffer = buffer;
+        instance->mapped = true;
+
+        return true;
     }
+#endif
 
-    uint32_t* buffer = realloc(instance->buffer, newCapacity * sizeof * buffer);
+    buffer = realloc(instance->buffer, capacity * sizeof * buffer);
 
     if (!buffer)
     {
         return false;
     }
 
-    instance->capacity = newCapacity;
+    instance->capacity = capacity;
     instance->buffer = buffer;
 
     return true;
 }
 
+bool segment_ensure_capacity(Segment instance, uint32_t capacity)
+{
+    if (instance->capacity >= capacity)
+    {
+        return true;
+    }
+
+    uint64_t newCapacity = (uint64_t)instance->capacity * 2;
+
+    if (newCapacity > UINT32_MAX)
+    {
+        newCapacity = UINT32_MAX;
+    }
+
+    if (capacity > newCapacity)
+    {
+        newCapacity = capacity;
+    }
+
+    return segment_resize(instance, newCapacity);
+}
+
 bool segment_add(Segment instance, uint32_t value)
 {
     if (!segment_ensure_capacity(instance, instance->length + 1))
@@ -82,14 +161,45 @@ bool segment_add_range(Segment instance, uint32_t values[], uint32_t count)
     return true;
 }
 
+bool segment_trim(Segment instance)
+{
+    uint32_t capacity = instance->length;
+
+    if (capacity < UM_SEGMENT_DEFAULT)
+    {
+        capacity = UM_SEGMENT_DEFAULT;
+    }
+
+    if (capacity >= instance->capacity)
+    {
+        return true;
+    }
+
+    return segment_resize(instance, capacity);
+}
+
 void finalize_segment(Segment instance)
 {
     instance->length = 0;
 
-    if (instance->buffer)
+    if (!instance->buffer)
     {
-        free(instance->buffer);
+        return;
+    }
 
-        instance->buffer = NULL;
+#ifdef UM32_SEGMENT_MAP
+    if (instance->mapped)
+    {
+        munmap(
+            instance->buffer,
+            (size_t)instance->capacity * sizeof * instance->buffer);
+    }
+    else
+#endif
+    {
+        free(instance->buffer);
     }
+
+    instance->buffer = NULL;
+    instance->mapped = false;
 }
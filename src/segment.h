@@ -4,6 +4,8 @@
 
 // http://boundvariable.org
 
+#ifndef UM32_SEGMENT
+#define UM32_SEGMENT
 #include <stdbool.h>
 #include <stdint.h>
 
@@ -12,6 +14,8 @@ struct Segment
     uint32_t length;
     uint32_t capacity;
     uint32_t* buffer;
+    bool mapped;
+    bool huge;
 };
 
 typedef struct Segment* Segment;
@@ -20,4 +24,7 @@ bool segment(Segment instance, uint32_t capacity);
 bool segment_ensure_capacity(Segment instance, uint32_t capacity);
 bool segment_add(Segment instance, uint32_t value);
 bool segment_add_range(Segment instance, uint32_t values[], uint32_t count);
+bool segment_trim(Segment instance);
 void finalize_segment(Segment instance);
+
+#endif
@@ -0,0 +1,235 @@
+// slab.c
+// Copyright (c) 2024 Ishan Pranav
+// Licensed under the MIT license.
+
+// http://boundvariable.org
+
+// A slab packs equally-sized arrays densely into one segment. Allocation
+// state lives out of line in a bitmap, and freed slots are recycled in LIFO
+// order from a stack that always has room for every slot.
+
+#include <errno.h>
+#include <string.h>
+#include "slab.h"
+#define um32_slab_word(slot) ((slot) >> 5)
+#define um32_slab_bit(slot) (1u << ((slot) & 31))
+
+bool slab(Slab instance, uint32_t capacity)
+{
+    instance->capacity = capacity;
+    instance->count = 0;
+
+    if (!segment(&instance->slots, 0))
+    {
+        return false;
+    }
+
+    if (!segment(&instance->bitmap, 0))
+    {
+        finalize_segment(&instance->slots);
+
+        return false;
+    }
+
+    if (!segment(&instance->free, 0))
+    {
+        finalize_segment(&instance->slots);
+        finalize_segment(&instance->bitmap);
+
+        return false;
+    }
+
+    return true;
+}
+
+bool slab_allocate(Slab instance, uint32_t* slot)
+{
+    uint32_t result;
+
+    if (instance->free.length)
+    {
+        instance->free.length--;
+        result = instance->free.buffer[instance->free.length];
+    }
+    else
+    {
+        result = instance->count;
+
+        if (result >= UM32_SLAB_SLOTS ||
+            !segment_ensure_capacity(
+                &instance->slots,
+                (result + 1) * instance->capacity) ||
+            !segment_ensure_capacity(&instance->free, result + 1))
+        {
+            return false;
+        }
+
+        if (!(result & 31) && !segment_add(&instance->bitmap, 0))
+        {
+            return false;
+        }
+
+        instance->count++;
+    }
+
+    instance->bitmap.buffer[um32_slab_word(result)] |= um32_slab_bit(result);
+
+    memset(
+        instance->slots.buffer + result * instance->capacity,
+        0,
+        instance->capacity * sizeof * instance->slots.buffer);
+
+    *slot = result;
+
+    return true;
+}
+
+bool slab_allocated(Slab instance, uint32_t slot)
+{
+    return slot < instance->count &&
+        instance->bitmap.buffer[um32_slab_word(slot)] & um32_slab_bit(slot);
+}
+
+uint32_t* slab_index(Slab instance, uint32_t slot, uint32_t offset)
+{
+    if (offset >= instance->capacity || !slab_allocated(instance, slot))
+    {
+        return NULL;
+    }
+
+    return instance->slots.buffer + slot * instance->capacity + offset;
+}
+
+bool slab_free(Slab instance, uint32_t slot)
+{
+    if (!slab_allocated(instance, slot))
+    {
+        return false;
+    }
+
+    instance->bitmap.buffer[um32_slab_word(slot)] &= ~um32_slab_bit(slot);
+    instance->free.buffer[instance->free.length] = slot;
+    instance->free.length++;
+
+    return true;
+}
+
+bool slab_checkpoint(Checkpoint checkpoint, Slab instance)
+{
+    return checkpoint_write(
+            checkpoint,
+            CHECKPOINT_SECTION_SLAB,
+            &instance->count,
+            sizeof instance->count) &&
+        checkpoint_write_segment(
+            checkpoint,
+            &instance->slots,
+            instance->count * instance->capacity) &&
+        checkpoint_write_segment(
+            checkpoint,
+            &instance->bitmap,
+            instance->bitmap.length) &&
+        checkpoint_write_segment(
+            checkpoint,
+            &instance->free,
+            instance->free.length);
+}
+
+// Tells whether the free stack holds distinct slots that are not allocated.
+// Each slot is marked in the bitmap while the stack is scanned, so that a
+// repeated one is caught, and unmarked again afterwards.
+
+static bool slab_valid_free(Slab instance)
+{
+    uint32_t* bitmap = instance->bitmap.buffer;
+    uint32_t i;
+    bool result = true;
+
+    for (i = 0; i < instance->free.length; i++)
+    {
+        uint32_t slot = instance->free.buffer[i];
+
+        if (slot >= instance->count ||
+            bitmap[um32_slab_word(slot)] & um32_slab_bit(slot))
+        {
+            result = false;
+
+            break;
+        }
+
+        bitmap[um32_slab_word(slot)] |= um32_slab_bit(slot);
+    }
+
+    while (i--)
+    {
+        uint32_t slot = instance->free.buffer[i];
+
+        bitmap[um32_slab_word(slot)] &= ~um32_slab_bit(slot);
+    }
+
+    return result;
+}
+
+bool slab_restore(Slab instance, Checkpoint checkpoint)
+{
+    uint64_t size;
+    const uint32_t* count = checkpoint_read(
+        checkpoint,
+        CHECKPOINT_SECTION_SLAB,
+        &size);
+
+    if (!count)
+    {
+        return false;
+    }
+
+    if (size != sizeof * count || *count > UM32_SLAB_SLOTS)
+    {
+        errno = EINVAL;
+
+        return false;
+    }
+
+    instance->count = *count;
+
+    // The slots are addressed by capacity alone, and the free stack must keep
+    // room for every slot.
+
+    if (!checkpoint_read_segment(
+            checkpoint,
+            &instance->slots,
+            instance->count * instance->capacity) ||
+        !checkpoint_read_segment(checkpoint, &instance->bitmap, 0) ||
+        !checkpoint_read_segment(checkpoint, &instance->free, instance->count))
+    {
+        instance->count = 0;
+
+        return false;
+    }
+
+    bool valid =
+        instance->slots.length == instance->count * instance->capacity &&
+        instance->bitmap.length == (instance->count + 31) / 32 &&
+        instance->free.length <= instance->count &&
+        slab_valid_free(instance);
+
+    instance->slots.length = 0;
+
+    if (!valid)
+    {
+        instance->count = 0;
+        instance->free.length = 0;
+        errno = EINVAL;
+
+        return false;
+    }
+
+    return true;
+}
+
+void finalize_slab(Slab instance)
+{
+    finalize_segment(&instance->slots);
+    finalize_segment(&instance->bitmap);
+    finalize_segment(&instance->free);
+}
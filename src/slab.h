@@ -0,0 +1,33 @@
+// slab.h
+// Copyright (c) 2024 Ishan Pranav
+// Licensed under the MIT license.
+
+// http://boundvariable.org
+
+#ifndef UM32_SLAB
+#define UM32_SLAB
+#include "checkpoint.h"
+#include "segment.h"
+#define UM32_SLAB_SLOTS 0x10000000
+
+struct Slab
+{
+    uint32_t capacity;
+    uint32_t count;
+    struct Segment slots;
+    struct Segment bitmap;
+    struct Segment free;
+};
+
+typedef struct Slab* Slab;
+
+bool slab(Slab instance, uint32_t capacity);
+bool slab_allocate(Slab instance, uint32_t* slot);
+bool slab_allocated(Slab instance, uint32_t slot);
+uint32_t* slab_index(Slab instance, uint32_t slot, uint32_t offset);
+bool slab_free(Slab instance, uint32_t slot);
+bool slab_checkpoint(Checkpoint checkpoint, Slab instance);
+bool slab_restore(Slab instance, Checkpoint checkpoint);
+void finalize_slab(Slab instance);
+
+#endif
@@ -0,0 +1,81 @@
+// stream.c
+// Copyright (c) 2024 Ishan Pranav
+// Licensed under the MIT license.
+
+// http://boundvariable.org
+
+#include "stream.h"
+
+void stream(
+    Stream instance,
+    BlockReader reader,
+    BlockWriter writer,
+    void* context)
+{
+    instance->reader = reader;
+    instance->writer = writer;
+    instance->context = context;
+    instance->inputOffset = 0;
+    instance->inputLength = 0;
+    instance->outputLength = 0;
+    instance->suspended = false;
+}
+
+bool stream_read(Stream instance, uint32_t* result)
+{
+    instance->suspended = false;
+
+    if (!instance->reader)
+    {
+        return false;
+    }
+
+    if (instance->inputOffset == instance->inputLength)
+    {
+        // The program may be waiting on a prompt it has just written.
+
+        stream_flush(instance);
+
+        uint32_t length = instance->reader(
+            instance->context,
+            instance->input,
+            UM32_STREAM_BUFFER);
+
+        instance->inputOffset = 0;
+        instance->inputLength = 0;
+
+        if (length == UM32_READER_SUSPEND)
+        {
+            instance->suspended = true;
+
+            return false;
+        }
+
+        instance->inputLength = length;
+
+        if (!instance->inputLength)
+        {
+            *result = UINT32_MAX;
+
+            return true;
+        }
+    }
+
+    *result = instance->input[instance->inputOffset];
+    instance->inputOffset++;
+
+    return true;
+}
+
+void stream_flush(Stream instance)
+{
+    if (instance->outputLength && instance->writer)
+    {
+        instance->writer(
+            instance->context,
+            instance->output,
+            instance->outputLength);
+    }
+
+    instance->outputLength = 0;
+}
@@ -0,0 +1,47 @@
+// stream.h
+// Copyright (c) 2024 Ishan Pranav
+// Licensed under the MIT license.
+
+// http://boundvariable.org
+
+#ifndef UM32_STREAM
+#define UM32_STREAM
+#include <stdbool.h>
+#include "reader.h"
+#include "writer.h"
+#define UM32_STREAM_BUFFER 4096
+#define um32_stream_write(instance, value) \
+    do \
+    { \
+        if ((instance)->outputLength == UM32_STREAM_BUFFER) \
+        { \
+            stream_flush(instance); \
+        } \
+        (instance)->output[(instance)->outputLength++] = (value); \
+    } while (0)
+
+struct Stream
+{
+    BlockReader reader;
+    BlockWriter writer;
+    void* context;
+    uint32_t inputOffset;
+    uint32_t inputLength;
+    uint32_t outputLength;
+    bool suspended;
+    uint8_t input[UM32_STREAM_BUFFER];
+    uint8_t output[UM32_STREAM_BUFFER];
+};
+
+typedef struct Stream* Stream;
+
+void stream(
+    Stream instance,
+    BlockReader reader,
+    BlockWriter writer,
+    void* context);
+
+bool stream_read(Stream instance, uint32_t* result);
+void stream_flush(Stream instance);
+
+#endif
@@ -0,0 +1,43 @@
+// superinstruction.c
+// Copyright (c) 2024 Ishan Pranav
+// Licensed under the MIT license.
+
+// http://boundvariable.org
+
+#include <string.h>
+#include "superinstruction.h"
+
+static const char* SUPERINSTRUCTIONS_STRINGS[SUPERINSTRUCTIONS_COUNT] =
+{
+    [SUPERINSTRUCTION_NOT] = "not",
+    [SUPERINSTRUCTION_NEGATE] = "negate",
+    [SUPERINSTRUCTION_SUBTRACT] = "subtract",
+    [SUPERINSTRUCTION_JUMP] = "jump",
+    [SUPERINSTRUCTION_IMMEDIATE_JUMP] = "immediate-jump",
+    [SUPERINSTRUCTION_BRANCH] = "branch"
+};
+
+const char* superinstruction_to_string(Superinstruction value)
+{
+    if (value < 0 || value >= SUPERINSTRUCTIONS_COUNT)
+    {
+        return "unknown";
+    }
+
+    return SUPERINSTRUCTIONS_STRINGS[value];
+}
+
+Superinstruction superinstruction_from_string(const char* value)
+{
+    for (Superinstruction superinstruction = 0;
+        superinstruction < SUPERINSTRUCTIONS_COUNT;
+        superinstruction++)
+    {
+        if (strcmp(value, SUPERINSTRUCTIONS_STRINGS[superinstruction]) == 0)
+        {
+            return superinstruction;
+        }
+    }
+
+    return SUPERINSTRUCTIONS_COUNT;
+}
@@ -0,0 +1,26 @@
+// superinstruction.h
+// Copyright (c) 2024 Ishan Pranav
+// Licensed under the MIT license.
+
+// http://boundvariable.org
+
+#ifndef UM32_SUPERINSTRUCTION
+#define UM32_SUPERINSTRUCTION
+
+enum Superinstruction
+{
+    SUPERINSTRUCTION_NOT = 0,
+    SUPERINSTRUCTION_NEGATE = 1,
+    SUPERINSTRUCTION_SUBTRACT = 2,
+    SUPERINSTRUCTION_JUMP = 3,
+    SUPERINSTRUCTION_IMMEDIATE_JUMP = 4,
+    SUPERINSTRUCTION_BRANCH = 5,
+    SUPERINSTRUCTIONS_COUNT
+};
+
+typedef enum Superinstruction Superinstruction;
+
+const char* superinstruction_to_string(Superinstruction value);
+Superinstruction superinstruction_from_string(const char* value);
+
+#endif
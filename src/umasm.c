@@ -4,164 +4,786 @@
 
 // http://boundvariable.org
 
-#include <ctype.h>
+// The listing is read in one pass by a lexer that walks the whole input in
+// memory, mapped where possible. Each line may begin with labels, written as
+// names followed by a colon, and an `li` may take a label in place of its
+// immediate. Such immediates are filled in once every label is known. The
+// program is byte-swapped as a whole before it is written.
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define UM32_ASM_MAP
+#endif
+
 #include <errno.h>
 #include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
 #include "instruction.h"
-#include "machine.h"
 #include "opcode.h"
-#define UM32_ASM_BUFFER_SIZE 256
+#include "segment.h"
+#define UM32_ASM_BUFFER_SIZE 65536
+#define UM32_ASM_LABELS 1024
+#define UM32_ASM_IMMEDIATE 0x01ffffff
+#define UM32_ASM_ANNOTATION 8
+
+struct AsmLabel
+{
+    const char* name;
+    uint32_t length;
+    uint32_t offset;
+};
 
-struct Machine um;
+typedef struct AsmLabel* AsmLabel;
 
-size_t asm_read(FILE* input, Machine instance)
+struct AsmFixup
 {
-    size_t lineNumber = 0;
-    char* instruction;
-    char buffer[UM32_ASM_BUFFER_SIZE];
-    Segment program = &instance->program;
+    const char* name;
+    uint32_t length;
+    uint32_t offset;
+    size_t line;
+};
+
+typedef struct AsmFixup* AsmFixup;
+
+struct Assembler
+{
+    const char* cursor;
+    const char* end;
+    size_t line;
+    const char* error;
+    struct Segment program;
+    AsmLabel labels;
+    uint32_t labelCapacity;
+    uint32_t labelCount;
+    AsmFixup fixups;
+    uint32_t fixupCapacity;
+    uint32_t fixupCount;
+};
+
+typedef struct Assembler* Assembler;
+
+static bool assembler(Assembler instance, const char* text, size_t size)
+{
+    uint64_t lines = 1;
+
+    instance->cursor = text;
+    instance->end = text + size;
+    instance->line = 1;
+    instance->error = NULL;
+    instance->labelCapacity = UM32_ASM_LABELS;
+    instance->labelCount = 0;
+    instance->fixups = NULL;
+    instance->fixupCapacity = 0;
+    instance->fixupCount = 0;
+    instance->labels = calloc(UM32_ASM_LABELS, sizeof * instance->labels);
+
+    // Each line holds at most one instruction, so counting the lines sizes
+    // the program once.
+
+    for (const char* p = text; (p = memchr(p, '\n', instance->end - p)); p++)
+    {
+        lines++;
+    }
 
-    while ((instruction = fgets(buffer, UM32_ASM_BUFFER_SIZE, input)))
+    if (lines > UINT32_MAX)
     {
-        lineNumber++;
+        lines = UINT32_MAX;
+    }
+
+    return segment(&instance->program, 0) &&
+        instance->labels &&
+        segment_ensure_capacity(&instance->program, lines);
+}
+
+static void finalize_assembler(Assembler instance)
+{
+    finalize_segment(&instance->program);
+    free(instance->labels);
+    free(instance->fixups);
 
-        char* labelOffset = strchr(instruction, ':');
+    instance->labels = NULL;
+    instance->fixups = NULL;
+}
+
+static bool asm_fail(Assembler instance, const char* error)
+{
+    instance->error = error;
+
+    return false;
+}
+
+static bool asm_is_space(char value)
+{
+    return value == ' ' || value == '\t' || value == '\r' ||
+        value == '\v' || value == '\f';
+}
+
+static bool asm_is_letter(char value)
+{
+    return (value >= 'a' && value <= 'z') ||
+        (value >= 'A' && value <= 'Z') ||
+        value == '_' ||
+        value == '.';
+}
+
+static bool asm_is_digit(char value)
+{
+    return value >= '0' && value <= '9';
+}
+
+static void asm_skip_space(Assembler instance)
+{
+    while (instance->cursor < instance->end && asm_is_space(*instance->cursor))
+    {
+        instance->cursor++;
+    }
+}
+
+static uint32_t asm_identifier(Assembler instance, const char** name)
+{
+    const char* start = instance->cursor;
+
+    if (start == instance->end || !asm_is_letter(*start))
+    {
+        return 0;
+    }
 
-        if (labelOffset)
+    while (instance->cursor < instance->end &&
+        (asm_is_letter(*instance->cursor) || asm_is_digit(*instance->cursor)))
+    {
+        instance->cursor++;
+    }
+
+    *name = start;
+
+    return instance->cursor - start;
+}
+
+static uint32_t asm_hash(const char* name, uint32_t length)
+{
+    uint32_t result = 2166136261;
+
+    for (uint32_t i = 0; i < length; i++)
+    {
+        result = (result ^ (unsigned char)name[i]) * 16777619;
+    }
+
+    return result;
+}
+
+static AsmLabel asm_find(
+    AsmLabel labels,
+    uint32_t capacity,
+    const char* name,
+    uint32_t length)
+{
+    for (uint32_t i = asm_hash(name, length);; i++)
+    {
+        AsmLabel label = labels + (i & (capacity - 1));
+
+        if (!label->name ||
+            (label->length == length &&
+                memcmp(label->name, name, length) == 0))
         {
-            instruction = labelOffset + 1;
+            return label;
         }
+    }
+}
+
+static bool asm_grow_labels(Assembler instance)
+{
+    uint32_t capacity = instance->labelCapacity * 2;
+    AsmLabel labels = calloc(capacity, sizeof * labels);
+
+    if (!labels)
+    {
+        return asm_fail(instance, strerror(errno));
+    }
+
+    for (uint32_t i = 0; i < instance->labelCapacity; i++)
+    {
+        AsmLabel label = instance->labels + i;
 
-        while (isspace(*instruction))
+        if (label->name)
         {
-            instruction++;
+            *asm_find(labels, capacity, label->name, label->length) = *label;
         }
+    }
+
+    free(instance->labels);
+
+    instance->labels = labels;
+    instance->labelCapacity = capacity;
+
+    return true;
+}
+
+static bool asm_define(
+    Assembler instance,
+    const char* name,
+    uint32_t length,
+    uint32_t offset)
+{
+    // The table is kept at most half full.
+
+    if (instance->labelCount * 2 >= instance->labelCapacity &&
+        !asm_grow_labels(instance))
+    {
+        return false;
+    }
+
+    AsmLabel label = asm_find(
+        instance->labels,
+        instance->labelCapacity,
+        name,
+        length);
+
+    if (label->name)
+    {
+        return asm_fail(instance, "duplicate label");
+    }
+
+    label->name = name;
+    label->length = length;
+    label->offset = offset;
+    instance->labelCount++;
+
+    return true;
+}
+
+static bool asm_emit(Assembler instance, uint32_t word)
+{
+    Segment program = &instance->program;
+
+    if (program->length == program->capacity &&
+        !segment_ensure_capacity(program, program->capacity + 1))
+    {
+        return asm_fail(instance, strerror(errno));
+    }
 
-        if (*instruction == '#')
+    program->buffer[program->length++] = word;
+
+    return true;
+}
+
+static bool asm_register(Assembler instance, uint32_t* value)
+{
+    asm_skip_space(instance);
+
+    if (instance->cursor == instance->end || *instance->cursor != 'r')
+    {
+        return asm_fail(instance, "syntax error");
+    }
+
+    instance->cursor++;
+    *value = 0;
+
+    if (instance->cursor == instance->end || !asm_is_digit(*instance->cursor))
+    {
+        return asm_fail(instance, "syntax error");
+    }
+
+    while (instance->cursor < instance->end &&
+        asm_is_digit(*instance->cursor))
+    {
+        *value = *value * 10 + *instance->cursor++ - '0';
+
+        if (*value > 7)
         {
-            continue;
+            return asm_fail(instance, "syntax error");
         }
+    }
 
-        char opcodeString[6];
-        uint32_t a;
-        uint32_t b;
-        uint32_t c;
-        int count = sscanf(instruction,
-            "%5s r%" SCNu32 " r%" SCNu32 " r%" SCNu32,
-            opcodeString, &a, &b, &c);
+    return true;
+}
+
+static int asm_hex_digit(char value)
+{
+    if (asm_is_digit(value))
+    {
+        return value - '0';
+    }
 
-        if (count < 1)
+    if (value >= 'a' && value <= 'f')
+    {
+        return value - 'a' + 10;
+    }
+
+    if (value >= 'A' && value <= 'F')
+    {
+        return value - 'A' + 10;
+    }
+
+    return -1;
+}
+
+static bool asm_fixup(Assembler instance, const char* name, uint32_t length)
+{
+    if (instance->fixupCount == instance->fixupCapacity)
+    {
+        uint32_t capacity = instance->fixupCapacity ?
+            instance->fixupCapacity * 2 :
+            UM32_ASM_LABELS;
+        AsmFixup fixups = realloc(
+            instance->fixups,
+            capacity * sizeof * fixups);
+
+        if (!fixups)
         {
-            return lineNumber;
+            return asm_fail(instance, strerror(errno));
         }
 
-        uint32_t opcode = opcode_from_string(opcodeString);
+        instance->fixups = fixups;
+        instance->fixupCapacity = capacity;
+    }
 
-        switch (opcode)
-        {
-        case OPCODE_IMMEDIATE:
+    struct AsmFixup fixup =
+    {
+        .name = name,
+        .length = length,
+        .offset = instance->program.length,
+        .line = instance->line
+    };
+
+    instance->fixups[instance->fixupCount++] = fixup;
+
+    return true;
+}
+
+// Reads `$0x` followed by hexadecimal digits, or `$` followed by a label whose
+// offset is filled in later.
+
+static bool asm_immediate(Assembler instance, uint32_t* value)
+{
+    const char* name;
+
+    asm_skip_space(instance);
+
+    if (instance->cursor == instance->end || *instance->cursor != '$')
+    {
+        return asm_fail(instance, "syntax error");
+    }
+
+    instance->cursor++;
+    *value = 0;
+
+    uint32_t length = asm_identifier(instance, &name);
+
+    if (length)
+    {
+        return asm_fixup(instance, name, length);
+    }
+
+    if (instance->end - instance->cursor < 3 ||
+        instance->cursor[0] != '0' ||
+        (instance->cursor[1] != 'x' && instance->cursor[1] != 'X') ||
+        asm_hex_digit(instance->cursor[2]) < 0)
+    {
+        return asm_fail(instance, "syntax error");
+    }
+
+    instance->cursor += 2;
+
+    for (int digit;
+        instance->cursor < instance->end &&
+            (digit = asm_hex_digit(*instance->cursor)) >= 0;
+        instance->cursor++)
+    {
+        *value = (*value << 4) | digit;
+
+        if (*value > UM32_ASM_IMMEDIATE)
         {
-            uint32_t immediate;
+            return asm_fail(instance, "immediate out of range");
+        }
+    }
 
-            count = sscanf(instruction, "%5s r%" SCNx32 " $0x%" SCNx32,
-                opcodeString, &a, &immediate);
+    return true;
+}
 
-            if (count != 3 || a > 7)
-            {
-                return lineNumber;
-            }
+static bool asm_instruction(Assembler instance, Opcode opcode)
+{
+    uint32_t a = 0;
+    uint32_t b = 0;
+    uint32_t c = 0;
 
-            uint32_t word = um32_instruction_from_immediate(
-                opcode,
-                a,
-                immediate);
+    switch (opcode)
+    {
+    case OPCODE_IMMEDIATE:
+        if (!asm_register(instance, &a) || !asm_immediate(instance, &b))
+        {
+            return false;
+        }
 
-            if (segment_add(program, word))
-            {
-                perror("segment_add");
-                exit(EXIT_FAILURE);
-            }
+        return asm_emit(
+            instance,
+            um32_instruction_from_immediate(opcode, a, b));
+
+    case OPCODE_ADD:
+    case OPCODE_CONDITIONAL_MOVE:
+    case OPCODE_DIVIDE:
+    case OPCODE_GET:
+    case OPCODE_MULTIPLY:
+    case OPCODE_NAND:
+    case OPCODE_SET:
+        if (!asm_register(instance, &a) ||
+            !asm_register(instance, &b) ||
+            !asm_register(instance, &c))
+        {
+            return false;
         }
         break;
 
-        case OPCODE_ADD:
-        case OPCODE_CONDITIONAL_MOVE:
-        case OPCODE_DIVIDE:
-        case OPCODE_GET:
-        case OPCODE_MULTIPLY:
-        case OPCODE_NAND:
-        case OPCODE_SET:
+    case OPCODE_ALLOCATE:
+    case OPCODE_LOAD:
+        if (!asm_register(instance, &b) || !asm_register(instance, &c))
         {
-            if (count != 4 || a > 7 || b > 7 || c > 7)
-            {
-                return lineNumber;
-            }
+            return false;
+        }
+        break;
 
-            if (!segment_add(program, um32_instruction(opcode, a, b, c)))
-            {
-                perror("segment_add");
-                exit(EXIT_FAILURE);
-            }
+    case OPCODE_FREE:
+    case OPCODE_READ:
+    case OPCODE_WRITE:
+        if (!asm_register(instance, &c))
+        {
+            return false;
         }
         break;
 
-        case OPCODE_ALLOCATE:
-        case OPCODE_LOAD:
+    case OPCODE_HALT:
+        break;
+
+    default:
+        return asm_fail(instance, "syntax error");
+    }
+
+    return asm_emit(instance, um32_instruction(opcode, a, b, c));
+}
+
+// The disassembler begins each line with the word it decoded, written as
+// eight hexadecimal digits and a colon. Whether they stand for that word or
+// for a label is only known once the instruction after them is assembled.
+
+static bool asm_annotation(Assembler instance, uint32_t* word)
+{
+    const char* cursor = instance->cursor;
+    uint32_t result = 0;
+
+    if (instance->end - cursor <= UM32_ASM_ANNOTATION ||
+        cursor[UM32_ASM_ANNOTATION] != ':')
+    {
+        return false;
+    }
+
+    for (int i = 0; i < UM32_ASM_ANNOTATION; i++)
+    {
+        int digit = asm_hex_digit(cursor[i]);
+
+        if (digit < 0)
         {
-            if (count != 3 || b > 7 || c > 7)
-            {
-                return lineNumber;
-            }
+            return false;
+        }
+
+        result = (result << 4) | digit;
+    }
+
+    instance->cursor += UM32_ASM_ANNOTATION + 1;
+    *word = result;
 
-            if (!segment_add(program, um32_instruction(opcode, 0, b, c)))
+    return true;
+}
+
+static uint32_t asm_unused_bits(uint32_t word)
+{
+    switch (um32_instruction_opcode(word))
+    {
+    case OPCODE_IMMEDIATE:
+        return 0;
+
+    case OPCODE_HALT:
+        return 0x0fffffff;
+
+    case OPCODE_ALLOCATE:
+    case OPCODE_LOAD:
+        return 0x0fffffc0;
+
+    case OPCODE_FREE:
+    case OPCODE_READ:
+    case OPCODE_WRITE:
+        return 0x0ffffff8;
+
+    default:
+        return 0x0ffffe00;
+    }
+}
+
+// An annotated word is kept as it was whenever it decodes to the instruction
+// on its line, so that unused bits and words with no valid opcode, which the
+// disassembler lists as `nop`, survive a round trip.
+
+static bool asm_statement(
+    Assembler instance,
+    const char* name,
+    uint32_t length,
+    bool annotated,
+    uint32_t word,
+    bool* kept)
+{
+    *kept = annotated &&
+        um32_instruction_opcode(word) >= OPCODES_COUNT &&
+        length == 3 &&
+        memcmp(name, "nop", 3) == 0;
+
+    if (*kept)
+    {
+        return asm_emit(instance, word);
+    }
+
+    if (!asm_instruction(instance, opcode_from_token(name, length)))
+    {
+        return false;
+    }
+
+    uint32_t* last = instance->program.buffer + instance->program.length - 1;
+
+    *kept = annotated && !((*last ^ word) & ~asm_unused_bits(*last));
+
+    if (*kept)
+    {
+        *last = word;
+    }
+
+    return true;
+}
+
+static bool asm_line(Assembler instance)
+{
+    const char* name;
+    uint32_t length;
+    uint32_t word = 0;
+
+    asm_skip_space(instance);
+
+    const char* annotation = instance->cursor;
+    bool annotated = asm_annotation(instance, &word);
+    bool kept = false;
+    uint32_t offset = instance->program.length;
+
+    asm_skip_space(instance);
+
+    while ((length = asm_identifier(instance, &name)))
+    {
+        if (instance->cursor == instance->end || *instance->cursor != ':')
+        {
+            if (!asm_statement(instance, name, length, annotated, word, &kept))
             {
-                perror("segment_add");
-                exit(EXIT_FAILURE);
+                return false;
             }
+
+            break;
         }
-        break;
 
-        case OPCODE_FREE:
-        case OPCODE_READ:
-        case OPCODE_WRITE:
+        instance->cursor++;
+
+        if (!asm_define(instance, name, length, offset))
         {
-            if (count != 2 || c > 7)
-            {
-                return lineNumber;
-            }
+            return false;
+        }
 
-            if (!segment_add(program, um32_instruction(opcode, 0, 0, c)))
-            {
-                perror("segment_add");
-                exit(EXIT_FAILURE);
-            }
+        asm_skip_space(instance);
+    }
+
+    // An annotation that does not describe its instruction, as in
+    // `deadbeef: halt`, is a label.
+
+    if (annotated &&
+        !kept &&
+        !asm_define(instance, annotation, UM32_ASM_ANNOTATION, offset))
+    {
+        return false;
+    }
+
+    asm_skip_space(instance);
+
+    if (instance->cursor < instance->end && *instance->cursor == '#')
+    {
+        const char* newline = memchr(
+            instance->cursor,
+            '\n',
+            instance->end - instance->cursor);
+
+        instance->cursor = newline ? newline : instance->end;
+    }
+
+    if (instance->cursor == instance->end)
+    {
+        return true;
+    }
+
+    if (*instance->cursor != '\n')
+    {
+        return asm_fail(instance, "syntax error");
+    }
+
+    instance->cursor++;
+    instance->line++;
+
+    return true;
+}
+
+static bool asm_read(Assembler instance)
+{
+    while (instance->cursor < instance->end)
+    {
+        if (!asm_line(instance))
+        {
+            return false;
         }
-        break;
+    }
+
+    // Labels may be used before they are defined, so their offsets are only
+    // filled in once the whole listing has been read.
+
+    for (uint32_t i = 0; i < instance->fixupCount; i++)
+    {
+        AsmFixup fixup = instance->fixups + i;
+        AsmLabel label = asm_find(
+            instance->labels,
+            instance->labelCapacity,
+            fixup->name,
+            fixup->length);
+
+        instance->line = fixup->line;
 
-        case OPCODE_HALT:
+        if (!label->name)
         {
-            if (count != 1)
-            {
-                return lineNumber;
-            }
+            return asm_fail(instance, "undefined label");
+        }
+
+        if (label->offset > UM32_ASM_IMMEDIATE)
+        {
+            return asm_fail(instance, "immediate out of range");
+        }
+
+        instance->program.buffer[fixup->offset] |= label->offset;
+    }
+
+    return true;
+}
 
-            if (!segment_add(program, um32_instruction(opcode, 0, 0, 0)))
+static char* asm_load(FILE* input, size_t* size, bool* mapped)
+{
+    char* result = NULL;
+    size_t capacity = 0;
+
+    *size = 0;
+    *mapped = false;
+
+#ifdef UM32_ASM_MAP
+    struct stat status;
+
+    if (fstat(fileno(input), &status) == 0 &&
+        S_ISREG(status.st_mode) &&
+        status.st_size > 0)
+    {
+        result = mmap(
+            NULL,
+            status.st_size,
+            PROT_READ,
+            MAP_PRIVATE,
+            fileno(input),
+            0);
+
+        if (result != MAP_FAILED)
+        {
+#ifdef MADV_SEQUENTIAL
+            madvise(result, status.st_size, MADV_SEQUENTIAL);
+#endif
+
+            *size = status.st_size;
+            *mapped = true;
+
+            return result;
+        }
+
+        result = NULL;
+    }
+#endif
+
+    // Streams that cannot be mapped, such as pipes, are read into a buffer
+    // that doubles as it fills.
+
+    for (;;)
+    {
+        if (*size == capacity)
+        {
+            capacity = capacity ? capacity * 2 : UM32_ASM_BUFFER_SIZE;
+
+            char* buffer = realloc(result, capacity);
+
+            if (!buffer)
             {
-                perror("segment_add");
-                exit(EXIT_FAILURE);
+                free(result);
+
+                return NULL;
             }
+
+            result = buffer;
         }
-        break;
 
-        default: return lineNumber;
+        size_t length = fread(result + *size, 1, capacity - *size, input);
+
+        *size += length;
+
+        if (!length)
+        {
+            break;
         }
     }
 
-    return 0;
+    if (ferror(input))
+    {
+        free(result);
+
+        return NULL;
+    }
+
+    return result;
+}
+
+static void asm_unload(char* text, size_t size, bool mapped)
+{
+#ifdef UM32_ASM_MAP
+    if (mapped)
+    {
+        munmap(text, size);
+
+        return;
+    }
+#endif
+
+    (void)size;
+    (void)mapped;
+
+    free(text);
+}
+
+static bool asm_write(FILE* output, Segment program)
+{
+    instruction_swap(program->buffer, program->buffer, program->length);
+
+    return fwrite(
+        program->buffer,
+        sizeof * program->buffer,
+        program->length,
+        output) == program->length;
 }
 
 int main(int count, char* args[])
 {
+    struct Assembler assembly;
     char* app = args[0];
 
     if (count < 2)
@@ -171,34 +793,55 @@ int main(int count, char* args[])
         return EXIT_FAILURE;
     }
 
-    if (!machine(&um, NULL, NULL))
+    size_t size;
+    bool mapped;
+    char* text = asm_load(stdin, &size, &mapped);
+
+    if (!text)
     {
         perror(app);
 
         return EXIT_FAILURE;
     }
 
-    size_t lineNumber = asm_read(stdin, &um);
+    if (!assembler(&assembly, text, size))
+    {
+        perror(app);
+        finalize_assembler(&assembly);
+        asm_unload(text, size, mapped);
 
-    if (lineNumber != 0)
+        return EXIT_FAILURE;
+    }
+
+    if (!asm_read(&assembly))
     {
-        fprintf(stderr, "%s: syntax error on line %zu\n", app, lineNumber);
+        fprintf(stderr,
+            "%s: %s on line %zu\n",
+            app, assembly.error, assembly.line);
+        finalize_assembler(&assembly);
+        asm_unload(text, size, mapped);
 
         return EXIT_FAILURE;
     }
 
+    // Labels point into the listing, so it stays loaded until they resolve.
+
+    asm_unload(text, size, mapped);
+
     char* path = args[1];
     FILE* output = fopen(path, "wb");
 
-    if (!output || !machine_write_program(output, &um) || fclose(output) != 0)
+    if (!output ||
+        !asm_write(output, &assembly.program) ||
+        fclose(output) != 0)
     {
-        finalize_machine(&um);
+        finalize_assembler(&assembly);
         fprintf(stderr, "%s: %s: %s\n", app, path, strerror(errno));
 
         return EXIT_FAILURE;
     }
 
-    finalize_machine(&um);
+    finalize_assembler(&assembly);
 
     return EXIT_SUCCESS;
 }
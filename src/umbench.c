@@ -0,0 +1,405 @@
+// umbench.c
+// Copyright (c) 2024 Ishan Pranav
+// Licensed under the MIT license.
+
+// http://boundvariable.org
+
+// Runs each program several times in the same process and reports, as JSON,
+// the median and variance of the wall time and of the millions of UM
+// instructions executed per second. Output is counted and discarded, and
+// every read sees the end of the input.
+
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+#include "machine.h"
+#define UM32_BENCH_RUNS 5
+
+struct BenchOptions
+{
+    Engine engine;
+    HeapMode mode;
+    bool fused;
+    uint32_t runs;
+};
+
+typedef struct BenchOptions* BenchOptions;
+
+struct BenchResult
+{
+    Fault fault;
+    uint64_t executed;
+    uint64_t output;
+    double* walls;
+    double* rates;
+};
+
+typedef struct BenchResult* BenchResult;
+
+static uint32_t bench_read(void* context, uint8_t buffer[], uint32_t length)
+{
+    (void)context;
+    (void)buffer;
+    (void)length;
+
+    return 0;
+}
+
+static void bench_write(
+    void* context,
+    const uint8_t buffer[],
+    uint32_t length)
+{
+    uint64_t* output = context;
+
+    (void)buffer;
+
+    *output += length;
+}
+
+static double bench_wall()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static int bench_compare(const void* left, const void* right)
+{
+    double a = *(const double*)left;
+    double b = *(const double*)right;
+
+    return (a > b) - (a < b);
+}
+
+static double bench_median(double values[], double sorted[], uint32_t count)
+{
+    memcpy(sorted, values, count * sizeof * sorted);
+    qsort(sorted, count, sizeof * sorted, bench_compare);
+
+    if (count % 2)
+    {
+        return sorted[count / 2];
+    }
+
+    return (sorted[count / 2 - 1] + sorted[count / 2]) / 2;
+}
+
+static double bench_variance(double values[], uint32_t count)
+{
+    double mean = 0;
+    double sum = 0;
+
+    if (count < 2)
+    {
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        mean += values[i];
+    }
+
+    mean /= count;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        sum += (values[i] - mean) * (values[i] - mean);
+    }
+
+    return sum / (count - 1);
+}
+
+static void bench_write_string(FILE* output, const char* value)
+{
+    fputc('"', output);
+
+    for (; *value; value++)
+    {
+        unsigned char c = *value;
+
+        if (c == '"' || c == '\\')
+        {
+            fprintf(output, "\\%c", c);
+        }
+        else if (c < 0x20)
+        {
+            fprintf(output, "\\u%04x", c);
+        }
+        else
+        {
+            fputc(c, output);
+        }
+    }
+
+    fputc('"', output);
+}
+
+static void bench_write_summary(
+    FILE* output,
+    const char* name,
+    double values[],
+    double sorted[],
+    uint32_t count)
+{
+    fprintf(output,
+        "      \"%s\": { \"median\": %.9g, \"variance\": %.9g, "
+        "\"samples\": [",
+        name,
+        bench_median(values, sorted, count),
+        bench_variance(values, count));
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        fprintf(output, "%s%.9g", i ? ", " : "", values[i]);
+    }
+
+    fprintf(output, "] }");
+}
+
+static void bench_configure(Machine instance, BenchOptions options)
+{
+    if (options->engine != ENGINES_COUNT)
+    {
+        instance->engine = options->engine;
+    }
+
+    if (options->mode != HEAP_MODES_COUNT)
+    {
+        instance->heap.mode = options->mode;
+    }
+
+    instance->fused = options->fused;
+}
+
+static bool bench_run(
+    BenchResult result,
+    BenchOptions options,
+    char* path,
+    uint32_t run)
+{
+    struct Machine um;
+    uint64_t executed = 0;
+
+    result->output = 0;
+
+    if (!machine_stream(&um, bench_read, bench_write, &result->output))
+    {
+        return false;
+    }
+
+    bench_configure(&um, options);
+
+    FILE* input = fopen(path, "rb");
+
+    if (!input || !machine_read_program(&um, input) || fclose(input) != 0)
+    {
+        finalize_machine(&um);
+
+        return false;
+    }
+
+    // Only execution is timed, including the final flush of the output.
+
+    double start = bench_wall();
+
+    result->fault = machine_run(&um, UINT64_MAX, &executed);
+
+    machine_flush(&um);
+
+    double wall = bench_wall() - start;
+
+    finalize_machine(&um);
+
+    result->executed = executed;
+    result->walls[run] = wall;
+    result->rates[run] = wall > 0 ? executed / wall / 1e6 : 0;
+
+    return true;
+}
+
+static int bench_usage(char* app)
+{
+    fprintf(stderr,
+        "Usage: %s [--runs N] [--engine switch|threaded|jit] "
+        "[--heap arena|handles|chunks] [--fuse] FILE...\n",
+        app);
+
+    return EXIT_FAILURE;
+}
+
+int main(int count, char* args[])
+{
+    char* app = args[0];
+    int first = count;
+    struct BenchOptions options =
+    {
+        .engine = ENGINES_COUNT,
+        .mode = HEAP_MODES_COUNT,
+        .runs = UM32_BENCH_RUNS
+    };
+
+    for (int i = 1; i < count && first == count; i++)
+    {
+        if (strcmp(args[i], "--runs") == 0 && i + 1 < count)
+        {
+            char* end;
+            unsigned long runs = strtoul(args[++i], &end, 10);
+
+            if (!*args[i] || *end || !runs || runs > UINT32_MAX)
+            {
+                return bench_usage(app);
+            }
+
+            options.runs = runs;
+        }
+        else if (strcmp(args[i], "--engine") == 0 && i + 1 < count)
+        {
+            options.engine = engine_from_string(args[++i]);
+
+            if (options.engine == ENGINES_COUNT)
+            {
+                return bench_usage(app);
+            }
+        }
+        else if (strcmp(args[i], "--heap") == 0 && i + 1 < count)
+        {
+            options.mode = heap_mode_from_string(args[++i]);
+
+            if (options.mode == HEAP_MODES_COUNT)
+            {
+                return bench_usage(app);
+            }
+        }
+        else if (strcmp(args[i], "--fuse") == 0)
+        {
+            options.fused = true;
+        }
+        else if (strncmp(args[i], "--", 2) == 0)
+        {
+            return bench_usage(app);
+        }
+        else
+        {
+            first = i;
+        }
+    }
+
+    if (first == count)
+    {
+        return bench_usage(app);
+    }
+
+    struct Machine um;
+    struct BenchResult result;
+    uint32_t written = 0;
+    int status = EXIT_SUCCESS;
+
+    if (!machine_stream(&um, bench_read, bench_write, NULL))
+    {
+        fprintf(stderr, "%s: %s\n", app, strerror(errno));
+
+        return EXIT_FAILURE;
+    }
+
+    // The settings are reported as a machine resolves them, so that the
+    // default engine is named explicitly.
+
+    bench_configure(&um, &options);
+
+    Engine engine = um.engine;
+    HeapMode mode = um.heap.mode;
+
+    finalize_machine(&um);
+
+    double* sorted = malloc(options.runs * sizeof * sorted);
+
+    result.walls = malloc(options.runs * sizeof * result.walls);
+    result.rates = malloc(options.runs * sizeof * result.rates);
+
+    if (!sorted || !result.walls || !result.rates)
+    {
+        free(sorted);
+        free(result.walls);
+        free(result.rates);
+        fprintf(stderr, "%s: %s\n", app, strerror(errno));
+
+        return EXIT_FAILURE;
+    }
+
+    printf(
+        "{\n"
+        "  \"engine\": \"%s\",\n"
+        "  \"heap\": \"%s\",\n"
+        "  \"fused\": %s,\n"
+        "  \"runs\": %" PRIu32 ",\n"
+        "  \"workloads\": [",
+        engine_to_string(engine),
+        heap_mode_to_string(mode),
+        options.fused ? "true" : "false",
+        options.runs);
+
+    for (int i = first; i < count; i++)
+    {
+        char* path = args[i];
+        bool completed = true;
+
+        for (uint32_t run = 0; completed && run < options.runs; run++)
+        {
+            completed = bench_run(&result, &options, path, run);
+        }
+
+        if (!completed)
+        {
+            fprintf(stderr, "%s: %s: %s\n", app, path, strerror(errno));
+
+            status = EXIT_FAILURE;
+
+            continue;
+        }
+
+        if (um32_fault_is_stopped(result.fault))
+        {
+            fprintf(stderr, "%s: %s\n", path, fault_to_string(result.fault));
+
+            status = EXIT_FAILURE;
+        }
+
+        printf("%s\n    {\n      \"name\": ", written ? "," : "");
+        bench_write_string(stdout, path);
+        printf(
+            ",\n"
+            "      \"fault\": \"%s\",\n"
+            "      \"instructions\": %" PRIu64 ",\n"
+            "      \"output\": %" PRIu64 ",\n",
+            fault_to_string(result.fault),
+            result.executed,
+            result.output);
+        bench_write_summary(
+            stdout,
+            "wall",
+            result.walls,
+            sorted,
+            options.runs);
+        printf(",\n");
+        bench_write_summary(
+            stdout,
+            "mips",
+            result.rates,
+            sorted,
+            options.runs);
+        printf("\n    }");
+        fflush(stdout);
+
+        written++;
+    }
+
+    printf("\n  ]\n}\n");
+    free(sorted);
+    free(result.walls);
+    free(result.rates);
+
+    return status;
+}
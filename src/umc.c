@@ -0,0 +1,481 @@
+// umc.c
+// Copyright (c) 2024 Ishan Pranav
+// Licensed under the MIT license.
+
+// http://boundvariable.org
+
+// Translates a program into a C translation unit with one label per
+// instruction. Loads from array 0 jump through a switch over every label,
+// except that an immediate followed by such a load jumps straight to its
+// target. The translation reads array 0 from a copy of the program and uses
+// libum for the heap. Writes to array 0 and loads of other arrays hand the
+// registers to an interpreter, which runs the rest of the program.
+
+// Both read the standard input stream through stdio, the interpreter one byte
+// at a time so that it never waits for more input than the program asked for.
+// At the end of the input, both read 0xffffffff, as umvm does.
+
+#include <errno.h>
+#include <inttypes.h>
+#include "machine.h"
+#include "operation.h"
+#define UM32_C_WORDS_PER_LINE 6
+
+static void c_write_prologue(
+    FILE* output,
+    char* path,
+    Segment program,
+    bool uses[])
+{
+    fprintf(output,
+        "// Generated by umc from %s.\n"
+        "\n"
+        "#include \"machine.h\"\n"
+        "#define UM32_C_LENGTH %" PRIu32 "\n"
+        "#define um32_c_fault(at, value) \\\n"
+        "    do \\\n"
+        "    { \\\n"
+        "        instructionPointer = (at); \\\n"
+        "        fault = (value); \\\n"
+        "        goto exit; \\\n"
+        "    } while (0)\n"
+        "#define um32_c_fallback(at) \\\n"
+        "    do \\\n"
+        "    { \\\n"
+        "        instructionPointer = (at); \\\n"
+        "        goto exit; \\\n"
+        "    } while (0)\n"
+        "\n"
+        "static const uint32_t PROGRAM[UM32_C_LENGTH + 1] =\n"
+        "{",
+        path,
+        program->length);
+
+    for (uint32_t i = 0; i < program->length; i++)
+    {
+        if (i % UM32_C_WORDS_PER_LINE == 0)
+        {
+            fprintf(output, "\n    ");
+        }
+        else
+        {
+            fprintf(output, " ");
+        }
+
+        fprintf(output, "0x%08" PRIx32 ",", program->buffer[i]);
+    }
+
+    fprintf(output,
+        "\n    0\n"
+        "};\n"
+        "\n"
+        "struct Machine um;\n"
+        "\n"
+        "static uint32_t c_read()\n"
+        "{\n"
+        "    int result = getchar();\n"
+        "\n"
+        "    if (result == EOF)\n"
+        "    {\n"
+        "        return UINT32_MAX;\n"
+        "    }\n"
+        "\n"
+        "    return result;\n"
+        "}\n"
+        "\n"
+        "static void c_write(uint8_t value)\n"
+        "{\n"
+        "    putchar(value);\n"
+        "}\n"
+        "\n"
+        "static uint32_t c_read_block(\n"
+        "    void* context,\n"
+        "    uint8_t buffer[],\n"
+        "    uint32_t length)\n"
+        "{\n"
+        "    (void)context;\n"
+        "    (void)length;\n"
+        "\n"
+        "    int result = getchar();\n"
+        "\n"
+        "    if (result == EOF)\n"
+        "    {\n"
+        "        return 0;\n"
+        "    }\n"
+        "\n"
+        "    buffer[0] = result;\n"
+        "\n"
+        "    return 1;\n"
+        "}\n"
+        "\n"
+        "static void c_write_block(\n"
+        "    void* context,\n"
+        "    const uint8_t buffer[],\n"
+        "    uint32_t length)\n"
+        "{\n"
+        "    (void)context;\n"
+        "\n"
+        "    fwrite(buffer, sizeof * buffer, length, stdout);\n"
+        "}\n"
+        "\n"
+        "int main()\n"
+        "{\n");
+
+    if (uses[OPCODE_GET] || uses[OPCODE_SET] ||
+        uses[OPCODE_ALLOCATE] || uses[OPCODE_FREE])
+    {
+        fprintf(output, "    Heap heap = &um.heap;\n");
+    }
+
+    fprintf(output,
+        "    Fault fault = FAULT_NONE;\n"
+        "    uint32_t instructionPointer = 0;\n"
+        "    uint32_t r0 = 0, r1 = 0, r2 = 0, r3 = 0;\n"
+        "    uint32_t r4 = 0, r5 = 0, r6 = 0, r7 = 0;\n"
+        "\n"
+        "    if (!machine_stream(&um, c_read_block, c_write_block, NULL) ||\n"
+        "        !segment_add_range(\n"
+        "            &um.program,\n"
+        "            (uint32_t*)PROGRAM,\n"
+        "            UM32_C_LENGTH))\n"
+        "    {\n"
+        "        perror(\"machine\");\n"
+        "\n"
+        "        return EXIT_FAILURE;\n"
+        "    }\n"
+        "\n"
+        "\n");
+
+    if (!uses[OPCODE_LOAD])
+    {
+        return;
+    }
+
+    fprintf(output,
+        "    goto label0;\n"
+        "\n"
+        "dispatch:\n"
+        "    switch (instructionPointer)\n"
+        "    {\n");
+
+    for (uint32_t i = 0; i < program->length; i++)
+    {
+        fprintf(output,
+            "    case %" PRIu32 ": goto label%" PRIu32 ";\n",
+            i, i);
+    }
+
+    fprintf(output,
+        "    default: goto label%" PRIu32 ";\n"
+        "    }\n"
+        "\n",
+        program->length);
+}
+
+static void c_write_operation(
+    FILE* output,
+    Segment program,
+    uint32_t instructionPointer,
+    bool uses[])
+{
+    struct Operation current;
+    uint32_t i = instructionPointer;
+
+    operation(&current, program->buffer[i]);
+
+    uint32_t a = current.a;
+    uint32_t b = current.b;
+    uint32_t c = current.c;
+
+    if (uses[OPCODE_LOAD])
+    {
+        fprintf(output, "label%" PRIu32 ":\n", i);
+    }
+
+    switch (current.opcode)
+    {
+    case OPCODE_CONDITIONAL_MOVE:
+        fprintf(output,
+            "    if (r%" PRIu32 ")\n"
+            "    {\n"
+            "        r%" PRIu32 " = r%" PRIu32 ";\n"
+            "    }\n",
+            c, a, b);
+        break;
+
+    case OPCODE_GET:
+        fprintf(output,
+            "    if (!r%" PRIu32 ")\n"
+            "    {\n"
+            "        if (r%" PRIu32 " >= UM32_C_LENGTH)\n"
+            "        {\n"
+            "            um32_c_fault(%" PRIu32 ", FAULT_INVALID_ADDRESS);\n"
+            "        }\n"
+            "\n"
+            "        r%" PRIu32 " = PROGRAM[r%" PRIu32 "];\n"
+            "    }\n"
+            "    else\n"
+            "    {\n"
+            "        uint32_t* index = heap_index("
+            "heap, r%" PRIu32 ", r%" PRIu32 ", NULL);\n"
+            "\n"
+            "        if (!index)\n"
+            "        {\n"
+            "            um32_c_fault(%" PRIu32 ", FAULT_INVALID_ADDRESS);\n"
+            "        }\n"
+            "\n"
+            "        r%" PRIu32 " = *index;\n"
+            "    }\n",
+            b, c, i, a, c, b, c, i, a);
+        break;
+
+    case OPCODE_SET:
+        fprintf(output,
+            "    if (!r%" PRIu32 ")\n"
+            "    {\n"
+            "        um32_c_fallback(%" PRIu32 ");\n"
+            "    }\n"
+            "    {\n"
+            "        uint32_t* index = heap_index("
+            "heap, r%" PRIu32 ", r%" PRIu32 ", NULL);\n"
+            "\n"
+            "        if (!index)\n"
+            "        {\n"
+            "            um32_c_fault(%" PRIu32 ", FAULT_INVALID_ADDRESS);\n"
+            "        }\n"
+            "\n"
+            "        *index = r%" PRIu32 ";\n"
+            "    }\n",
+            a, i, a, b, i, c);
+        break;
+
+    case OPCODE_ADD:
+        fprintf(output,
+            "    r%" PRIu32 " = r%" PRIu32 " + r%" PRIu32 ";\n",
+            a, b, c);
+        break;
+
+    case OPCODE_MULTIPLY:
+        fprintf(output,
+            "    r%" PRIu32 " = r%" PRIu32 " * r%" PRIu32 ";\n",
+            a, b, c);
+        break;
+
+    case OPCODE_DIVIDE:
+        fprintf(output,
+            "    if (!r%" PRIu32 ")\n"
+            "    {\n"
+            "        um32_c_fault(%" PRIu32 ", FAULT_DIVISION_BY_ZERO);\n"
+            "    }\n"
+            "\n"
+            "    r%" PRIu32 " = r%" PRIu32 " / r%" PRIu32 ";\n",
+            c, i, a, b, c);
+        break;
+
+    case OPCODE_NAND:
+        fprintf(output,
+            "    r%" PRIu32 " = ~(r%" PRIu32 " & r%" PRIu32 ");\n",
+            a, b, c);
+        break;
+
+    case OPCODE_HALT:
+        fprintf(output,
+            "    um32_c_fault(%" PRIu32 ", FAULT_HALTED);\n",
+            i);
+        break;
+
+    case OPCODE_ALLOCATE:
+        fprintf(output,
+            "    {\n"
+            "        uint32_t address = heap_allocate(heap, r%" PRIu32 ");\n"
+            "\n"
+            "        if (!address)\n"
+            "        {\n"
+            "            um32_c_fault(%" PRIu32 ", FAULT_OUT_OF_MEMORY);\n"
+            "        }\n"
+            "\n"
+            "        r%" PRIu32 " = address;\n"
+            "    }\n",
+            c, i, b);
+        break;
+
+    case OPCODE_FREE:
+        fprintf(output,
+            "    if (!heap_free(heap, r%" PRIu32 "))\n"
+            "    {\n"
+            "        um32_c_fault(%" PRIu32 ", FAULT_INVALID_FREE);\n"
+            "    }\n",
+            c, i);
+        break;
+
+    case OPCODE_WRITE:
+        fprintf(output,
+            "    if (r%" PRIu32 " > UINT8_MAX)\n"
+            "    {\n"
+            "        um32_c_fault(%" PRIu32 ", FAULT_INVALID_BYTE);\n"
+            "    }\n"
+            "\n"
+            "    c_write(r%" PRIu32 ");\n",
+            c, i, c);
+        break;
+
+    case OPCODE_READ:
+        fprintf(output, "    r%" PRIu32 " = c_read();\n", c);
+        break;
+
+    case OPCODE_LOAD:
+        fprintf(output,
+            "    if (r%" PRIu32 ")\n"
+            "    {\n"
+            "        um32_c_fallback(%" PRIu32 ");\n"
+            "    }\n"
+            "\n"
+            "    if (r%" PRIu32 " >= UM32_C_LENGTH)\n"
+            "    {\n"
+            "        um32_c_fault(%" PRIu32 ", "
+            "FAULT_INVALID_INSTRUCTION_POINTER);\n"
+            "    }\n"
+            "\n"
+            "    instructionPointer = r%" PRIu32 ";\n"
+            "    goto dispatch;\n",
+            b, i, c, i, c);
+        break;
+
+    case OPCODE_IMMEDIATE:
+        fprintf(output,
+            "    r%" PRIu32 " = %" PRIu32 ";\n",
+            a, current.immediate);
+
+        if (i + 1 < program->length)
+        {
+            struct Operation next;
+
+            operation(&next, program->buffer[i + 1]);
+
+            if (next.opcode == OPCODE_LOAD &&
+                next.c == a &&
+                current.immediate < program->length)
+            {
+                fprintf(output,
+                    "\n"
+                    "    if (!r%" PRIu32 ")\n"
+                    "    {\n"
+                    "        goto label%" PRIu32 ";\n"
+                    "    }\n",
+                    next.b, current.immediate);
+            }
+        }
+        break;
+
+    default:
+        fprintf(output,
+            "    um32_c_fault(%" PRIu32 ", FAULT_INVALID_INSTRUCTION);\n",
+            i);
+        break;
+    }
+
+    fprintf(output, "\n");
+}
+
+static void c_write_epilogue(FILE* output, Segment program, bool uses[])
+{
+    if (uses[OPCODE_LOAD])
+    {
+        fprintf(output, "label%" PRIu32 ":\n", program->length);
+    }
+
+    fprintf(output,
+        "    um32_c_fault(%" PRIu32 ", FAULT_TERMINATED);\n"
+        "\n"
+        "exit:\n"
+        "    um.registers[0] = r0;\n"
+        "    um.registers[1] = r1;\n"
+        "    um.registers[2] = r2;\n"
+        "    um.registers[3] = r3;\n"
+        "    um.registers[4] = r4;\n"
+        "    um.registers[5] = r5;\n"
+        "    um.registers[6] = r6;\n"
+        "    um.registers[7] = r7;\n"
+        "    um.instructionPointer = instructionPointer;\n"
+        "\n"
+        "    if (fault == FAULT_NONE)\n"
+        "    {\n"
+        "        fault = machine_run(&um, UINT64_MAX, NULL);\n"
+        "    }\n"
+        "\n"
+        "    fflush(stdout);\n"
+        "\n"
+        "    if (um32_fault_is_stopped(fault))\n"
+        "    {\n"
+        "        fprintf(stderr, \"%%s\\n\", fault_to_string(fault));\n"
+        "        finalize_machine(&um);\n"
+        "\n"
+        "        return EXIT_FAILURE;\n"
+        "    }\n"
+        "\n"
+        "    finalize_machine(&um);\n"
+        "\n"
+        "    return EXIT_SUCCESS;\n"
+        "}\n",
+        program->length);
+}
+
+static void c_write(FILE* output, char* path, Machine instance)
+{
+    Segment program = &instance->program;
+    bool uses[UM32_OPERATIONS_COUNT] = { 0 };
+
+    for (uint32_t i = 0; i < program->length; i++)
+    {
+        struct Operation current;
+
+        operation(&current, program->buffer[i]);
+
+        uses[current.opcode] = true;
+    }
+
+    c_write_prologue(output, path, program, uses);
+
+    for (uint32_t i = 0; i < program->length; i++)
+    {
+        c_write_operation(output, program, i, uses);
+    }
+
+    c_write_epilogue(output, program, uses);
+}
+
+int main(int count, char* args[])
+{
+    struct Machine um;
+    char* app = args[0];
+
+    if (count < 2)
+    {
+        fprintf(stderr, "Usage: %s FILE\n", app);
+
+        return EXIT_FAILURE;
+    }
+
+    if (!machine(&um, NULL, NULL))
+    {
+        perror(app);
+
+        return EXIT_FAILURE;
+    }
+
+    char* path = args[1];
+    FILE* input = fopen(path, "rb");
+
+    if (!input || !machine_read_program(&um, input) || fclose(input) != 0)
+    {
+        finalize_machine(&um);
+        fprintf(stderr, "%s: %s: %s\n", app, path, strerror(errno));
+
+        return EXIT_FAILURE;
+    }
+
+    c_write(stdout, path, &um);
+    finalize_machine(&um);
+
+    return EXIT_SUCCESS;
+}
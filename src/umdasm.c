@@ -4,30 +4,325 @@
 
 // http://boundvariable.org
 
+// The program is split into chunks that worker threads format into buffers of
+// their own, while the main thread writes the finished buffers in order. Only
+// a window of chunks ahead of the one being written is formatted at a time, so
+// memory stays bounded however large the image.
+
 #include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "instruction.h"
 #include "machine.h"
 #include "opcode.h"
+#define UM32_DASM_CHUNK 65536
+#define UM32_DASM_WINDOW 2
+
+struct DasmSlot
+{
+    char* buffer;
+    size_t length;
+    bool done;
+};
+
+typedef struct DasmSlot* DasmSlot;
+
+struct Dasm
+{
+    const uint32_t* words;
+    uint32_t first;
+    uint32_t end;
+    uint32_t chunks;
+    uint32_t next;
+    uint32_t written;
+    DasmSlot slots;
+    uint32_t window;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+};
+
+typedef struct Dasm* Dasm;
+
+static size_t dasm_format(
+    char buffer[],
+    const uint32_t words[],
+    uint32_t first,
+    uint32_t end)
+{
+    char* output = buffer;
+
+    for (uint32_t i = first; i < end; i++)
+    {
+        output += instruction_format_assembly(output, words[i]);
+    }
+
+    return output - buffer;
+}
 
-struct Machine um;
+static void dasm_chunk(
+    Dasm instance,
+    uint32_t chunk,
+    uint32_t* first,
+    uint32_t* end)
+{
+    *first = instance->first + chunk * UM32_DASM_CHUNK;
+    *end = instance->end - *first < UM32_DASM_CHUNK ?
+        instance->end :
+        *first + UM32_DASM_CHUNK;
+}
 
-void dasm_write(FILE* output, Machine instance)
+static void* dasm_work(void* context)
 {
-    for (uint32_t i = 0; i < instance->program.length; i++)
+    Dasm instance = context;
+
+    pthread_mutex_lock(&instance->lock);
+
+    for (;;)
     {
-        instruction_write_assembly(output, instance->program.buffer[i]);
+        // A chunk is only taken once its slot has been written out.
+
+        while (instance->next < instance->chunks &&
+            instance->next >= instance->written + instance->window)
+        {
+            pthread_cond_wait(&instance->changed, &instance->lock);
+        }
+
+        if (instance->next == instance->chunks)
+        {
+            break;
+        }
+
+        uint32_t chunk = instance->next++;
+        DasmSlot slot = instance->slots + chunk % instance->window;
+        uint32_t first;
+        uint32_t end;
+
+        pthread_mutex_unlock(&instance->lock);
+        dasm_chunk(instance, chunk, &first, &end);
+
+        slot->length = dasm_format(slot->buffer, instance->words, first, end);
+
+        pthread_mutex_lock(&instance->lock);
+
+        slot->done = true;
+
+        pthread_cond_broadcast(&instance->changed);
     }
+
+    pthread_mutex_unlock(&instance->lock);
+
+    return NULL;
+}
+
+static bool dasm_write_serial(
+    FILE* output,
+    const uint32_t words[],
+    uint32_t first,
+    uint32_t end)
+{
+    char* buffer = malloc(UM32_DASM_CHUNK * UM32_INSTRUCTION_ASSEMBLY_SIZE);
+
+    if (!buffer)
+    {
+        return false;
+    }
+
+    for (uint32_t i = first; i < end; i += UM32_DASM_CHUNK)
+    {
+        uint32_t last = end - i < UM32_DASM_CHUNK ? end : i + UM32_DASM_CHUNK;
+        size_t length = dasm_format(buffer, words, i, last);
+
+        if (fwrite(buffer, 1, length, output) != length)
+        {
+            free(buffer);
+
+            return false;
+        }
+    }
+
+    free(buffer);
+
+    return true;
+}
+
+static bool dasm_write(
+    FILE* output,
+    Machine instance,
+    uint32_t first,
+    uint32_t end,
+    uint32_t jobs)
+{
+    const uint32_t* words = instance->program.buffer;
+    struct Dasm dasm =
+    {
+        .words = words,
+        .first = first,
+        .end = end,
+        .chunks = ((uint64_t)end - first + UM32_DASM_CHUNK - 1) /
+            UM32_DASM_CHUNK
+    };
+
+    if (jobs > dasm.chunks)
+    {
+        jobs = dasm.chunks;
+    }
+
+    if (jobs < 2)
+    {
+        return dasm_write_serial(output, words, first, end);
+    }
+
+    dasm.window = jobs * UM32_DASM_WINDOW;
+    dasm.slots = calloc(dasm.window, sizeof * dasm.slots);
+
+    pthread_t* threads = calloc(jobs, sizeof * threads);
+    bool result = dasm.slots && threads;
+
+    for (uint32_t i = 0; result && i < dasm.window; i++)
+    {
+        dasm.slots[i].buffer = malloc(
+            UM32_DASM_CHUNK * UM32_INSTRUCTION_ASSEMBLY_SIZE);
+        result = dasm.slots[i].buffer;
+    }
+
+    uint32_t started = 0;
+
+    if (result)
+    {
+        pthread_mutex_init(&dasm.lock, NULL);
+        pthread_cond_init(&dasm.changed, NULL);
+
+        for (; started < jobs; started++)
+        {
+            if (pthread_create(threads + started, NULL, dasm_work, &dasm) != 0)
+            {
+                break;
+            }
+        }
+
+        // Without any worker, the chunks are formatted here instead.
+
+        if (!started)
+        {
+            result = dasm_write_serial(output, words, first, end);
+            dasm.written = dasm.chunks;
+        }
+
+        for (uint32_t i = dasm.written; i < dasm.chunks; i++)
+        {
+            DasmSlot slot = dasm.slots + i % dasm.window;
+
+            pthread_mutex_lock(&dasm.lock);
+
+            while (!slot->done)
+            {
+                pthread_cond_wait(&dasm.changed, &dasm.lock);
+            }
+
+            pthread_mutex_unlock(&dasm.lock);
+
+            if (result &&
+                fwrite(slot->buffer, 1, slot->length, output) != slot->length)
+            {
+                result = false;
+            }
+
+            pthread_mutex_lock(&dasm.lock);
+
+            slot->done = false;
+            dasm.written++;
+
+            pthread_cond_broadcast(&dasm.changed);
+            pthread_mutex_unlock(&dasm.lock);
+        }
+
+        for (uint32_t i = 0; i < started; i++)
+        {
+            pthread_join(threads[i], NULL);
+        }
+
+        pthread_cond_destroy(&dasm.changed);
+        pthread_mutex_destroy(&dasm.lock);
+    }
+
+    for (uint32_t i = 0; dasm.slots && i < dasm.window; i++)
+    {
+        free(dasm.slots[i].buffer);
+    }
+
+    free(dasm.slots);
+    free(threads);
+
+    return result;
+}
+
+static int dasm_usage(char* app)
+{
+    fprintf(stderr,
+        "Usage: %s [--jobs N] [--range FIRST LAST] FILE\n",
+        app);
+
+    return EXIT_FAILURE;
+}
+
+static bool dasm_parse(char* value, int base, uint32_t* result)
+{
+    char* end;
+    unsigned long parsed = strtoul(value, &end, base);
+
+    if (!*value || *end || parsed > UINT32_MAX)
+    {
+        return false;
+    }
+
+    *result = parsed;
+
+    return true;
 }
 
 int main(int count, char* args[])
 {
+    struct Machine um;
     char* app = args[0];
+    char* path = NULL;
+    uint32_t first = 0;
+    uint32_t last = UINT32_MAX;
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t jobs = online > 0 ? online : 1;
 
-    if (count < 2)
+    for (int i = 1; i < count; i++)
     {
-        fprintf(stderr, "Usage: %s FILE\n", app);
+        if (strcmp(args[i], "--jobs") == 0 && i + 1 < count)
+        {
+            if (!dasm_parse(args[++i], 10, &jobs) || !jobs)
+            {
+                return dasm_usage(app);
+            }
+        }
+        else if (strcmp(args[i], "--range") == 0 && i + 2 < count)
+        {
+            if (!dasm_parse(args[i + 1], 16, &first) ||
+                !dasm_parse(args[i + 2], 16, &last) ||
+                first > last)
+            {
+                return dasm_usage(app);
+            }
 
-        return EXIT_FAILURE;
+            i += 2;
+        }
+        else if (strncmp(args[i], "--", 2) == 0 || path)
+        {
+            return dasm_usage(app);
+        }
+        else
+        {
+            path = args[i];
+        }
+    }
+
+    if (!path)
+    {
+        return dasm_usage(app);
     }
 
     if (!machine(&um, NULL, NULL))
@@ -37,7 +332,6 @@ int main(int count, char* args[])
         return EXIT_FAILURE;
     }
 
-    char* path = args[1];
     FILE* input = fopen(path, "rb");
 
     if (!input ||!machine_read_program(&um, input) || fclose(input) != 0)
@@ -48,7 +342,28 @@ int main(int count, char* args[])
         return EXIT_FAILURE;
     }
 
-    dasm_write(stdout, &um);
+    // The range is inclusive and clipped to the program.
+
+    uint32_t end = um.program.length;
+
+    if (last < end)
+    {
+        end = last + 1;
+    }
+
+    if (first > end)
+    {
+        first = end;
+    }
+
+    if (!dasm_write(stdout, &um, first, end, jobs) || fflush(stdout) != 0)
+    {
+        finalize_machine(&um);
+        perror(app);
+
+        return EXIT_FAILURE;
+    }
+
     finalize_machine(&um);
 
     return EXIT_SUCCESS;
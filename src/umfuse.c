@@ -0,0 +1,273 @@
+// umfuse.c
+// Copyright (c) 2024 Ishan Pranav
+// Licensed under the MIT license.
+
+// http://boundvariable.org
+
+// Runs a program one instruction at a time and reports how often each
+// superinstruction would replace a run of dispatches, followed by the
+// straight-line opcode sequences that execute most often.
+
+#include <errno.h>
+#include <inttypes.h>
+#include "fusion.h"
+#include "instruction.h"
+#include "machine.h"
+#define UM32_FUSE_HOTTEST 10
+#define UM32_FUSE_SEQUENCES (1 << (4 * UM32_FUSION_WINDOW))
+
+struct FuseProfile
+{
+    uint64_t executed;
+    uint64_t sites[SUPERINSTRUCTIONS_COUNT];
+    uint64_t hits[SUPERINSTRUCTIONS_COUNT];
+    uint64_t sequences[UM32_FUSION_WINDOW + 1][UM32_FUSE_SEQUENCES];
+    uint32_t history;
+    uint32_t historyLength;
+    uint32_t last;
+    uint32_t pending;
+};
+
+typedef struct FuseProfile* FuseProfile;
+
+static struct FuseProfile fuseProfile;
+
+static uint8_t fuse_read()
+{
+    int result = getchar();
+
+    if (result == EOF)
+    {
+        return -1;
+    }
+
+    return result;
+}
+
+static void fuse_write(uint8_t value)
+{
+    putchar(value);
+}
+
+static void fuse_count_sites(FuseProfile instance, Segment program)
+{
+    for (uint32_t i = 0; i < program->length; i++)
+    {
+        Superinstruction superinstruction;
+
+        if (fusion_match(
+            program->buffer,
+            program->length,
+            i,
+            &superinstruction))
+        {
+            instance->sites[superinstruction]++;
+        }
+    }
+}
+
+static void fuse_observe(FuseProfile instance, Machine machine)
+{
+    uint32_t instructionPointer = machine->instructionPointer;
+    Segment program = &machine->program;
+
+    if (instructionPointer >= program->length)
+    {
+        return;
+    }
+
+    uint32_t opcode = um32_instruction_opcode(
+        program->buffer[instructionPointer]);
+    bool sequential = instance->executed &&
+        instructionPointer == instance->last + 1;
+
+    instance->executed++;
+    instance->last = instructionPointer;
+
+    // Only straight-line runs can be fused, so a jump starts a new sequence.
+
+    if (!sequential)
+    {
+        instance->historyLength = 0;
+        instance->pending = 0;
+    }
+
+    instance->history = ((instance->history << 4) | opcode) &
+        (UM32_FUSE_SEQUENCES - 1);
+
+    if (instance->historyLength < UM32_FUSION_WINDOW)
+    {
+        instance->historyLength++;
+    }
+
+    for (uint32_t n = 2; n <= instance->historyLength; n++)
+    {
+        instance->sequences[n][instance->history & ((1 << (4 * n)) - 1)]++;
+    }
+
+    if (instance->pending)
+    {
+        instance->pending--;
+
+        return;
+    }
+
+    Superinstruction superinstruction;
+
+    if (fusion_match(
+        program->buffer,
+        program->length,
+        instructionPointer,
+        &superinstruction))
+    {
+        instance->hits[superinstruction]++;
+        instance->pending = fusion_length(superinstruction) - 1;
+    }
+}
+
+static int fuse_write_sequence(FILE* output, uint32_t key, uint32_t length)
+{
+    int result = 0;
+
+    for (uint32_t i = length; i > 0; i--)
+    {
+        Opcode opcode = (key >> (4 * (i - 1))) & 0xf;
+
+        result += fprintf(
+            output,
+            "%s%s",
+            opcode_to_string(opcode),
+            i > 1 ? " " : "");
+    }
+
+    return result;
+}
+
+static void fuse_report(FILE* output, FuseProfile instance)
+{
+    double executed = instance->executed ? instance->executed : 1;
+
+    fprintf(output,
+        "%-16s %8s %14s %14s %8s\n",
+        "Superinstruction", "Sites", "Executed", "Saved", "Share");
+
+    for (Superinstruction superinstruction = 0;
+        superinstruction < SUPERINSTRUCTIONS_COUNT;
+        superinstruction++)
+    {
+        uint64_t hits = instance->hits[superinstruction];
+        uint64_t saved = hits * (fusion_length(superinstruction) - 1);
+
+        fprintf(output,
+            "%-16s %8" PRIu64 " %14" PRIu64 " %14" PRIu64 " %7.2lf%%\n",
+            superinstruction_to_string(superinstruction),
+            instance->sites[superinstruction],
+            hits,
+            saved,
+            saved * 100.0 / executed);
+    }
+
+    fprintf(output,
+        "\n%-32s %14s %8s\n", "Sequence", "Executed", "Share");
+
+    // Rank sequences by the dispatches that fusing them would remove. Each
+    // reported sequence is cleared so that the next pass finds the runner-up.
+
+    for (int rank = 0; rank < UM32_FUSE_HOTTEST; rank++)
+    {
+        uint64_t best = 0;
+        uint32_t bestLength = 0;
+        uint32_t bestKey = 0;
+
+        for (uint32_t n = 2; n <= UM32_FUSION_WINDOW; n++)
+        {
+            for (uint32_t key = 0; key < (1u << (4 * n)); key++)
+            {
+                uint64_t saved = instance->sequences[n][key] * (n - 1);
+
+                if (saved > best)
+                {
+                    best = saved;
+                    bestLength = n;
+                    bestKey = key;
+                }
+            }
+        }
+
+        if (!best)
+        {
+            break;
+        }
+
+        uint64_t count = instance->sequences[bestLength][bestKey];
+        int written = fuse_write_sequence(output, bestKey, bestLength);
+
+        instance->sequences[bestLength][bestKey] = 0;
+
+        fprintf(output,
+            "%*s %14" PRIu64 " %7.2lf%%\n",
+            32 - written, "",
+            count,
+            count * 100.0 / executed);
+    }
+}
+
+int main(int count, char* args[])
+{
+    struct Machine um;
+    char* app = args[0];
+
+    if (count != 2)
+    {
+        fprintf(stderr, "Usage: %s FILE\n", app);
+
+        return EXIT_FAILURE;
+    }
+
+    if (!machine(&um, fuse_read, fuse_write))
+    {
+        fprintf(stderr, "%s: %s\n", app, strerror(errno));
+
+        return EXIT_FAILURE;
+    }
+
+    char* path = args[1];
+    FILE* input = fopen(path, "rb");
+
+    if (!input || !machine_read_program(&um, input) || fclose(input) != 0)
+    {
+        finalize_machine(&um);
+        fprintf(stderr, "%s: %s: %s\n", app, path, strerror(errno));
+
+        return EXIT_FAILURE;
+    }
+
+    fuse_count_sites(&fuseProfile, &um.program);
+
+    Fault fault;
+
+    do
+    {
+        fuse_observe(&fuseProfile, &um);
+
+        fault = machine_run(&um, 1, NULL);
+    }
+    while (!fault);
+
+    fflush(stdout);
+
+    if (um32_fault_is_stopped(fault))
+    {
+        fprintf(stderr, "%s: %s\n", path, fault_to_string(fault));
+    }
+
+    fuse_report(stderr, &fuseProfile);
+    finalize_machine(&um);
+
+    if (um32_fault_is_stopped(fault))
+    {
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
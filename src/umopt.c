@@ -0,0 +1,1027 @@
+// umopt.c
+// Copyright (c) 2024 Ishan Pranav
+// Licensed under the MIT license.
+
+// http://boundvariable.org
+
+// Rewrites a program so that it does the same work in fewer dispatches. The
+// analysis follows control flow from the first instruction, tracking what is
+// known about each register, and recovers basic blocks from the targets of
+// jumps through array 0. Constant results become `li`, writes that are never
+// read become no-ops, and the surviving instructions of each block are moved
+// to its start, so that no instruction that can be entered ever changes
+// position. A program that may jump to a computed address, write to array 0,
+// read its code through a register that is not known, or load another array
+// is written back unchanged.
+
+#include <errno.h>
+#include <inttypes.h>
+#include "instruction.h"
+#include "machine.h"
+#define UM32_OPT_REGISTERS 8
+#define UM32_OPT_IMMEDIATE 0x01ffffff
+#define UM32_OPT_REACHED 0x1
+#define UM32_OPT_LEADER 0x2
+#define UM32_OPT_PINNED 0x4
+#define UM32_OPT_QUEUED 0x8
+
+enum OptValueKind
+{
+    OPT_VALUE_UNDEFINED,
+    OPT_VALUE_CONSTANT,
+    OPT_VALUE_PAIR,
+    OPT_VALUE_NONZERO,
+    OPT_VALUE_UNKNOWN
+};
+
+typedef enum OptValueKind OptValueKind;
+
+struct OptValue
+{
+    OptValueKind kind;
+    uint32_t first;
+    uint32_t second;
+};
+
+struct OptState
+{
+    struct OptValue registers[UM32_OPT_REGISTERS];
+};
+
+typedef struct OptState* OptState;
+
+struct Optimizer
+{
+    uint32_t* words;
+    uint32_t length;
+    OptState states;
+    uint8_t* flags;
+    uint8_t* live;
+    uint32_t* worklist;
+    uint32_t pending;
+    bool trusted;
+    const char* reason;
+    uint32_t offset;
+    uint32_t folded;
+    uint32_t removed;
+    uint32_t blocks;
+    uint32_t saved;
+};
+
+typedef struct Optimizer* Optimizer;
+
+static struct OptValue opt_constant(uint32_t value)
+{
+    struct OptValue result =
+    {
+        .kind = OPT_VALUE_CONSTANT,
+        .first = value,
+        .second = value
+    };
+
+    return result;
+}
+
+static struct OptValue opt_value(OptValueKind kind)
+{
+    struct OptValue result =
+    {
+        .kind = kind
+    };
+
+    return result;
+}
+
+static bool opt_is_constant(struct OptValue value, uint32_t constant)
+{
+    return value.kind == OPT_VALUE_CONSTANT && value.first == constant;
+}
+
+static bool opt_is_nonzero(struct OptValue value)
+{
+    switch (value.kind)
+    {
+    case OPT_VALUE_CONSTANT:
+    case OPT_VALUE_PAIR:
+        return value.first && value.second;
+
+    case OPT_VALUE_NONZERO:
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+static bool opt_equals(struct OptValue left, struct OptValue right)
+{
+    return left.kind == right.kind &&
+        left.first == right.first &&
+        left.second == right.second;
+}
+
+// A constant is stored with itself as its second value, so that a constant and
+// a pair can be merged as sets of at most two values.
+
+static struct OptValue opt_union(struct OptValue left, struct OptValue right)
+{
+    if (left.kind == OPT_VALUE_UNDEFINED)
+    {
+        return right;
+    }
+
+    if (right.kind == OPT_VALUE_UNDEFINED || opt_equals(left, right))
+    {
+        return left;
+    }
+
+    if (left.kind == OPT_VALUE_UNKNOWN || right.kind == OPT_VALUE_UNKNOWN)
+    {
+        return opt_value(OPT_VALUE_UNKNOWN);
+    }
+
+    if (left.kind != OPT_VALUE_NONZERO && right.kind != OPT_VALUE_NONZERO)
+    {
+        uint32_t values[] =
+        {
+            left.first, left.second, right.first, right.second
+        };
+        uint32_t count = 0;
+
+        for (int i = 0; i < 4; i++)
+        {
+            int j = 0;
+
+            while (j < i && values[j] != values[i])
+            {
+                j++;
+            }
+
+            if (j == i)
+            {
+                values[count++] = values[i];
+            }
+        }
+
+        if (count <= 2)
+        {
+            struct OptValue result =
+            {
+                .kind = count == 1 ? OPT_VALUE_CONSTANT : OPT_VALUE_PAIR,
+                .first = values[0] < values[1] ? values[0] : values[1],
+                .second = values[0] < values[1] ? values[1] : values[0]
+            };
+
+            if (count == 1)
+            {
+                result.second = result.first;
+            }
+
+            return result;
+        }
+    }
+
+    if (opt_is_nonzero(left) && opt_is_nonzero(right))
+    {
+        return opt_value(OPT_VALUE_NONZERO);
+    }
+
+    return opt_value(OPT_VALUE_UNKNOWN);
+}
+
+static struct OptValue opt_arithmetic(
+    Opcode opcode,
+    struct OptValue left,
+    struct OptValue right)
+{
+    if (left.kind != OPT_VALUE_CONSTANT || right.kind != OPT_VALUE_CONSTANT)
+    {
+        return opt_value(OPT_VALUE_UNKNOWN);
+    }
+
+    uint32_t b = left.first;
+    uint32_t c = right.first;
+
+    switch (opcode)
+    {
+    case OPCODE_ADD:
+        return opt_constant(b + c);
+
+    case OPCODE_MULTIPLY:
+        return opt_constant(b * c);
+
+    case OPCODE_DIVIDE:
+        return opt_constant(b / c);
+
+    default:
+        return opt_constant(~(b & c));
+    }
+}
+
+static bool opt_is_nop(uint32_t word)
+{
+    return um32_instruction_opcode(word) == OPCODE_CONDITIONAL_MOVE &&
+        um32_instruction_operand_a(word) == um32_instruction_operand_b(word);
+}
+
+static bool opt_fail(Optimizer instance, uint32_t offset, const char* reason)
+{
+    instance->reason = reason;
+    instance->offset = offset;
+
+    return false;
+}
+
+static void opt_add_successor(
+    Optimizer instance,
+    uint32_t successors[],
+    uint32_t* count,
+    uint32_t offset)
+{
+    if (offset < instance->length &&
+        (!*count || successors[*count - 1] != offset))
+    {
+        successors[(*count)++] = offset;
+    }
+}
+
+// Applies one instruction to a copy of its entry state and lists the offsets
+// that may run next. Returns false if the instruction hides control flow or
+// code from the analysis.
+
+static bool opt_step(
+    Optimizer instance,
+    uint32_t offset,
+    OptState state,
+    uint32_t successors[],
+    uint32_t* count)
+{
+    uint32_t word = instance->words[offset];
+    struct OptValue* r = state->registers;
+    uint32_t a = um32_instruction_operand_a(word);
+    uint32_t b = um32_instruction_operand_b(word);
+    uint32_t c = um32_instruction_operand_c(word);
+
+    *count = 0;
+
+    switch (um32_instruction_opcode(word))
+    {
+    case OPCODE_CONDITIONAL_MOVE:
+        if (opt_is_nonzero(r[c]))
+        {
+            r[a] = r[b];
+        }
+        else if (!opt_is_constant(r[c], 0))
+        {
+            r[a] = opt_union(r[a], r[b]);
+        }
+        break;
+
+    case OPCODE_GET:
+        if (r[b].kind == OPT_VALUE_CONSTANT && !r[b].first)
+        {
+            // Words of array 0 that are read as data keep their contents.
+
+            if (r[c].kind != OPT_VALUE_CONSTANT && r[c].kind != OPT_VALUE_PAIR)
+            {
+                return opt_fail(instance, offset, "reads code at a computed offset");
+            }
+
+            if (r[c].first < instance->length)
+            {
+                instance->flags[r[c].first] |= UM32_OPT_PINNED;
+            }
+
+            if (r[c].second < instance->length)
+            {
+                instance->flags[r[c].second] |= UM32_OPT_PINNED;
+            }
+        }
+        else if (!opt_is_nonzero(r[b]) &&
+            (!instance->trusted || r[b].kind != OPT_VALUE_UNKNOWN))
+        {
+            return opt_fail(instance, offset, "may read code");
+        }
+
+        r[a] = opt_value(OPT_VALUE_UNKNOWN);
+        break;
+
+    case OPCODE_SET:
+        if (!opt_is_nonzero(r[a]) &&
+            (!instance->trusted || r[a].kind != OPT_VALUE_UNKNOWN))
+        {
+            return opt_fail(instance, offset, "may modify code");
+        }
+        break;
+
+    case OPCODE_ADD:
+    case OPCODE_MULTIPLY:
+    case OPCODE_NAND:
+        r[a] = opt_arithmetic(um32_instruction_opcode(word), r[b], r[c]);
+        break;
+
+    case OPCODE_DIVIDE:
+        if (opt_is_constant(r[c], 0))
+        {
+            return true;
+        }
+
+        r[a] = opt_arithmetic(OPCODE_DIVIDE, r[b], r[c]);
+        break;
+
+    case OPCODE_HALT:
+        return true;
+
+    case OPCODE_ALLOCATE:
+        r[b] = opt_value(OPT_VALUE_NONZERO);
+        break;
+
+    case OPCODE_FREE:
+    case OPCODE_WRITE:
+        break;
+
+    case OPCODE_READ:
+        r[c] = opt_value(OPT_VALUE_UNKNOWN);
+        break;
+
+    case OPCODE_LOAD:
+        if (!opt_is_constant(r[b], 0))
+        {
+            return opt_fail(instance, offset, "may load another array");
+        }
+
+        if (r[c].kind != OPT_VALUE_CONSTANT && r[c].kind != OPT_VALUE_PAIR)
+        {
+            return opt_fail(instance, offset, "jumps to a computed offset");
+        }
+
+        opt_add_successor(instance, successors, count, r[c].first);
+        opt_add_successor(instance, successors, count, r[c].second);
+
+        for (uint32_t i = 0; i < *count; i++)
+        {
+            instance->flags[successors[i]] |= UM32_OPT_LEADER;
+        }
+
+        return true;
+
+    case OPCODE_IMMEDIATE:
+        r[um32_instruction_immediate_register(word)] =
+            opt_constant(um32_instruction_immediate_value(word));
+        break;
+
+    default:
+        return true;
+    }
+
+    opt_add_successor(instance, successors, count, offset + 1);
+
+    return true;
+}
+
+static void opt_enqueue(Optimizer instance, uint32_t offset)
+{
+    if (!(instance->flags[offset] & UM32_OPT_QUEUED))
+    {
+        instance->flags[offset] |= UM32_OPT_QUEUED;
+        instance->worklist[instance->pending++] = offset;
+    }
+}
+
+static bool opt_analyze(Optimizer instance)
+{
+    // Every register starts at zero.
+
+    for (int i = 0; i < UM32_OPT_REGISTERS; i++)
+    {
+        instance->states[0].registers[i] = opt_constant(0);
+    }
+
+    instance->flags[0] |= UM32_OPT_REACHED | UM32_OPT_LEADER;
+
+    opt_enqueue(instance, 0);
+
+    while (instance->pending)
+    {
+        uint32_t offset = instance->worklist[--instance->pending];
+        struct OptState state = instance->states[offset];
+        uint32_t successors[2];
+        uint32_t count;
+
+        instance->flags[offset] &= ~UM32_OPT_QUEUED;
+
+        if (!opt_step(instance, offset, &state, successors, &count))
+        {
+            return false;
+        }
+
+        for (uint32_t i = 0; i < count; i++)
+        {
+            OptState next = instance->states + successors[i];
+            bool changed = !(instance->flags[successors[i]] &
+                UM32_OPT_REACHED);
+
+            instance->flags[successors[i]] |= UM32_OPT_REACHED;
+
+            for (int j = 0; j < UM32_OPT_REGISTERS; j++)
+            {
+                struct OptValue value = opt_union(
+                    next->registers[j],
+                    state.registers[j]);
+
+                if (!opt_equals(value, next->registers[j]))
+                {
+                    next->registers[j] = value;
+                    changed = true;
+                }
+            }
+
+            if (changed)
+            {
+                opt_enqueue(instance, successors[i]);
+            }
+        }
+    }
+
+    return true;
+}
+
+static bool opt_is_rewritable(Optimizer instance, uint32_t offset)
+{
+    return (instance->flags[offset] & UM32_OPT_REACHED) &&
+        !(instance->flags[offset] & UM32_OPT_PINNED);
+}
+
+// Replaces instructions whose result is known with `li`, and conditional moves
+// and jumps that cannot change anything with no-ops.
+
+static void opt_fold(Optimizer instance)
+{
+    for (uint32_t i = 0; i < instance->length; i++)
+    {
+        if (!opt_is_rewritable(instance, i))
+        {
+            continue;
+        }
+
+        uint32_t word = instance->words[i];
+        struct OptValue* r = instance->states[i].registers;
+        struct OptState state = instance->states[i];
+        uint32_t a = um32_instruction_operand_a(word);
+        uint32_t successors[2];
+        uint32_t count;
+
+        switch (um32_instruction_opcode(word))
+        {
+        case OPCODE_CONDITIONAL_MOVE:
+            if (opt_is_nop(word))
+            {
+                continue;
+            }
+
+            if (opt_is_constant(r[um32_instruction_operand_c(word)], 0))
+            {
+                instance->words[i] = 0;
+                instance->folded++;
+
+                continue;
+            }
+            break;
+
+        case OPCODE_ADD:
+        case OPCODE_MULTIPLY:
+        case OPCODE_DIVIDE:
+        case OPCODE_NAND:
+            break;
+
+        case OPCODE_LOAD:
+            opt_step(instance, i, &state, successors, &count);
+
+            if (r[um32_instruction_operand_c(word)].kind ==
+                OPT_VALUE_CONSTANT && count == 1 && successors[0] == i + 1)
+            {
+                instance->words[i] = 0;
+                instance->folded++;
+            }
+
+            continue;
+
+        default:
+            continue;
+        }
+
+        opt_step(instance, i, &state, successors, &count);
+
+        if (count && state.registers[a].kind == OPT_VALUE_CONSTANT &&
+            state.registers[a].first <= UM32_OPT_IMMEDIATE)
+        {
+            instance->words[i] = um32_instruction_from_immediate(
+                OPCODE_IMMEDIATE,
+                a,
+                state.registers[a].first);
+            instance->folded++;
+        }
+    }
+}
+
+// Lists the registers that an instruction reads and the registers it always
+// writes, given the state on entry.
+
+static void opt_registers(
+    Optimizer instance,
+    uint32_t offset,
+    uint8_t* uses,
+    uint8_t* defines)
+{
+    uint32_t word = instance->words[offset];
+    struct OptValue* r = instance->states[offset].registers;
+    uint32_t a = um32_instruction_operand_a(word);
+    uint32_t b = um32_instruction_operand_b(word);
+    uint32_t c = um32_instruction_operand_c(word);
+
+    *uses = 0;
+    *defines = 0;
+
+    switch (um32_instruction_opcode(word))
+    {
+    case OPCODE_CONDITIONAL_MOVE:
+        if (opt_is_nop(word) || opt_is_constant(r[c], 0))
+        {
+            break;
+        }
+
+        *uses = (1 << b) | (1 << c);
+
+        if (opt_is_nonzero(r[c]))
+        {
+            *defines = 1 << a;
+        }
+        else
+        {
+            *uses |= 1 << a;
+        }
+        break;
+
+    case OPCODE_GET:
+    case OPCODE_ADD:
+    case OPCODE_MULTIPLY:
+    case OPCODE_DIVIDE:
+    case OPCODE_NAND:
+        *uses = (1 << b) | (1 << c);
+        *defines = 1 << a;
+        break;
+
+    case OPCODE_SET:
+        *uses = (1 << a) | (1 << b) | (1 << c);
+        break;
+
+    case OPCODE_ALLOCATE:
+        *uses = 1 << c;
+        *defines = 1 << b;
+        break;
+
+    case OPCODE_FREE:
+    case OPCODE_WRITE:
+        *uses = 1 << c;
+        break;
+
+    case OPCODE_READ:
+        *defines = 1 << c;
+        break;
+
+    case OPCODE_LOAD:
+        *uses = (1 << b) | (1 << c);
+        break;
+
+    case OPCODE_IMMEDIATE:
+        *defines = 1 << um32_instruction_immediate_register(word);
+        break;
+    }
+}
+
+static void opt_liveness(Optimizer instance)
+{
+    bool changed = true;
+
+    memset(instance->live, 0, instance->length);
+
+    // Iterate backwards to a fixed point; loops settle in a few passes.
+
+    while (changed)
+    {
+        changed = false;
+
+        for (uint32_t i = instance->length; i-- > 0;)
+        {
+            if (!(instance->flags[i] & UM32_OPT_REACHED))
+            {
+                continue;
+            }
+
+            struct OptState state = instance->states[i];
+            uint32_t successors[2];
+            uint32_t count;
+            uint8_t live = 0;
+
+            opt_step(instance, i, &state, successors, &count);
+
+            for (uint32_t j = 0; j < count; j++)
+            {
+                uint8_t uses;
+                uint8_t defines;
+
+                opt_registers(instance, successors[j], &uses, &defines);
+
+                live |= (instance->live[successors[j]] & ~defines) | uses;
+            }
+
+            if (live != instance->live[i])
+            {
+                instance->live[i] = live;
+                changed = true;
+            }
+        }
+    }
+}
+
+// Replaces writes that no later instruction reads with no-ops. Instructions
+// that may fault or that touch the heap or the streams are kept.
+
+static bool opt_remove_dead(Optimizer instance)
+{
+    bool removed = false;
+
+    for (uint32_t i = 0; i < instance->length; i++)
+    {
+        if (!opt_is_rewritable(instance, i))
+        {
+            continue;
+        }
+
+        uint32_t word = instance->words[i];
+        struct OptValue* r = instance->states[i].registers;
+        uint32_t target = um32_instruction_operand_a(word);
+
+        switch (um32_instruction_opcode(word))
+        {
+        case OPCODE_CONDITIONAL_MOVE:
+            if (opt_is_nop(word))
+            {
+                continue;
+            }
+            break;
+
+        case OPCODE_DIVIDE:
+            if (!opt_is_nonzero(r[um32_instruction_operand_c(word)]))
+            {
+                continue;
+            }
+            break;
+
+        case OPCODE_ADD:
+        case OPCODE_MULTIPLY:
+        case OPCODE_NAND:
+            break;
+
+        case OPCODE_IMMEDIATE:
+            target = um32_instruction_immediate_register(word);
+            break;
+
+        default:
+            continue;
+        }
+
+        if (!(instance->live[i] & (1 << target)))
+        {
+            instance->words[i] = 0;
+            instance->removed++;
+            removed = true;
+        }
+    }
+
+    return removed;
+}
+
+static bool opt_falls_through(Optimizer instance, uint32_t offset)
+{
+    struct OptState state = instance->states[offset];
+    uint32_t successors[2];
+    uint32_t count;
+    uint32_t opcode = um32_instruction_opcode(instance->words[offset]);
+
+    if (opcode == OPCODE_LOAD || opcode == OPCODE_HALT)
+    {
+        return false;
+    }
+
+    opt_step(instance, offset, &state, successors, &count);
+
+    return count == 1 && successors[0] == offset + 1;
+}
+
+// Finds a register for the target of a jump out of a block and one that holds
+// zero, both free after the last instruction of the block. Returns the number
+// of instructions the jump takes, or zero if there are no such registers.
+
+static uint32_t opt_jump(
+    Optimizer instance,
+    uint32_t last,
+    uint32_t* target,
+    uint32_t* zero)
+{
+    struct OptState state = instance->states[last];
+    uint32_t successors[2];
+    uint32_t count;
+    uint8_t live = instance->live[last];
+    int free[2];
+    int frees = 0;
+
+    opt_step(instance, last, &state, successors, &count);
+
+    *zero = UM32_OPT_REGISTERS;
+
+    for (int i = 0; i < UM32_OPT_REGISTERS; i++)
+    {
+        if (!(live & (1 << i)))
+        {
+            if (frees < 2)
+            {
+                free[frees++] = i;
+            }
+        }
+        else if (opt_is_constant(state.registers[i], 0))
+        {
+            *zero = i;
+        }
+    }
+
+    if (!frees)
+    {
+        return 0;
+    }
+
+    *target = free[0];
+
+    if (*zero != UM32_OPT_REGISTERS)
+    {
+        return 2;
+    }
+
+    if (frees < 2)
+    {
+        return 0;
+    }
+
+    *zero = free[1];
+
+    return 3;
+}
+
+static void opt_compact_block(Optimizer instance, uint32_t start, uint32_t end)
+{
+    uint32_t kept = 0;
+
+    for (uint32_t i = start; i < end; i++)
+    {
+        if (instance->flags[i] & UM32_OPT_PINNED)
+        {
+            return;
+        }
+
+        if (!opt_is_nop(instance->words[i]))
+        {
+            kept++;
+        }
+    }
+
+    uint32_t extra = 0;
+    uint32_t target = 0;
+    uint32_t zero = 0;
+
+    if (opt_falls_through(instance, end - 1))
+    {
+        // A block that runs into the next one now ends with a jump to it.
+
+        if (end > UM32_OPT_IMMEDIATE)
+        {
+            return;
+        }
+
+        extra = opt_jump(instance, end - 1, &target, &zero);
+
+        if (!extra)
+        {
+            return;
+        }
+    }
+
+    if (kept + extra >= end - start)
+    {
+        return;
+    }
+
+    uint32_t next = start;
+
+    for (uint32_t i = start; i < end; i++)
+    {
+        if (!opt_is_nop(instance->words[i]))
+        {
+            instance->words[next++] = instance->words[i];
+        }
+    }
+
+    if (extra == 3)
+    {
+        instance->words[next++] = um32_instruction_from_immediate(
+            OPCODE_IMMEDIATE,
+            zero,
+            0);
+    }
+
+    if (extra)
+    {
+        instance->words[next++] = um32_instruction_from_immediate(
+            OPCODE_IMMEDIATE,
+            target,
+            end);
+        instance->words[next++] = um32_instruction(
+            OPCODE_LOAD,
+            0,
+            zero,
+            target);
+    }
+
+    instance->blocks++;
+    instance->saved += end - next;
+
+    while (next < end)
+    {
+        instance->words[next++] = 0;
+    }
+}
+
+// Moves the instructions that remain in each basic block to its start. Only
+// the first instruction of a block is ever entered, so the rest of its slots
+// are free once it is compacted.
+
+static void opt_compact(Optimizer instance)
+{
+    uint32_t i = 0;
+
+    while (i < instance->length)
+    {
+        if (!(instance->flags[i] & UM32_OPT_REACHED))
+        {
+            i++;
+
+            continue;
+        }
+
+        uint32_t start = i++;
+
+        while (i < instance->length &&
+            (instance->flags[i] & UM32_OPT_REACHED) &&
+            !(instance->flags[i] & UM32_OPT_LEADER) &&
+            opt_falls_through(instance, i - 1))
+        {
+            i++;
+        }
+
+        opt_compact_block(instance, start, i);
+    }
+}
+
+static bool optimizer(Optimizer instance, Segment program, bool trusted)
+{
+    uint32_t length = program->length ? program->length : 1;
+
+    instance->words = program->buffer;
+    instance->length = program->length;
+    instance->trusted = trusted;
+    instance->pending = 0;
+    instance->reason = NULL;
+    instance->folded = 0;
+    instance->removed = 0;
+    instance->blocks = 0;
+    instance->saved = 0;
+    instance->states = calloc(length, sizeof * instance->states);
+    instance->flags = calloc(length, sizeof * instance->flags);
+    instance->live = calloc(length, sizeof * instance->live);
+    instance->worklist = malloc(length * sizeof * instance->worklist);
+
+    return instance->states && instance->flags && instance->live &&
+        instance->worklist;
+}
+
+static void finalize_optimizer(Optimizer instance)
+{
+    free(instance->states);
+    free(instance->flags);
+    free(instance->live);
+    free(instance->worklist);
+
+    instance->states = NULL;
+    instance->flags = NULL;
+    instance->live = NULL;
+    instance->worklist = NULL;
+}
+
+static void opt_run(Optimizer instance)
+{
+    if (!instance->length || !opt_analyze(instance))
+    {
+        return;
+    }
+
+    opt_fold(instance);
+
+    // Removing a write can leave the writes that fed it unread.
+
+    do
+    {
+        opt_liveness(instance);
+    }
+    while (opt_remove_dead(instance));
+
+    opt_compact(instance);
+}
+
+int main(int count, char* args[])
+{
+    struct Machine um;
+    struct Optimizer opt;
+    char* app = args[0];
+    bool trusted = count == 4 && strcmp(args[1], "--trusted") == 0;
+
+    if (count != 3 + trusted)
+    {
+        fprintf(stderr, "Usage: %s [--trusted] INPUT OUTPUT\n", app);
+
+        return EXIT_FAILURE;
+    }
+
+    if (!machine(&um, NULL, NULL))
+    {
+        perror(app);
+
+        return EXIT_FAILURE;
+    }
+
+    char* path = args[1 + trusted];
+    FILE* input = fopen(path, "rb");
+
+    if (!input || !machine_read_program(&um, input) || fclose(input) != 0)
+    {
+        finalize_machine(&um);
+        fprintf(stderr, "%s: %s: %s\n", app, path, strerror(errno));
+
+        return EXIT_FAILURE;
+    }
+
+    if (!optimizer(&opt, &um.program, trusted))
+    {
+        perror(app);
+        finalize_optimizer(&opt);
+        finalize_machine(&um);
+
+        return EXIT_FAILURE;
+    }
+
+    opt_run(&opt);
+
+    if (opt.reason)
+    {
+        fprintf(stderr,
+            "%s: %s: unchanged: %08" PRIx32 " %s\n",
+            app, path, opt.offset, opt.reason);
+    }
+    else
+    {
+        fprintf(stderr,
+            "%s: %s: %" PRIu32 " folded, %" PRIu32 " removed, "
+            "%" PRIu32 " blocks compacted, %" PRIu32 " dispatches saved\n",
+            app, path,
+            opt.folded,
+            opt.removed,
+            opt.blocks,
+            opt.saved);
+    }
+
+    finalize_optimizer(&opt);
+
+    path = args[2 + trusted];
+
+    FILE* output = fopen(path, "wb");
+
+    if (!output || !machine_write_program(output, &um) || fclose(output) != 0)
+    {
+        finalize_machine(&um);
+        fprintf(stderr, "%s: %s: %s\n", app, path, strerror(errno));
+
+        return EXIT_FAILURE;
+    }
+
+    finalize_machine(&um);
+
+    return EXIT_SUCCESS;
+}
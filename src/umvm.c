@@ -6,199 +6,1784 @@
 
 #include <errno.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <signal.h>
+#include <stdatomic.h>
+#include <sys/time.h>
+#include <unistd.h>
 #include "instruction.h"
 #include "machine.h"
+#include "sampler.h"
 #define UM32_VM_MAX_DUMP 16
+#define UM32_VM_LINE 4096
+#define UM32_VM_JOBS 16
+#define UM32_VM_SLICE 65536
+#define UM32_VM_SEED 0x9e3779b9u
+#define UM32_VM_RING 65536
+#define UM32_VM_FOLDED "umvm.folded"
 #define UM32_VM_DEBUG
 
-struct Machine um;
+struct VmOptions
+{
+    Engine engine;
+    HeapMode mode;
+    uint32_t threshold;
+    bool huge;
+    bool trusted;
+    bool fused;
+    bool profiled;
+    bool heapStats;
+    uint32_t timeline;
+    uint32_t frequency;
+    char* folded;
+    bool async;
+};
+
+typedef struct VmOptions* VmOptions;
+
+struct VmSample
+{
+    uint64_t executed;
+    uint64_t size;
+    uint64_t arrays;
+    uint64_t words;
+    uint64_t freeWords;
+};
+
+struct VmTimeline
+{
+    struct VmSample* samples;
+    uint32_t count;
+    uint32_t capacity;
+    uint64_t executed;
+};
+
+typedef struct VmTimeline* VmTimeline;
+
+struct VmJob
+{
+    char* program;
+    char* input;
+    char* output;
+    FILE* stream;
+    uint8_t* buffer;
+    size_t length;
+    size_t capacity;
+    Fault fault;
+    int error;
+    bool done;
+};
+
+typedef struct VmJob* VmJob;
+
+struct VmQueue
+{
+    pthread_mutex_t lock;
+    uint32_t begin;
+    uint32_t end;
+};
+
+typedef struct VmQueue* VmQueue;
+
+struct VmBatch
+{
+    VmOptions options;
+    VmJob jobs;
+    uint32_t count;
+    VmQueue queues;
+    uint32_t workers;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+};
+
+typedef struct VmBatch* VmBatch;
+
+struct VmWorker
+{
+    VmBatch batch;
+    uint32_t index;
+    pthread_t thread;
+};
+
+typedef struct VmWorker* VmWorker;
+
+struct VmRing
+{
+    uint8_t* buffer;
+    _Atomic uint32_t head;
+    _Atomic uint32_t tail;
+    atomic_bool closed;
+    atomic_bool producerWaiting;
+    atomic_bool consumerWaiting;
+    sem_t space;
+    sem_t data;
+};
+
+typedef struct VmRing* VmRing;
+
+struct VmAsync
+{
+    struct VmRing output;
+    struct VmRing input;
+    pthread_t writer;
+    pthread_t reader;
+    sem_t drained;
+    bool suspends;
+    bool running;
+};
+
+typedef struct VmAsync* VmAsync;
+
+static Machine vm_current;
+static VmAsync vm_pipeline;
+static atomic_uint vm_ticks;
+
+static uint32_t vm_read(void* context, uint8_t buffer[], uint32_t length)
+{
+    bool* suspends = context;
+    ssize_t result;
+
+    fflush(stdout);
+
+    do
+    {
+        result = read(STDIN_FILENO, buffer, length);
+    }
+    while (result < 0 && errno == EINTR);
+
+    if (result < 0)
+    {
+        return 0;
+    }
+
+    // When saving, the machine stops at the end of the input instead of
+    // reading past it.
+
+    if (!result && *suspends)
+    {
+        return UM32_READER_SUSPEND;
+    }
+
+    return result;
+}
+
+static void vm_write(void* context, const uint8_t buffer[], uint32_t length)
+{
+    (void)context;
+
+    fwrite(buffer, sizeof * buffer, length, stdout);
+}
+
+// A ring has one producer and one consumer, which only exchange the head and
+// tail indices. A side that finds the ring full or empty flags itself as
+// waiting and sleeps on a semaphore, which the other side posts after it next
+// moves its index. Posting a semaphore is safe from a signal handler, so the
+// interrupt handler can flush through the ring.
+
+static bool vm_ring(VmRing instance)
+{
+    instance->buffer = malloc(UM32_VM_RING);
+
+    if (!instance->buffer)
+    {
+        return false;
+    }
+
+    atomic_init(&instance->head, 0);
+    atomic_init(&instance->tail, 0);
+    atomic_init(&instance->closed, false);
+    atomic_init(&instance->producerWaiting, false);
+    atomic_init(&instance->consumerWaiting, false);
+
+    if (sem_init(&instance->space, 0, 0) != 0)
+    {
+        free(instance->buffer);
+
+        return false;
+    }
+
+    if (sem_init(&instance->data, 0, 0) != 0)
+    {
+        sem_destroy(&instance->space);
+        free(instance->buffer);
+
+        return false;
+    }
+
+    return true;
+}
+
+static void finalize_vm_ring(VmRing instance)
+{
+    sem_destroy(&instance->space);
+    sem_destroy(&instance->data);
+    free(instance->buffer);
+
+    instance->buffer = NULL;
+}
+
+static uint32_t vm_ring_readable(VmRing instance, uint32_t* offset)
+{
+    uint32_t tail = atomic_load(&instance->tail);
+    uint32_t length = atomic_load(&instance->head) - tail;
+
+    *offset = tail % UM32_VM_RING;
+
+    // Only the contiguous part up to the end of the buffer is returned.
+
+    if (length > UM32_VM_RING - *offset)
+    {
+        length = UM32_VM_RING - *offset;
+    }
+
+    return length;
+}
+
+static uint32_t vm_ring_writable(VmRing instance, uint32_t* offset)
+{
+    uint32_t head = atomic_load(&instance->head);
+    uint32_t length = UM32_VM_RING - (head - atomic_load(&instance->tail));
+
+    *offset = head % UM32_VM_RING;
+
+    if (length > UM32_VM_RING - *offset)
+    {
+        length = UM32_VM_RING - *offset;
+    }
+
+    return length;
+}
+
+static void vm_ring_produce(VmRing instance, uint32_t length)
+{
+    atomic_fetch_add(&instance->head, length);
+
+    if (atomic_exchange(&instance->consumerWaiting, false))
+    {
+        sem_post(&instance->data);
+    }
+}
+
+static void vm_ring_consume(VmRing instance, uint32_t length)
+{
+    atomic_fetch_add(&instance->tail, length);
+
+    if (atomic_exchange(&instance->producerWaiting, false))
+    {
+        sem_post(&instance->space);
+    }
+}
+
+static void vm_ring_close(VmRing instance)
+{
+    atomic_store(&instance->closed, true);
+
+    if (atomic_exchange(&instance->consumerWaiting, false))
+    {
+        sem_post(&instance->data);
+    }
+}
+
+static void vm_ring_wait(sem_t* semaphore)
+{
+    while (sem_wait(semaphore) != 0 && errno == EINTR) { }
+}
+
+static void vm_ring_wait_data(VmRing instance)
+{
+    uint32_t offset;
+
+    atomic_store(&instance->consumerWaiting, true);
+
+    if (!vm_ring_readable(instance, &offset) &&
+        !atomic_load(&instance->closed))
+    {
+        vm_ring_wait(&instance->data);
+    }
+}
+
+static void vm_ring_wait_space(VmRing instance)
+{
+    uint32_t offset;
+
+    atomic_store(&instance->producerWaiting, true);
+
+    if (!vm_ring_writable(instance, &offset))
+    {
+        vm_ring_wait(&instance->space);
+    }
+}
+
+static uint32_t vm_async_read(void* context, uint8_t buffer[], uint32_t length)
+{
+    VmAsync instance = context;
+    VmRing ring = &instance->input;
+
+    for (;;)
+    {
+        uint32_t offset;
+        bool closed = atomic_load(&ring->closed);
+        uint32_t available = vm_ring_readable(ring, &offset);
+
+        if (available)
+        {
+            if (available > length)
+            {
+                available = length;
+            }
+
+            memcpy(buffer, ring->buffer + offset, available);
+            vm_ring_consume(ring, available);
+
+            return available;
+        }
+
+        if (closed)
+        {
+            return instance->suspends ? UM32_READER_SUSPEND : 0;
+        }
+
+        vm_ring_wait_data(ring);
+    }
+}
+
+static void vm_async_write(
+    void* context,
+    const uint8_t buffer[],
+    uint32_t length)
+{
+    VmAsync instance = context;
+    VmRing ring = &instance->output;
+
+    while (length)
+    {
+        uint32_t offset;
+        uint32_t available = vm_ring_writable(ring, &offset);
+
+        if (!available)
+        {
+            vm_ring_wait_space(ring);
+
+            continue;
+        }
+
+        if (available > length)
+        {
+            available = length;
+        }
+
+        memcpy(ring->buffer + offset, buffer, available);
+        vm_ring_produce(ring, available);
+
+        buffer += available;
+        length -= available;
+    }
+}
+
+static void* vm_async_output(void* context)
+{
+    VmAsync instance = context;
+    VmRing ring = &instance->output;
+
+    for (;;)
+    {
+        uint32_t offset;
+        bool closed = atomic_load(&ring->closed);
+        uint32_t available = vm_ring_readable(ring, &offset);
+
+        if (available)
+        {
+            fwrite(ring->buffer + offset, 1, available, stdout);
+            vm_ring_consume(ring, available);
+
+            continue;
+        }
+
+        // Output reaches the terminal whenever the ring runs dry, so prompts
+        // appear before the program waits for input.
+
+        fflush(stdout);
+
+        if (closed)
+        {
+            break;
+        }
+
+        vm_ring_wait_data(ring);
+    }
+
+    sem_post(&instance->drained);
+
+    return NULL;
+}
+
+static void* vm_async_input(void* context)
+{
+    VmRing ring = context;
+
+    for (;;)
+    {
+        uint32_t offset;
+        uint32_t available = vm_ring_writable(ring, &offset);
+
+        if (!available)
+        {
+            vm_ring_wait_space(ring);
+
+            continue;
+        }
+
+        ssize_t result = read(
+            STDIN_FILENO,
+            ring->buffer + offset,
+            available);
+
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (result <= 0)
+        {
+            break;
+        }
+
+        vm_ring_produce(ring, result);
+    }
+
+    vm_ring_close(ring);
+
+    return NULL;
+}
+
+static bool vm_async(VmAsync instance, bool suspends)
+{
+    sigset_t signals;
+    sigset_t previous;
+
+    instance->suspends = suspends;
+    instance->running = false;
+
+    if (!vm_ring(&instance->output))
+    {
+        return false;
+    }
+
+    if (!vm_ring(&instance->input))
+    {
+        finalize_vm_ring(&instance->output);
+
+        return false;
+    }
+
+    if (sem_init(&instance->drained, 0, 0) != 0)
+    {
+        finalize_vm_ring(&instance->input);
+        finalize_vm_ring(&instance->output);
+
+        return false;
+    }
+
+    // Interrupts and profiling ticks are left to the interpreter thread.
+
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGPROF);
+    pthread_sigmask(SIG_BLOCK, &signals, &previous);
+
+    int error = pthread_create(
+        &instance->writer,
+        NULL,
+        vm_async_output,
+        instance);
+
+    if (!error)
+    {
+        error = pthread_create(
+            &instance->reader,
+            NULL,
+            vm_async_input,
+            &instance->input);
+
+        if (error)
+        {
+            vm_ring_close(&instance->output);
+            pthread_join(instance->writer, NULL);
+        }
+    }
+
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+    if (error)
+    {
+        sem_destroy(&instance->drained);
+        finalize_vm_ring(&instance->input);
+        finalize_vm_ring(&instance->output);
+
+        errno = error;
+
+        return false;
+    }
+
+    instance->running = true;
+
+    return true;
+}
+
+// Waits until everything written so far has reached the standard output
+// stream. The writer thread exits once it has drained the ring.
+
+static void vm_async_drain(VmAsync instance)
+{
+    if (!instance || !instance->running)
+    {
+        return;
+    }
+
+    vm_ring_close(&instance->output);
+    vm_ring_wait(&instance->drained);
+
+    instance->running = false;
+}
+
+static void finalize_vm_async(VmAsync instance)
+{
+    if (!instance || !instance->output.buffer)
+    {
+        return;
+    }
+
+    vm_async_drain(instance);
+    pthread_join(instance->writer, NULL);
+
+    // The reader may be blocked on input that will never be consumed.
+
+    pthread_cancel(instance->reader);
+    pthread_join(instance->reader, NULL);
+    sem_destroy(&instance->drained);
+    finalize_vm_ring(&instance->input);
+    finalize_vm_ring(&instance->output);
+}
+
+static void vm_dump_raw(FILE* output, uint32_t values[], uint32_t length)
+{
+    if (length > UM32_VM_MAX_DUMP)
+    {
+        length = UM32_VM_MAX_DUMP;
+    }
+
+    while (length >= 4)
+    {
+        fprintf(
+            output,
+            "%08" PRIx32 " %08" PRIx32 " %08" PRIx32 " %08" PRIx32 "\n",
+            values[0], values[1], values[2], values[3]);
+
+        values += 4;
+        length -= 4;
+    }
+
+    if (!length)
+    {
+        fprintf(output, "\n");
+
+        return;
+    }
+
+    while (length)
+    {
+        fprintf(output, "%08" PRIx32 " ", *values);
+
+        values++;
+        length--;
+    }
+
+    fprintf(output, "\n\n");
+}
+
+static double vm_fragmentation(uint64_t words, uint64_t freeWords)
+{
+    if (!words && !freeWords)
+    {
+        return 0;
+    }
+
+    return freeWords * 100.0 / (words + freeWords);
+}
+
+void vm_dump_heap(FILE* output, Heap heap)
+{
+    struct HeapStats stats;
+
+    heap_stats(&stats, heap);
+    fprintf(output, 
+        "Heap:%22" PRIu64 " word(s)\n"
+        " %8" PRIu64 " alloc'ed, %8" PRIu64 " free'd\n"
+        " %19.2lf%% fragmentation\n", 
+        stats.size,
+        stats.arrays, stats.freeBlocks,
+        vm_fragmentation(stats.words, stats.freeWords));
+    vm_dump_raw(output, heap->segment.buffer, heap->segment.length);
+}
+
+static bool vm_sample(VmTimeline instance, Heap heap)
+{
+    struct HeapStats stats;
+
+    if (instance->count == instance->capacity)
+    {
+        uint32_t capacity = instance->capacity ? instance->capacity * 2 : 64;
+        struct VmSample* resized = realloc(
+            instance->samples,
+            capacity * sizeof * resized);
+
+        if (!resized)
+        {
+            return false;
+        }
+
+        instance->samples = resized;
+        instance->capacity = capacity;
+    }
+
+    heap_stats(&stats, heap);
+
+    instance->samples[instance->count] = (struct VmSample)
+    {
+        .executed = instance->executed,
+        .size = stats.size,
+        .arrays = stats.arrays,
+        .words = stats.words,
+        .freeWords = stats.freeWords
+    };
+    instance->count++;
+
+    return true;
+}
+
+static void vm_write_heap_stats(FILE* output, Heap heap, VmTimeline timeline)
+{
+    struct HeapStats stats;
+
+    heap_stats(&stats, heap);
+    fprintf(output,
+        "%-16s %16" PRIu64 "\n"
+        "%-16s %16" PRIu64 "\n"
+        "%-16s %16" PRIu64 "\n"
+        "%-16s %16" PRIu64 "\n"
+        "%-16s %16" PRIu64 "\n"
+        "%-16s %16" PRIu64 "\n"
+        "%-16s %16" PRIu64 "\n"
+        "%-16s %16" PRIu64 "\n"
+        "%-16s %16" PRIu64 "\n"
+        "%-16s %16" PRIu64 "\n"
+        "%-16s %15.2lf%%\n",
+        "Live arrays", stats.arrays,
+        "Live words", stats.words,
+        "Peak arrays", stats.peakArrays,
+        "Peak words", stats.peakWords,
+        "Allocations", stats.allocations,
+        "Frees", stats.frees,
+        "Words freed", stats.freedWords,
+        "Free blocks", stats.freeBlocks,
+        "Free words", stats.freeWords,
+        "Heap size", stats.size,
+        "Fragmentation", vm_fragmentation(stats.words, stats.freeWords));
+    fprintf(output, "\n%-16s %16s\n", "Array size", "Allocations");
+
+    // Bucket k holds the allocations of 2^(k - 1) to 2^k - 1 words.
+
+    for (uint32_t k = 0; k < UM32_HEAP_SIZES; k++)
+    {
+        char label[24];
+
+        if (!stats.sizes[k])
+        {
+            continue;
+        }
+
+        if (k < 2)
+        {
+            snprintf(label, sizeof label, "%" PRIu32, k);
+        }
+        else
+        {
+            snprintf(label, sizeof label,
+                "%" PRIu64 "-%" PRIu64,
+                (uint64_t)1 << (k - 1),
+                ((uint64_t)1 << k) - 1);
+        }
+
+        fprintf(output, "%-16s %16" PRIu64 "\n", label, stats.sizes[k]);
+    }
+
+    if (!timeline->count)
+    {
+        return;
+    }
+
+    fprintf(output,
+        "\n%16s %12s %12s %12s %12s %8s\n",
+        "Executed", "Heap size", "Live arrays", "Live words", "Free words",
+        "Frag.");
+
+    for (uint32_t i = 0; i < timeline->count; i++)
+    {
+        struct VmSample* sample = timeline->samples + i;
+
+        fprintf(output,
+            "%16" PRIu64 " %12" PRIu64 " %12" PRIu64 " %12" PRIu64
+            " %12" PRIu64 " %7.2lf%%\n",
+            sample->executed,
+            sample->size,
+            sample->arrays,
+            sample->words,
+            sample->freeWords,
+            vm_fragmentation(sample->words, sample->freeWords));
+    }
+}
+
+void vm_dump_machine(FILE* output, Machine machine)
+{
+    struct Segment program = machine->program;
+
+    if (machine->instructionPointer < program.length)
+    {
+        uint32_t word = program.buffer[machine->instructionPointer];
+
+        fprintf(output, "Instruction %08" PRIx32 ":\n",
+            machine->instructionPointer);
+        instruction_write_assembly(output, word);
+        fprintf(output, "\n");
+    }
+
+    fprintf(output, "Registers:%17d word(s)\n", UM32_MACHINE_REGISTERS);
+    vm_dump_raw(output, machine->registers, UM32_MACHINE_REGISTERS);
+    fprintf(output, "Program:%18" PRIu32 " words(s)\n", program.length);
+    vm_dump_raw(output, program.buffer, program.length);
+    vm_dump_heap(output, &machine->heap);
+}
+
+static void vm_handle_interrupt()
+{
+    machine_flush(vm_current);
+    vm_async_drain(vm_pipeline);
+    printf("\nProcess terminating with signal %d (SIGINT)\n", SIGINT);
+    vm_dump_machine(stderr, vm_current);
+    finalize_machine(vm_current);
+    exit(128 + SIGINT);
+}
+
+static void vm_handle_tick()
+{
+    atomic_fetch_add_explicit(&vm_ticks, 1, memory_order_relaxed);
+}
+
+static bool vm_arm(uint32_t frequency)
+{
+    struct itimerval timer = { 0 };
+
+    if (frequency)
+    {
+        timer.it_interval.tv_sec = 1 / frequency;
+        timer.it_interval.tv_usec = 1000000 / frequency % 1000000;
+        timer.it_value = timer.it_interval;
+
+        signal(SIGPROF, vm_handle_tick);
+    }
+
+    return setitimer(ITIMER_PROF, &timer, NULL) == 0;
+}
+
+static void vm_record(Sampler sampler, Machine instance)
+{
+    uint32_t ticks = atomic_exchange_explicit(
+        &vm_ticks,
+        0,
+        memory_order_relaxed);
+    uint32_t instructionPointer = instance->instructionPointer;
+    struct Sample sample =
+    {
+        .instructionPointer = instructionPointer,
+        .generation = instance->generation
+    };
+
+    if (instructionPointer < instance->program.length)
+    {
+        sample.word = instance->program.buffer[instructionPointer];
+    }
+
+    for (; ticks; ticks--)
+    {
+        sampler_push(sampler, sample);
+    }
+
+    if (sampler_backlog(sampler) >= UM32_SAMPLER_RING / 2)
+    {
+        sampler_drain(sampler);
+    }
+}
+
+// Slices vary in length around UM32_VM_SLICE instructions. A fixed length
+// would end every slice at the same offset of any loop whose length divides
+// it, and charge every tick to that one instruction.
+
+static uint64_t vm_slice(uint32_t* state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+
+    return UM32_VM_SLICE / 2 + x % UM32_VM_SLICE;
+}
+
+static void vm_write_samples(char* app, Sampler sampler, char* path)
+{
+    // Ticks that arrive after the last slice ends are never sampled.
+
+    vm_arm(0);
+    sampler_drain(sampler);
+
+    sampler->dropped += atomic_exchange(&vm_ticks, 0);
+
+    sampler_write(stderr, sampler);
+
+    FILE* output = fopen(path, "w");
+
+    if (!output ||
+        !sampler_write_folded(output, sampler) ||
+        fclose(output) != 0)
+    {
+        fprintf(stderr, "%s: %s: %s\n", app, path, strerror(errno));
+    }
+}
+
+static void vm_configure(Machine instance, VmOptions options)
+{
+    if (options->engine != ENGINES_COUNT)
+    {
+        instance->engine = options->engine;
+    }
+
+    if (options->mode != HEAP_MODES_COUNT)
+    {
+        instance->heap.mode = options->mode;
+    }
+
+    instance->heap.threshold = options->threshold;
+    instance->trusted = options->trusted;
+    instance->fused = options->fused;
+    instance->heap.histogram = options->heapStats;
+
+    if (options->huge)
+    {
+        instance->program.huge = true;
+        instance->heap.segment.huge = true;
+        instance->heap.chunks.huge = true;
+    }
+}
+
+static int vm_save(char* app, char* path, Machine instance)
+{
+    FILE* output = fopen(path, "wb");
+
+    if (!output)
+    {
+        finalize_machine(instance);
+        fprintf(stderr, "%s: %s: %s\n", app, path, strerror(errno));
+
+        return EXIT_FAILURE;
+    }
+
+    bool result = machine_checkpoint(output, instance);
+
+    if (fclose(output) != 0)
+    {
+        result = false;
+    }
+
+    finalize_machine(instance);
+
+    if (!result)
+    {
+        fprintf(stderr, "%s: %s: %s\n", app, path, strerror(errno));
+
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static int vm_finalize(
+    char* app,
+    Machine instance,
+    VmOptions options,
+    VmTimeline timeline,
+    Sampler sampler,
+    int result)
+{
+    Profile profile = instance->profile;
+
+    finalize_vm_async(vm_pipeline);
+
+    vm_pipeline = NULL;
+
+    if (options->heapStats)
+    {
+        vm_write_heap_stats(stderr, &instance->heap, timeline);
+    }
+
+    if (options->frequency)
+    {
+        vm_write_samples(app, sampler, options->folded);
+        finalize_sampler(sampler);
+    }
+
+    free(timeline->samples);
+
+    if (!profile)
+    {
+        finalize_machine(instance);
+
+        return result;
+    }
+
+    profile_rank(profile, &instance->program);
+    profile_begin(profile, PROFILE_PHASE_TEARDOWN);
+    finalize_machine(instance);
+    profile_end(profile, PROFILE_PHASE_TEARDOWN);
+    profile_write(stderr, profile);
+    finalize_profile(profile);
+
+    return result;
+}
+
+static int vm_run(
+    char* app,
+    char* path,
+    char* savePath,
+    char* restorePath,
+    VmOptions options)
+{
+    struct Machine um;
+    struct Profile report;
+    struct VmTimeline timeline = { 0 };
+    struct Sampler samples;
+    struct VmAsync pipeline = { 0 };
+    uint64_t next = options->timeline ? options->timeline : UINT64_MAX;
+    uint32_t seed = UM32_VM_SEED;
+    bool suspends = savePath;
+    bool created;
+
+    if (restorePath)
+    {
+        path = restorePath;
+    }
+
+    if (options->async)
+    {
+        created = machine_stream(
+            &um,
+            vm_async_read,
+            vm_async_write,
+            &pipeline);
+    }
+    else
+    {
+        created = machine_stream(&um, vm_read, vm_write, &suspends);
+    }
+
+    if (!created)
+    {
+        fprintf(stderr, "%s: %s\n", app, strerror(errno));
+
+        return EXIT_FAILURE;
+    }
+
+    vm_configure(&um, options);
+
+    if (options->profiled)
+    {
+        um.profile = &report;
+
+        profile(&report);
+        profile_begin(&report, PROFILE_PHASE_LOAD);
+    }
+
+    vm_current = &um;
+
+    signal(SIGINT, vm_handle_interrupt);
+
+    FILE* input = fopen(path, "rb");
+
+    if (!input)
+    {
+        finalize_machine(&um);
+        fprintf(stderr, "%s: %s: %s\n", app, path, strerror(errno));
+
+        return EXIT_FAILURE;
+    }
+
+    if (restorePath ?
+        !machine_restore(&um, input) :
+        !machine_read_program(&um, input))
+    {
+        fclose(input);
+        finalize_machine(&um);
+        fprintf(stderr, "%s: %s\n", app, strerror(errno));
+
+        return EXIT_FAILURE;
+    }
+
+    if (fclose(input) != 0)
+    {
+        finalize_machine(&um);
+        fprintf(stderr, "%s: %s: %s\n", app, path, strerror(errno));
+
+        return EXIT_FAILURE;
+    }
+
+    if (um.profile)
+    {
+        profile_end(&report, PROFILE_PHASE_LOAD);
+        profile_begin(&report, PROFILE_PHASE_EXECUTE);
+    }
+
+    // The instruction pointer only leaves the interpreter's registers when
+    // the machine stops, so a tick just counts itself and the sample is
+    // taken when the current slice of instructions runs out, at an offset
+    // that the varying slice lengths keep from lining up with any loop.
+
+    if (options->frequency)
+    {
+        if (!sampler(&samples))
+        {
+            finalize_machine(&um);
+            fprintf(stderr, "%s: %s\n", app, strerror(errno));
+
+            return EXIT_FAILURE;
+        }
+
+        if (!vm_arm(options->frequency))
+        {
+            finalize_sampler(&samples);
+            finalize_machine(&um);
+            fprintf(stderr, "%s: %s\n", app, strerror(errno));
+
+            return EXIT_FAILURE;
+        }
+    }
+
+    // The helper threads start last, so that nothing is read from the
+    // standard input stream unless the program actually runs.
+
+    if (options->async)
+    {
+        if (!vm_async(&pipeline, suspends))
+        {
+            fprintf(stderr, "%s: %s\n", app, strerror(errno));
+
+            return vm_finalize(
+                app,
+                &um,
+                options,
+                &timeline,
+                &samples,
+                EXIT_FAILURE);
+        }
+
+        vm_pipeline = &pipeline;
+    }
+
+    Fault fault;
+
+    do
+    {
+        uint64_t budget = next - timeline.executed;
+        uint64_t executed;
+
+        if (options->frequency)
+        {
+            uint64_t slice = vm_slice(&seed);
+
+            if (budget > slice)
+            {
+                budget = slice;
+            }
+        }
+
+        fault = machine_run(&um, budget, &executed);
+        timeline.executed += executed;
+
+        // The machine only stops without a fault when its budget runs out,
+        // which is when the timeline and the sampler take their samples.
+
+        if (!fault)
+        {
+            if (timeline.executed >= next)
+            {
+                next += options->timeline;
+
+                if (!vm_sample(&timeline, &um.heap))
+                {
+                    fprintf(stderr, "%s: %s\n", app, strerror(errno));
+
+                    return vm_finalize(
+                        app,
+                        &um,
+                        options,
+                        &timeline,
+                        &samples,
+                        EXIT_FAILURE);
+                }
+            }
+
+            if (options->frequency)
+            {
+                vm_record(&samples, &um);
+            }
+
+            continue;
+        }
+
+        if (um.profile)
+        {
+            profile_end(&report, PROFILE_PHASE_EXECUTE);
+        }
+
+        // The machine has already flushed its stream, so draining the
+        // pipeline puts every output byte before any report that follows.
+
+        finalize_vm_async(vm_pipeline);
+
+        vm_pipeline = NULL;
+
+        if (fault == FAULT_SUSPENDED && savePath)
+        {
+            int result = vm_save(app, savePath, &um);
+
+            finalize_profile(&report);
+            free(timeline.samples);
+
+            if (options->frequency)
+            {
+                vm_arm(0);
+                finalize_sampler(&samples);
+            }
+
+            return result;
+        }
+
+        if (um32_fault_is_stopped(fault))
+        {
+            fprintf(stderr, "%s: %s\n", path, fault_to_string(fault));
+            vm_dump_machine(stderr, &um);
+
+            return vm_finalize(
+                app,
+                &um,
+                options,
+                &timeline,
+                &samples,
+                EXIT_FAILURE);
+        }
+    } 
+    while (um32_fault_is_stopped(fault));
+
+#ifdef UM32_VM_DEBUG
+        finalize_vm_async(vm_pipeline);
+
+        vm_pipeline = NULL;
+
+        printf("%s: %s\n", path, fault_to_string(fault));
+        vm_dump_machine(stdout, &um);
+#endif
+    
+    return vm_finalize(
+        app,
+        &um,
+        options,
+        &timeline,
+        &samples,
+        EXIT_SUCCESS);
+}
+
+static uint32_t vm_job_read(void* context, uint8_t buffer[], uint32_t length)
+{
+    VmJob instance = context;
+
+    if (!instance->stream)
+    {
+        return 0;
+    }
+
+    return fread(buffer, sizeof * buffer, length, instance->stream);
+}
+
+static void vm_job_write(
+    void* context,
+    const uint8_t buffer[],
+    uint32_t length)
+{
+    VmJob instance = context;
+
+    if (instance->capacity - instance->length < length)
+    {
+        size_t capacity = instance->capacity * 2;
+
+        if (capacity < instance->length + length)
+        {
+            capacity = instance->length + length;
+        }
+
+        uint8_t* resized = realloc(instance->buffer, capacity);
+
+        if (!resized)
+        {
+            instance->error = ENOMEM;
 
-static uint8_t vm_read()
-{
-    int result = getchar();
+            return;
+        }
 
-    if (result == EOF)
-    {
-        return -1;
+        instance->buffer = resized;
+        instance->capacity = capacity;
     }
 
-    return result;
-}
+    memcpy(instance->buffer + instance->length, buffer, length);
 
-static void vm_write(uint8_t value)
-{
-    putchar(value);
+    instance->length += length;
 }
 
-static void vm_dump_raw(FILE* output, uint32_t values[], uint32_t length)
+static void vm_job_execute(VmJob instance, VmOptions options)
 {
-    if (length > UM32_VM_MAX_DUMP)
+    struct Machine machine;
+
+    if (instance->input)
     {
-        length = UM32_VM_MAX_DUMP;
+        instance->stream = fopen(instance->input, "rb");
+
+        if (!instance->stream)
+        {
+            instance->error = errno;
+
+            return;
+        }
     }
 
-    while (length >= 4)
+    if (!machine_stream(&machine, vm_job_read, vm_job_write, instance))
     {
-        fprintf(
-            output,
-            "%08" PRIx32 " %08" PRIx32 " %08" PRIx32 " %08" PRIx32 "\n",
-            values[0], values[1], values[2], values[3]);
+        instance->error = errno;
 
-        values += 4;
-        length -= 4;
+        return;
     }
 
-    if (!length)
+    vm_configure(&machine, options);
+
+    FILE* program = fopen(instance->program, "rb");
+
+    if (!program)
     {
-        fprintf(output, "\n");
+        instance->error = errno;
+
+        finalize_machine(&machine);
 
         return;
     }
 
-    while (length)
+    if (!machine_read_program(&machine, program))
     {
-        fprintf(output, "%08" PRIx32 " ", *values);
+        instance->error = errno;
 
-        values++;
-        length--;
+        fclose(program);
+        finalize_machine(&machine);
+
+        return;
     }
 
-    fprintf(output, "\n\n");
+    if (fclose(program) != 0)
+    {
+        instance->error = errno;
+
+        finalize_machine(&machine);
+
+        return;
+    }
+
+    instance->fault = machine_run(&machine, UINT64_MAX, NULL);
+
+    finalize_machine(&machine);
 }
 
-void vm_dump_heap(FILE* output, Heap heap)
+static bool vm_batch_take(VmBatch instance, uint32_t worker, uint32_t* result)
 {
-    struct HeapBlock it;
-    uint32_t allocated = 0;
-    uint32_t freed = 0;
-    uint32_t allocatedSize = 0;
-    uint32_t freedSize = 0;
+    VmQueue queue = instance->queues + worker;
+    bool taken = false;
 
-    for (heap_first(&it); heap_next(&it, heap); )
+    pthread_mutex_lock(&queue->lock);
+
+    if (queue->begin < queue->end)
     {
-        if (it.allocated) 
-        {
-            allocated++;
-            allocatedSize += it.capacity;
-        }
-        else 
+        *result = queue->begin;
+        queue->begin++;
+        taken = true;
+    }
+
+    pthread_mutex_unlock(&queue->lock);
+
+    // An idle worker steals from the far end of another worker's range, away
+    // from the jobs that its owner is about to take.
+
+    for (uint32_t i = 1; !taken && i < instance->workers; i++)
+    {
+        queue = instance->queues + (worker + i) % instance->workers;
+
+        pthread_mutex_lock(&queue->lock);
+
+        if (queue->begin < queue->end)
         {
-            freed++;
-            freedSize += it.capacity;
+            queue->end--;
+            *result = queue->end;
+            taken = true;
         }
+
+        pthread_mutex_unlock(&queue->lock);
     }
-    
-    fprintf(output, 
-        "Heap:%22" PRIu32 " word(s)\n"
-        " %8" PRId32 " alloc'ed, %8" PRId32 " free'd\n"
-        " %19.2lf%% fragmentation\n", 
-        heap->segment.capacity,
-        allocated, freed,
-        (double)freedSize * 100.0 / (allocatedSize + freedSize));
-    vm_dump_raw(output, heap->segment.buffer, heap->segment.length);
+
+    return taken;
 }
 
-void vm_dump_machine(FILE* output, Machine machine)
+static void* vm_batch_work(void* context)
 {
-    struct Segment program = machine->program;
+    VmWorker instance = context;
+    VmBatch batch = instance->batch;
+    uint32_t index;
 
-    if (machine->instructionPointer < program.length)
+    while (vm_batch_take(batch, instance->index, &index))
     {
-        uint32_t word = program.buffer[machine->instructionPointer];
+        VmJob job = batch->jobs + index;
 
-        fprintf(output, "Instruction %08" PRIx32 ":\n",
-            machine->instructionPointer);
-        instruction_write_assembly(output, word);
-        fprintf(output, "\n");
+        vm_job_execute(job, batch->options);
+
+        if (job->stream)
+        {
+            fclose(job->stream);
+
+            job->stream = NULL;
+        }
+
+        pthread_mutex_lock(&batch->lock);
+
+        job->done = true;
+
+        pthread_cond_broadcast(&batch->finished);
+        pthread_mutex_unlock(&batch->lock);
     }
 
-    fprintf(output, "Registers:%17d word(s)\n", UM32_MACHINE_REGISTERS);
-    vm_dump_raw(output, machine->registers, UM32_MACHINE_REGISTERS);
-    fprintf(output, "Program:%18" PRIu32 " words(s)\n", program.length);
-    vm_dump_raw(output, program.buffer, program.length);
-    vm_dump_heap(output, &machine->heap);
+    return NULL;
 }
 
-static void vm_handle_interrupt()
+static bool vm_batch_read(VmBatch instance, FILE* input)
 {
-    printf("\nProcess terminating with signal %d (SIGINT)\n", SIGINT);
-    vm_dump_machine(stderr, &um);
-    finalize_machine(&um);
-    exit(128 + SIGINT);
+    char buffer[UM32_VM_LINE];
+    uint32_t capacity = 0;
+
+    while (fgets(buffer, sizeof buffer, input))
+    {
+        char* state;
+        char* program = strtok_r(buffer, " \t\r\n", &state);
+
+        if (!program)
+        {
+            continue;
+        }
+
+        char* in = strtok_r(NULL, " \t\r\n", &state);
+        char* out = in ? strtok_r(NULL, " \t\r\n", &state) : NULL;
+
+        if (instance->count == capacity)
+        {
+            VmJob jobs;
+
+            capacity = capacity ? capacity * 2 : UM32_VM_JOBS;
+            jobs = realloc(instance->jobs, capacity * sizeof * jobs);
+
+            if (!jobs)
+            {
+                return false;
+            }
+
+            instance->jobs = jobs;
+        }
+
+        VmJob job = instance->jobs + instance->count;
+
+        memset(job, 0, sizeof * job);
+
+        job->program = strdup(program);
+        job->input = in && strcmp(in, "-") != 0 ? strdup(in) : NULL;
+        job->output = out ? strdup(out) : NULL;
+        instance->count++;
+
+        if (!job->program || (in && strcmp(in, "-") && !job->input) ||
+            (out && !job->output))
+        {
+            return false;
+        }
+    }
+
+    return !ferror(input);
 }
 
-int main(int count, char* args[])
+static bool vm_batch_report(char* app, VmJob job)
 {
-    signal(SIGINT, vm_handle_interrupt);
+    bool result = true;
 
-    char* app = args[0];
+    if (job->output)
+    {
+        FILE* output = fopen(job->output, "wb");
+
+        if (!output ||
+            fwrite(job->buffer, 1, job->length, output) != job->length ||
+            fclose(output) != 0)
+        {
+            fprintf(stderr,
+                "%s: %s: %s\n", app, job->output, strerror(errno));
 
-    if (count < 2)
+            result = false;
+        }
+    }
+    else
     {
-        fprintf(stderr, "Usage: %s FILE\n", app);
+        fwrite(job->buffer, 1, job->length, stdout);
+    }
 
-        return EXIT_FAILURE;
+    if (job->error)
+    {
+        fprintf(stderr,
+            "%s: %s: %s\n", app, job->program, strerror(job->error));
+
+        return false;
     }
 
-    if (!machine(&um, vm_read, vm_write))
+    if (um32_fault_is_stopped(job->fault))
     {
-        fprintf(stderr, "%s: %s\n", app, strerror(errno));
+        fprintf(stderr, "%s: %s\n", job->program, fault_to_string(job->fault));
 
-        return EXIT_FAILURE;
+        return false;
     }
 
-    char* path = args[1];
-    FILE* input = fopen(path, "rb");
+    return result;
+}
+
+static void finalize_vm_batch(VmBatch instance)
+{
+    for (uint32_t i = 0; i < instance->count; i++)
+    {
+        free(instance->jobs[i].program);
+        free(instance->jobs[i].input);
+        free(instance->jobs[i].output);
+        free(instance->jobs[i].buffer);
+    }
+
+    free(instance->jobs);
+    free(instance->queues);
+}
+
+static int vm_batch(char* app, char* path, uint32_t workers, VmOptions options)
+{
+    struct VmBatch batch =
+    {
+        .options = options
+    };
+    FILE* input = fopen(path, "r");
 
     if (!input)
     {
-        finalize_machine(&um);
         fprintf(stderr, "%s: %s: %s\n", app, path, strerror(errno));
 
         return EXIT_FAILURE;
     }
 
-    if (!machine_read_program(&um, input))
+    if (!vm_batch_read(&batch, input) || fclose(input) != 0)
     {
-        fclose(input);
-        finalize_machine(&um);
-        fprintf(stderr, "%s: %s\n", app, strerror(errno));
+        fprintf(stderr, "%s: %s: %s\n", app, path, strerror(errno));
+        finalize_vm_batch(&batch);
 
         return EXIT_FAILURE;
     }
 
-    if (fclose(input) != 0)
+    if (workers > batch.count)
     {
-        finalize_machine(&um);
-        fprintf(stderr, "%s: %s: %s\n", app, path, strerror(errno));
+        workers = batch.count;
+    }
+
+    VmWorker pool = calloc(workers + 1, sizeof * pool);
+
+    batch.workers = workers;
+    batch.queues = calloc(workers + 1, sizeof * batch.queues);
+
+    if (!pool || !batch.queues)
+    {
+        fprintf(stderr, "%s: %s\n", app, strerror(errno));
+        free(pool);
+        finalize_vm_batch(&batch);
 
         return EXIT_FAILURE;
     }
 
-    Fault fault;
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.finished, NULL);
 
-    do
+    // Each worker starts with a contiguous share of the list and steals once
+    // its own share runs out.
+
+    for (uint32_t i = 0; i < workers; i++)
     {
-        fault = machine_execute(&um);
+        pthread_mutex_init(&batch.queues[i].lock, NULL);
 
-        if (fault && um32_fault_is_stopped(fault))
+        batch.queues[i].begin = (uint64_t)batch.count * i / workers;
+        batch.queues[i].end = (uint64_t)batch.count * (i + 1) / workers;
+    }
+
+    uint32_t started = 0;
+
+    for (; started < workers; started++)
+    {
+        pool[started].batch = &batch;
+        pool[started].index = started;
+
+        if (pthread_create(
+            &pool[started].thread,
+            NULL,
+            vm_batch_work,
+            pool + started) != 0)
         {
-            fprintf(stderr, "%s: %s\n", path, fault_to_string(fault));
-            vm_dump_machine(stderr, &um);
-            finalize_machine(&um);
+            break;
+        }
+    }
 
-            return EXIT_FAILURE;
+    // The jobs of workers that failed to start are stolen by the others, or
+    // run here if no thread could be started at all.
+
+    if (!started && workers)
+    {
+        pool->batch = &batch;
+        pool->index = 0;
+
+        vm_batch_work(pool);
+    }
+
+    int result = EXIT_SUCCESS;
+
+    for (uint32_t i = 0; i < batch.count; i++)
+    {
+        VmJob job = batch.jobs + i;
+
+        pthread_mutex_lock(&batch.lock);
+
+        while (!job->done)
+        {
+            pthread_cond_wait(&batch.finished, &batch.lock);
         }
-    } 
-    while (um32_fault_is_stopped(fault));
 
-#ifdef UM32_VM_DEBUG
-        printf("%s: %s\n", path, fault_to_string(fault));
-        vm_dump_machine(stdout, &um);
-#endif
-    
-    finalize_machine(&um);
+        pthread_mutex_unlock(&batch.lock);
 
-    return EXIT_SUCCESS;
+        if (!vm_batch_report(app, job))
+        {
+            result = EXIT_FAILURE;
+        }
+
+        free(job->buffer);
+
+        job->buffer = NULL;
+    }
+
+    fflush(stdout);
+
+    for (uint32_t i = 0; i < started; i++)
+    {
+        pthread_join(pool[i].thread, NULL);
+    }
+
+    for (uint32_t i = 0; i < workers; i++)
+    {
+        pthread_mutex_destroy(&batch.queues[i].lock);
+    }
+
+    pthread_mutex_destroy(&batch.lock);
+    pthread_cond_destroy(&batch.finished);
+    free(pool);
+    finalize_vm_batch(&batch);
+
+    return result;
+}
+
+static int vm_usage(char* app)
+{
+    fprintf(stderr,
+        "Usage: %s [--engine switch|threaded|jit] "
+        "[--heap arena|handles|chunks] [--threshold WORDS] [--huge-pages] "
+        "[--trusted] [--fuse] [--profile] [--heap-stats] "
+        "[--heap-timeline INSTRUCTIONS] [--sample HZ] [--folded FILE] "
+        "[--async-io] [--save CHECKPOINT] FILE | --restore CHECKPOINT\n"
+        "       %s --jobs N [OPTIONS] LIST\n",
+        app, app);
+
+    return EXIT_FAILURE;
+}
+
+static bool vm_parse(char* value, uint32_t* result)
+{
+    char* end;
+    unsigned long parsed = strtoul(value, &end, 10);
+
+    if (!*value || *end || parsed > UINT32_MAX)
+    {
+        return false;
+    }
+
+    *result = parsed;
+
+    return true;
+}
+
+int main(int count, char* args[])
+{
+    char* app = args[0];
+    char* path = NULL;
+    char* savePath = NULL;
+    char* restorePath = NULL;
+    uint32_t jobs = 0;
+    struct VmOptions options =
+    {
+        .engine = ENGINES_COUNT,
+        .mode = HEAP_MODES_COUNT,
+        .threshold = UM32_HEAP_THRESHOLD,
+        .folded = UM32_VM_FOLDED
+    };
+
+    for (int i = 1; i < count; i++)
+    {
+        if (strcmp(args[i], "--engine") == 0 && i + 1 < count)
+        {
+            options.engine = engine_from_string(args[++i]);
+
+            if (options.engine == ENGINES_COUNT)
+            {
+                return vm_usage(app);
+            }
+        }
+        else if (strcmp(args[i], "--heap") == 0 && i + 1 < count)
+        {
+            options.mode = heap_mode_from_string(args[++i]);
+
+            if (options.mode == HEAP_MODES_COUNT)
+            {
+                return vm_usage(app);
+            }
+        }
+        else if (strcmp(args[i], "--threshold") == 0 && i + 1 < count)
+        {
+            if (!vm_parse(args[++i], &options.threshold))
+            {
+                return vm_usage(app);
+            }
+        }
+        else if (strcmp(args[i], "--huge-pages") == 0)
+        {
+            options.huge = true;
+        }
+        else if (strcmp(args[i], "--trusted") == 0)
+        {
+            options.trusted = true;
+        }
+        else if (strcmp(args[i], "--fuse") == 0)
+        {
+            options.fused = true;
+        }
+        else if (strcmp(args[i], "--profile") == 0)
+        {
+            options.profiled = true;
+        }
+        else if (strcmp(args[i], "--heap-stats") == 0)
+        {
+            options.heapStats = true;
+        }
+        else if (strcmp(args[i], "--heap-timeline") == 0 && i + 1 < count)
+        {
+            if (!vm_parse(args[++i], &options.timeline) || !options.timeline)
+            {
+                return vm_usage(app);
+            }
+
+            options.heapStats = true;
+        }
+        else if (strcmp(args[i], "--sample") == 0 && i + 1 < count)
+        {
+            if (!vm_parse(args[++i], &options.frequency) ||
+                !options.frequency ||
+                options.frequency > 1000000)
+            {
+                return vm_usage(app);
+            }
+        }
+        else if (strcmp(args[i], "--folded") == 0 && i + 1 < count)
+        {
+            options.folded = args[++i];
+        }
+        else if (strcmp(args[i], "--async-io") == 0)
+        {
+            options.async = true;
+        }
+        else if (strcmp(args[i], "--save") == 0 && i + 1 < count)
+        {
+            savePath = args[++i];
+        }
+        else if (strcmp(args[i], "--restore") == 0 && i + 1 < count)
+        {
+            restorePath = args[++i];
+        }
+        else if (strcmp(args[i], "--jobs") == 0 && i + 1 < count)
+        {
+            if (!vm_parse(args[++i], &jobs) || !jobs)
+            {
+                return vm_usage(app);
+            }
+        }
+        else if (!path)
+        {
+            path = args[i];
+        }
+        else
+        {
+            return vm_usage(app);
+        }
+    }
+
+    if (jobs)
+    {
+        if (!path ||
+            savePath ||
+            restorePath ||
+            options.profiled ||
+            options.heapStats ||
+            options.frequency ||
+            options.async)
+        {
+            return vm_usage(app);
+        }
+
+        return vm_batch(app, path, jobs, &options);
+    }
+
+    if (!path == !restorePath)
+    {
+        return vm_usage(app);
+    }
+
+    return vm_run(app, path, savePath, restorePath, &options);
 }
@@ -4,4 +4,15 @@
 
 // http://boundvariable.org
 
+#ifndef UM32_WRITER
+#define UM32_WRITER
+#include <stdint.h>
+
 typedef void (*Writer)(uint8_t value);
+
+typedef void (*BlockWriter)(
+    void* context,
+    const uint8_t buffer[],
+    uint32_t length);
+
+#endif